@@ -0,0 +1,184 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Measure the epoll system calls made per client call for each
+// epoll mode of the RMC transport. Each mode runs a local client
+// and server node, forked into processes of their own, and reports
+// the epoll_wait() and epoll_ctl() calls made by both per call.
+//
+// Usage: epoll_syscalls [calls] [calls_per_iteration]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "dstc.h"
+
+#define SETUP_TIMEOUT 10000000 // usec
+
+DSTC_CLIENT(epoll_sink, int,)
+DSTC_SERVER(epoll_sink, int,)
+
+static char* mode_names[] = { "level", "edge", "immediate" };
+static uint8_t modes[] = { DSTC_EPOLL_IMMEDIATE, DSTC_EPOLL_LEVEL, DSTC_EPOLL_EDGE };
+static int received = 0;
+static int delivered = 0;
+
+void epoll_sink(int value)
+{
+    received++;
+}
+
+static void sink_complete(void* user_data, int status)
+{
+    delivered = 1;
+}
+
+// Report the epoll system calls made since start through fd.
+static void report(int fd, dstc_epoll_stats_t* start)
+{
+    dstc_epoll_stats_t end;
+
+    dstc_get_epoll_stats(&end);
+    end.waits -= start->waits;
+    end.ctls -= start->ctls;
+    end.interest_changes -= start->interest_changes;
+    end.edge_reads -= start->edge_reads;
+
+    if (write(fd, &end, sizeof(end)) != sizeof(end)) {
+        perror("write");
+        exit(1);
+    }
+}
+
+static void run_server(int fd, uint8_t mode, int call_count)
+{
+    dstc_epoll_stats_t start;
+
+    dstc_set_epoll_mode(mode);
+    dstc_setup();
+
+    // The client counts from its first call.
+    while(!received)
+        dstc_process_events(-1);
+
+    dstc_get_epoll_stats(&start);
+    while(received < call_count)
+        dstc_process_events(-1);
+
+    report(fd, &start);
+
+    // Keep acknowledging until the parent kills us.
+    dstc_process_events(-1);
+    exit(0);
+}
+
+static void run_client(int fd, uint8_t mode, int call_count, int batch)
+{
+    dstc_epoll_stats_t start;
+    int ind = 0;
+
+    dstc_set_epoll_mode(mode);
+    dstc_setup();
+
+    if (dstc_wait_for_remote("epoll_sink", SETUP_TIMEOUT) == ETIME)
+        exit(1);
+
+    dstc_get_epoll_stats(&start);
+    for(ind = 0; ind < call_count - 1; ++ind) {
+        dstc_epoll_sink(ind);
+
+        if (ind % batch == batch - 1)
+            dstc_process_events(0);
+    }
+
+    DSTC_ON_COMPLETE(sink_complete, 0, dstc_epoll_sink(ind));
+    while(!delivered)
+        dstc_process_events(-1);
+
+    report(fd, &start);
+    exit(0);
+}
+
+int main(int argc, char* argv[])
+{
+    int call_count = (argc > 1)?atoi(argv[1]):100000;
+    int batch = (argc > 2)?atoi(argv[2]):1;
+    int ind = 0;
+
+    if (call_count < 2 || batch < 1) {
+        fprintf(stderr, "Usage: %s [calls (>1)] [calls_per_iteration (>0)]\n", argv[0]);
+        exit(255);
+    }
+
+    printf("%d calls, %d calls per event loop iteration\n\n", call_count, batch);
+    printf("%-10s %13s %13s %13s %13s %13s\n",
+           "mode", "client waits", "client ctls", "server waits", "server ctls", "changes");
+
+    // DSTC state is process wide, so each node gets a fresh process.
+    for(ind = 0; ind < sizeof(modes) / sizeof(modes[0]); ++ind) {
+        dstc_epoll_stats_t client;
+        dstc_epoll_stats_t server;
+        int client_fds[2];
+        int server_fds[2];
+        pid_t server_pid = 0;
+        pid_t client_pid = 0;
+        int status = 0;
+
+        if (pipe(client_fds) == -1 || pipe(server_fds) == -1) {
+            perror("pipe");
+            exit(255);
+        }
+        fflush(stdout);
+
+        if (!(server_pid = fork()))
+            run_server(server_fds[1], modes[ind], call_count);
+
+        if (server_pid == -1) {
+            perror("fork");
+            exit(255);
+        }
+
+        if (!(client_pid = fork()))
+            run_client(client_fds[1], modes[ind], call_count, batch);
+
+        if (client_pid == -1) {
+            perror("fork");
+            kill(server_pid, SIGTERM);
+            exit(255);
+        }
+
+        waitpid(client_pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+            read(client_fds[0], &client, sizeof(client)) != sizeof(client) ||
+            read(server_fds[0], &server, sizeof(server)) != sizeof(server)) {
+            fprintf(stderr, "Mode %s failed\n", mode_names[modes[ind]]);
+            kill(server_pid, SIGTERM);
+            exit(1);
+        }
+
+        kill(server_pid, SIGTERM);
+        waitpid(server_pid, 0, 0);
+        close(client_fds[0]);
+        close(client_fds[1]);
+        close(server_fds[0]);
+        close(server_fds[1]);
+
+        // System calls per client call.
+        printf("%-10s %13.3f %13.3f %13.3f %13.3f %13.3f\n",
+               mode_names[modes[ind]],
+               (double) client.waits / call_count,
+               (double) client.ctls / call_count,
+               (double) server.waits / call_count,
+               (double) server.ctls / call_count,
+               (double) (client.interest_changes + server.interest_changes) / call_count);
+    }
+    exit(0);
+}
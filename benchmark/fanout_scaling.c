@@ -0,0 +1,381 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Measure how DSTC scales with the number of nodes over the real
+// multicast path. For each combination of publisher and subscriber
+// counts, doubling from one up to the given max, local publisher
+// and subscriber processes are forked. Each publisher calls all
+// subscribers at the given rate for the given time. Aggregate
+// throughput, the lowest per subscriber delivery rate, CPU time per
+// call, and median and 99th percentile latency are reported.
+//
+// Usage: fanout_scaling [max_publishers] [max_subscribers] [calls_per_sec] [payload_size] [duration_msec]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "dstc.h"
+
+#define SETUP_TIMEOUT 5000000 // usec
+#define DRAIN_TIMEOUT 5000000 // usec
+#define LATENCY_SAMPLES 4096  // Per subscriber
+
+DSTC_CLIENT(scale_sink, int,, uint32_t,, usec_timestamp_t,, DECL_DYNAMIC_ARG)
+DSTC_CLIENT(scale_done, int,)
+
+// Reported by each publisher through its pipe.
+typedef struct {
+    uint64_t sent;
+    uint32_t subscribers;       // Reached before the timeout
+    usec_timestamp_t start_ts;
+    usec_timestamp_t end_ts;    // All calls delivered
+    usec_timestamp_t cpu_usec;
+} publisher_result_t;
+
+// Reported by each subscriber through its pipe,
+// followed by sample_count latency samples.
+typedef struct {
+    uint64_t received;
+    usec_timestamp_t cpu_usec;
+    uint32_t publishers_done;
+    uint32_t sample_count;
+} subscriber_result_t;
+
+static subscriber_result_t sub_result;
+static usec_timestamp_t samples[LATENCY_SAMPLES];
+static int delivered = 0;
+
+static void scale_sink(int publisher, uint32_t seq, usec_timestamp_t sent_ts, dstc_dynamic_data_t payload)
+{
+    usec_timestamp_t latency = rmc_usec_monotonic_timestamp() - sent_ts;
+    uint64_t slot = sub_result.received++;
+
+    // Reservoir sampling keeps a uniform sample of all latencies.
+    if (slot >= LATENCY_SAMPLES)
+        slot = rand() % (slot + 1);
+
+    if (slot < LATENCY_SAMPLES)
+        samples[slot] = latency;
+}
+
+static void scale_done(int publisher)
+{
+    sub_result.publishers_done++;
+}
+
+// The servers are only registered by subscribers, so that publishers
+// do not call each other.
+static DSTC_SERVER_INTERNAL(scale_sink, int,, uint32_t,, usec_timestamp_t,, DECL_DYNAMIC_ARG)
+static DSTC_SERVER_INTERNAL(scale_done, int,)
+
+static void sink_handler(void* ctx, rmc_node_id_t node_id, uint8_t* data)
+{
+    dstc_server_scale_sink(node_id, data);
+}
+
+static void done_handler(void* ctx, rmc_node_id_t node_id, uint8_t* data)
+{
+    dstc_server_scale_done(node_id, data);
+}
+
+static void done_complete(void* user_data, int status)
+{
+    delivered = 1;
+}
+
+static usec_timestamp_t cpu_usec(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return (usec_timestamp_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+        usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static void run_subscriber(int fd, int publisher_count, usec_timestamp_t duration)
+{
+    usec_timestamp_t timeout_ts = 0;
+    usec_timestamp_t start_cpu = 0;
+
+    // Avoid identical random node ids in forked processes.
+    srand(getpid() ^ rmc_usec_monotonic_timestamp());
+    dstc_register_local_function_ctx("scale_sink", sink_handler, 0);
+    dstc_register_local_function_ctx("scale_done", done_handler, 0);
+    dstc_setup();
+
+    start_cpu = cpu_usec();
+    timeout_ts = rmc_usec_monotonic_timestamp() + SETUP_TIMEOUT + duration + DRAIN_TIMEOUT;
+    while(sub_result.publishers_done < publisher_count &&
+          rmc_usec_monotonic_timestamp() < timeout_ts)
+        dstc_process_events(10000);
+
+    sub_result.cpu_usec = cpu_usec() - start_cpu;
+    sub_result.sample_count = (sub_result.received < LATENCY_SAMPLES)?sub_result.received:LATENCY_SAMPLES;
+    if (write(fd, &sub_result, sizeof(sub_result)) != sizeof(sub_result) ||
+        write(fd, samples, sizeof(usec_timestamp_t) * sub_result.sample_count) !=
+        sizeof(usec_timestamp_t) * sub_result.sample_count) {
+        perror("write");
+        exit(1);
+    }
+
+    // Keep acknowledging until the parent kills us.
+    while(1)
+        dstc_process_events(-1);
+}
+
+static void run_publisher(int fd, int index, int subscriber_count,
+                          int rate, uint32_t payload_size, usec_timestamp_t duration)
+{
+    publisher_result_t result = { 0 };
+    uint8_t* payload = calloc(1, payload_size);
+    usec_timestamp_t timeout_ts = 0;
+    usec_timestamp_t start_cpu = 0;
+    usec_timestamp_t now = 0;
+
+    srand(getpid() ^ rmc_usec_monotonic_timestamp());
+    dstc_setup();
+
+    timeout_ts = rmc_usec_monotonic_timestamp() + SETUP_TIMEOUT;
+    while(dstc_get_remote_count("scale_sink") < subscriber_count &&
+          rmc_usec_monotonic_timestamp() < timeout_ts)
+        dstc_process_events(10000);
+
+    result.subscribers = dstc_get_remote_count("scale_sink");
+    start_cpu = cpu_usec();
+    result.start_ts = rmc_usec_monotonic_timestamp();
+
+    // Send the calls due so far, then wait for the next one.
+    while((now = rmc_usec_monotonic_timestamp()) < result.start_ts + duration) {
+        uint64_t due = (uint64_t) (now - result.start_ts) * rate / 1000000;
+
+        while(result.sent < due) {
+            dstc_scale_sink(index, result.sent, rmc_usec_monotonic_timestamp(),
+                            DYNAMIC_ARG(payload, payload_size));
+            result.sent++;
+        }
+        dstc_process_events(1000000 / rate);
+    }
+
+    // Calls from a publisher are delivered in order, so the
+    // subscribers are done once this one has been delivered.
+    DSTC_ON_COMPLETE(done_complete, 0, dstc_scale_done(index));
+    timeout_ts = rmc_usec_monotonic_timestamp() + DRAIN_TIMEOUT;
+    while(!delivered && rmc_usec_monotonic_timestamp() < timeout_ts)
+        dstc_process_events(10000);
+
+    result.end_ts = rmc_usec_monotonic_timestamp();
+    result.cpu_usec = cpu_usec() - start_cpu;
+    if (write(fd, &result, sizeof(result)) != sizeof(result)) {
+        perror("write");
+        exit(1);
+    }
+
+    // Keep retransmitting until the parent kills us.
+    while(1)
+        dstc_process_events(-1);
+}
+
+// Kill the nodes started so far and give up on a failed sweep.
+static void abort_sweep(pid_t* pids, int count, const char* what)
+{
+    perror(what);
+    while(count--)
+        if (pids[count] > 0)
+            kill(pids[count], SIGTERM);
+
+    exit(255);
+}
+
+// Read len bytes from a pipe, which may return them in parts.
+static int read_all(int fd, void* buf, size_t len)
+{
+    size_t done = 0;
+
+    while(done < len) {
+        ssize_t res = read(fd, (uint8_t*) buf + done, len - done);
+
+        if (res <= 0)
+            return -1;
+
+        done += res;
+    }
+    return 0;
+}
+
+static int compare_ts(const void* a, const void* b)
+{
+    usec_timestamp_t ts_a = *(usec_timestamp_t*) a;
+    usec_timestamp_t ts_b = *(usec_timestamp_t*) b;
+
+    return (ts_a > ts_b) - (ts_a < ts_b);
+}
+
+static void run_sweep(int publisher_count, int subscriber_count,
+                      int rate, uint32_t payload_size, usec_timestamp_t duration)
+{
+    int pub_fds[publisher_count][2];
+    int sub_fds[subscriber_count][2];
+    pid_t pids[publisher_count + subscriber_count];
+    usec_timestamp_t* latency = malloc(sizeof(usec_timestamp_t) * LATENCY_SAMPLES * subscriber_count);
+    uint32_t latency_count = 0;
+    usec_timestamp_t start_ts = -1;
+    usec_timestamp_t end_ts = 0;
+    usec_timestamp_t pub_cpu = 0;
+    usec_timestamp_t sub_cpu = 0;
+    uint64_t sent = 0;
+    uint64_t received = 0;
+    double min_delivery = 1.0;
+    uint32_t min_reached = subscriber_count;
+    double elapsed = 0;
+    int ind = 0;
+
+    memset(pids, 0, sizeof(pids));
+    fflush(stdout);
+
+    // The parent closes the write end of each pipe, so that a read
+    // fails instead of blocking if the node dies without reporting.
+    for(ind = 0; ind < subscriber_count; ++ind) {
+        if (pipe(sub_fds[ind]) == -1)
+            abort_sweep(pids, publisher_count + subscriber_count, "pipe");
+
+        if (!(pids[publisher_count + ind] = fork()))
+            run_subscriber(sub_fds[ind][1], publisher_count, duration);
+
+        if (pids[publisher_count + ind] == -1)
+            abort_sweep(pids, publisher_count + subscriber_count, "fork");
+
+        close(sub_fds[ind][1]);
+    }
+
+    for(ind = 0; ind < publisher_count; ++ind) {
+        if (pipe(pub_fds[ind]) == -1)
+            abort_sweep(pids, publisher_count + subscriber_count, "pipe");
+
+        if (!(pids[ind] = fork()))
+            run_publisher(pub_fds[ind][1], ind, subscriber_count, rate, payload_size, duration);
+
+        if (pids[ind] == -1)
+            abort_sweep(pids, publisher_count + subscriber_count, "fork");
+
+        close(pub_fds[ind][1]);
+    }
+
+    for(ind = 0; ind < publisher_count; ++ind) {
+        publisher_result_t result;
+
+        if (read_all(pub_fds[ind][0], &result, sizeof(result))) {
+            fprintf(stderr, "Publisher %d failed\n", ind);
+            continue;
+        }
+
+        sent += result.sent;
+        pub_cpu += result.cpu_usec;
+        if (result.subscribers < min_reached)
+            min_reached = result.subscribers;
+
+        if (start_ts == -1 || result.start_ts < start_ts)
+            start_ts = result.start_ts;
+
+        if (result.end_ts > end_ts)
+            end_ts = result.end_ts;
+    }
+
+    for(ind = 0; ind < subscriber_count; ++ind) {
+        subscriber_result_t result;
+
+        if (read_all(sub_fds[ind][0], &result, sizeof(result))) {
+            fprintf(stderr, "Subscriber %d failed\n", ind);
+            min_delivery = 0.0;
+            continue;
+        }
+
+        if (!read_all(sub_fds[ind][0], &latency[latency_count],
+                      sizeof(usec_timestamp_t) * result.sample_count))
+            latency_count += result.sample_count;
+
+        received += result.received;
+        sub_cpu += result.cpu_usec;
+        if (sent && (double) result.received / sent < min_delivery)
+            min_delivery = (double) result.received / sent;
+    }
+
+    for(ind = 0; ind < publisher_count + subscriber_count; ++ind) {
+        kill(pids[ind], SIGTERM);
+        waitpid(pids[ind], 0, 0);
+    }
+
+    for(ind = 0; ind < publisher_count; ++ind)
+        close(pub_fds[ind][0]);
+
+    for(ind = 0; ind < subscriber_count; ++ind)
+        close(sub_fds[ind][0]);
+
+    qsort(latency, latency_count, sizeof(usec_timestamp_t), compare_ts);
+    elapsed = (end_ts > start_ts)?(end_ts - start_ts) / 1000000.0:0.0;
+
+    printf("%4d %4d %8u %12.0f %10.1f %9.1f%% %10.2f %10.2f %9.3f %9.3f\n",
+           publisher_count,
+           subscriber_count,
+           min_reached,
+           elapsed?received / elapsed:0.0,
+           elapsed?(received * payload_size / (1024.0 * 1024.0)) / elapsed:0.0,
+           min_delivery * 100.0,
+           sent?(double) pub_cpu / sent:0.0,
+           received?(double) sub_cpu / received:0.0,
+           latency_count?latency[latency_count / 2] / 1000.0:0.0,
+           latency_count?latency[(latency_count * 99) / 100] / 1000.0:0.0);
+
+    free(latency);
+}
+
+int main(int argc, char* argv[])
+{
+    int max_publishers = (argc > 1)?atoi(argv[1]):4;
+    int max_subscribers = (argc > 2)?atoi(argv[2]):32;
+    int rate = (argc > 3)?atoi(argv[3]):1000;
+    int payload_size = (argc > 4)?atoi(argv[4]):256;
+    usec_timestamp_t duration = (argc > 5)?atol(argv[5]) * 1000:1000000;
+    int publisher_count = 0;
+    int subscriber_count = 0;
+
+    if (max_publishers < 1 || max_subscribers < 1 || rate < 1 ||
+        payload_size < 0 || payload_size > 60000 || duration < 1000) {
+        fprintf(stderr, "Usage: %s [max_publishers (>0)] [max_subscribers (>0)] [calls_per_sec (>0)] "
+                "[payload_size (0-60000)] [duration_msec (>0)]\n", argv[0]);
+        exit(255);
+    }
+
+    printf("%d calls/sec per publisher, %d byte payload, %ld msec\n\n",
+           rate, payload_size, duration / 1000);
+    printf("%4s %4s %8s %12s %10s %10s %10s %10s %9s %9s\n",
+           "pubs", "subs", "reached", "calls/sec", "MB/sec", "delivery",
+           "pub usec", "sub usec", "p50 msec", "p99 msec");
+
+    // Sweep doubling node counts, always including the max.
+    for(publisher_count = 1; ; publisher_count *= 2) {
+        if (publisher_count > max_publishers)
+            publisher_count = max_publishers;
+
+        for(subscriber_count = 1; ; subscriber_count *= 2) {
+            if (subscriber_count > max_subscribers)
+                subscriber_count = max_subscribers;
+
+            run_sweep(publisher_count, subscriber_count, rate, payload_size, duration);
+            if (subscriber_count == max_subscribers)
+                break;
+        }
+
+        if (publisher_count == max_publishers)
+            break;
+    }
+    exit(0);
+}
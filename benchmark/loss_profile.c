@@ -0,0 +1,166 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Measure the cost of packet loss, jitter, reordering, and
+// duplication on a fan-out to virtual peers, using the in-memory
+// simulator transport. Each loss profile runs in its own process,
+// and reports retransmits, goodput, and call latency in virtual time.
+//
+// Usage: loss_profile [peers] [calls] [retransmit_usec] [max_in_flight]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "dstc_sim.h"
+
+#define PAYLOAD_SIZE 256
+#define LATENCY_USEC 200
+
+DSTC_CLIENT(loss_sink, char, [PAYLOAD_SIZE])
+
+typedef struct {
+    char* name;
+    double loss;
+    double duplicate;
+    double reorder;
+    usec_timestamp_t jitter_usec;
+    usec_timestamp_t reorder_usec;
+} profile_t;
+
+static profile_t profiles[] = {
+    { "clean",      0.0,  0.0,  0.0,  0,    0 },
+    { "loss 1%",    0.01, 0.0,  0.0,  0,    0 },
+    { "loss 5%",    0.05, 0.0,  0.0,  0,    0 },
+    { "loss 10%",   0.10, 0.0,  0.0,  0,    0 },
+    { "jitter",     0.0,  0.0,  0.0,  1000, 0 },
+    { "reorder 5%", 0.0,  0.0,  0.05, 0,    2000 },
+    { "dup 5%",     0.0,  0.05, 0.0,  0,    0 },
+    { "mixed",      0.02, 0.01, 0.02, 500,  2000 },
+};
+
+static usec_timestamp_t* queued_ts = 0;
+static usec_timestamp_t* latency = 0;
+static uint32_t completed = 0;
+
+static void sink_complete(void* user_data, int status)
+{
+    uint32_t ind = (uint32_t) (uintptr_t) user_data;
+
+    latency[ind] = dstc_usec_monotonic_timestamp() - queued_ts[ind];
+    completed++;
+}
+
+static int compare_ts(const void* a, const void* b)
+{
+    usec_timestamp_t ts_a = *(usec_timestamp_t*) a;
+    usec_timestamp_t ts_b = *(usec_timestamp_t*) b;
+
+    return (ts_a > ts_b) - (ts_a < ts_b);
+}
+
+static void run_profile(profile_t* profile,
+                        int peer_count,
+                        int call_count,
+                        usec_timestamp_t retransmit_usec,
+                        uint32_t max_in_flight)
+{
+    char* functions[] = { "loss_sink" };
+    char payload[PAYLOAD_SIZE] = { 0 };
+    dstc_sim_link_t link = {
+        .loss = profile->loss,
+        .duplicate = profile->duplicate,
+        .reorder = profile->reorder,
+        .jitter_usec = profile->jitter_usec,
+        .reorder_usec = profile->reorder_usec,
+        .retransmit_usec = retransmit_usec
+    };
+    dstc_sim_link_stats_t start;
+    dstc_sim_link_stats_t end;
+    usec_timestamp_t start_ts = 0;
+    usec_timestamp_t elapsed = 0;
+    int ind = 0;
+
+    queued_ts = malloc(sizeof(usec_timestamp_t) * call_count);
+    latency = malloc(sizeof(usec_timestamp_t) * call_count);
+
+    dstc_sim_setup(LATENCY_USEC);
+    dstc_sim_set_link(&link, 1);
+    dstc_set_max_in_flight(max_in_flight);
+
+    for(ind = 0; ind < peer_count; ++ind)
+        dstc_sim_add_peer(functions, 1);
+
+    while(dstc_get_remote_count("loss_sink") < peer_count)
+        dstc_process_events(1000);
+
+    dstc_sim_get_link_stats(&start);
+    start_ts = dstc_usec_monotonic_timestamp();
+
+    for(ind = 0; ind < call_count; ++ind) {
+        queued_ts[ind] = dstc_usec_monotonic_timestamp();
+        DSTC_ON_COMPLETE(sink_complete, (void*) (uintptr_t) ind, dstc_loss_sink(payload));
+    }
+
+    while(completed < call_count)
+        dstc_process_events(1000);
+
+    elapsed = dstc_usec_monotonic_timestamp() - start_ts;
+    dstc_sim_get_link_stats(&end);
+    qsort(latency, call_count, sizeof(usec_timestamp_t), compare_ts);
+
+    // Goodput is the call payload delivered to each peer per second.
+    printf("%-11s %11lu %11lu %13.1f %10.3f %10.3f\n",
+           profile->name,
+           end.retransmits - start.retransmits,
+           end.transmissions - start.transmissions,
+           elapsed?((double) call_count * PAYLOAD_SIZE / 1024.0) / (elapsed / 1000000.0):0.0,
+           latency[call_count / 2] / 1000.0,
+           latency[(call_count * 99) / 100] / 1000.0);
+}
+
+int main(int argc, char* argv[])
+{
+    int peer_count = (argc > 1)?atoi(argv[1]):100;
+    int call_count = (argc > 2)?atoi(argv[2]):10000;
+    usec_timestamp_t retransmit_usec = (argc > 3)?atol(argv[3]):5000;
+    uint32_t max_in_flight = (argc > 4)?atoi(argv[4]):0;
+    int ind = 0;
+
+    if (peer_count < 1 || call_count < 1 || retransmit_usec < 1) {
+        fprintf(stderr, "Usage: %s [peers (>0)] [calls (>0)] [retransmit_usec (>0)] [max_in_flight]\n", argv[0]);
+        exit(255);
+    }
+
+    printf("%d peers, %d calls of %d bytes, %ld usec latency, %ld usec retransmit, %u packets in flight\n\n",
+           peer_count, call_count, PAYLOAD_SIZE, (long) LATENCY_USEC, retransmit_usec, max_in_flight);
+
+    printf("%-11s %11s %11s %13s %10s %10s\n",
+           "profile", "retransmits", "transmits", "goodput KB/s", "p50 msec", "p99 msec");
+
+    // DSTC state is process wide, so each profile gets a fresh process.
+    for(ind = 0; ind < sizeof(profiles) / sizeof(profiles[0]); ++ind) {
+        pid_t pid = 0;
+        int status = 0;
+
+        fflush(stdout);
+        pid = fork();
+
+        if (pid == 0) {
+            run_profile(&profiles[ind], peer_count, call_count, retransmit_usec, max_in_flight);
+            exit(0);
+        }
+
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "Profile %s failed\n", profiles[ind].name);
+            exit(1);
+        }
+    }
+    exit(0);
+}
@@ -0,0 +1,106 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Run discovery, fan-out, and fan-in against a large number of
+// virtual peers using the in-memory simulator transport.
+// Times are reported both in virtual time, which is deterministic,
+// and in wall clock time spent by DSTC itself.
+//
+// Usage: sim_fanout [peers] [calls] [latency_usec]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "dstc_sim.h"
+
+DSTC_CLIENT(sim_sink, int,)
+DSTC_SERVER(sim_ping, int,)
+
+static uint32_t completed = 0;
+static uint32_t pinged = 0;
+
+void sim_ping(int value)
+{
+    pinged++;
+}
+
+static void sink_complete(void* user_data, int status)
+{
+    completed++;
+}
+
+static void report(char* phase, usec_timestamp_t virt_start, usec_timestamp_t wall_start)
+{
+    printf("%-10s virtual %8.3f msec  wall %8.3f msec\n",
+           phase,
+           (dstc_usec_monotonic_timestamp() - virt_start) / 1000.0,
+           (rmc_usec_monotonic_timestamp() - wall_start) / 1000.0);
+}
+
+int main(int argc, char* argv[])
+{
+    int peer_count = (argc > 1)?atoi(argv[1]):500;
+    int call_count = (argc > 2)?atoi(argv[2]):10000;
+    usec_timestamp_t latency = (argc > 3)?atol(argv[3]):200;
+    char* functions[] = { "sim_sink" };
+    usec_timestamp_t virt_start = 0;
+    usec_timestamp_t wall_start = 0;
+    dstc_sim_peer_stats_t stats;
+    int ind = 0;
+
+    if (peer_count < 1 || call_count < 0) {
+        fprintf(stderr, "Usage: %s [peers (>0)] [calls] [latency_usec]\n", argv[0]);
+        exit(255);
+    }
+
+    dstc_sim_setup(latency);
+
+    // Discovery storm. All peers join at once.
+    virt_start = dstc_usec_monotonic_timestamp();
+    wall_start = rmc_usec_monotonic_timestamp();
+
+    for(ind = 0; ind < peer_count; ++ind)
+        dstc_sim_add_peer(functions, 1);
+
+    while(dstc_get_remote_count("sim_sink") < peer_count)
+        dstc_process_events(1000);
+
+    report("discovery", virt_start, wall_start);
+
+    // Fan-out. Every call is delivered to all peers.
+    virt_start = dstc_usec_monotonic_timestamp();
+    wall_start = rmc_usec_monotonic_timestamp();
+
+    for(ind = 0; ind < call_count; ++ind)
+        DSTC_ON_COMPLETE(sink_complete, 0, dstc_sim_sink(ind));
+
+    while(completed < call_count)
+        dstc_process_events(1000);
+
+    report("fan-out", virt_start, wall_start);
+
+    for(ind = 0; ind < peer_count; ++ind) {
+        dstc_sim_get_peer_stats(ind, &stats);
+        if (stats.calls != call_count) {
+            printf("Peer %d received %lu calls. Wanted %d\n", ind, stats.calls, call_count);
+            exit(1);
+        }
+    }
+
+    // Fan-in. Every peer calls us.
+    virt_start = dstc_usec_monotonic_timestamp();
+    wall_start = rmc_usec_monotonic_timestamp();
+
+    for(ind = 0; ind < peer_count; ++ind)
+        dstc_sim_peer_call(ind, "sim_ping", &ind, sizeof(ind));
+
+    while(pinged < peer_count)
+        dstc_process_events(1000);
+
+    report("fan-in", virt_start, wall_start);
+    exit(0);
+}
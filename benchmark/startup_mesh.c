@@ -0,0 +1,126 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the 
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Measure the time it takes for N local nodes to form a full mesh,
+// where every node has registered the server function of every other node.
+//
+// Usage: startup_mesh [nodes] [burst_interval_usec] [steady_interval_usec]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "dstc.h"
+
+#define MESH_TIMEOUT 10000000 // usec
+
+DSTC_SERVER(mesh_ping, int,)
+
+void mesh_ping(int value)
+{
+}
+
+// Run a single node until it sees all other nodes, and report
+// the absolute timestamp of that moment through fd.
+static void run_node(int fd, int node_count,
+                     usec_timestamp_t burst, usec_timestamp_t steady)
+{
+    usec_timestamp_t done_ts = -1;
+    usec_timestamp_t timeout_ts = rmc_usec_monotonic_timestamp() + MESH_TIMEOUT;
+
+    // Avoid identical random node ids in forked processes.
+    srand(getpid() ^ rmc_usec_monotonic_timestamp());
+    dstc_set_announce_schedule(burst, 5, steady);
+    dstc_setup();
+
+    while(dstc_get_remote_count("mesh_ping") < node_count - 1) {
+        if (rmc_usec_monotonic_timestamp() > timeout_ts)
+            break;
+
+        dstc_process_events(1000);
+    }
+
+    if (dstc_get_remote_count("mesh_ping") >= node_count - 1)
+        done_ts = rmc_usec_monotonic_timestamp();
+
+    if (write(fd, &done_ts, sizeof(done_ts)) != sizeof(done_ts)) {
+        perror("write");
+        exit(1);
+    }
+
+    // Keep serving the other nodes until the parent kills us.
+    dstc_process_events(-1);
+    exit(0);
+}
+
+int main(int argc, char* argv[])
+{
+    int node_count = (argc > 1)?atoi(argv[1]):8;
+    usec_timestamp_t burst = (argc > 2)?atol(argv[2]):20000;
+    usec_timestamp_t steady = (argc > 3)?atol(argv[3]):1000000;
+    usec_timestamp_t start_ts = 0;
+    usec_timestamp_t mesh_ts = 0;
+    pid_t pids[node_count];
+    int fds[2];
+    int failed = 0;
+    int ind = 0;
+
+    if (node_count < 2) {
+        fprintf(stderr, "Usage: %s [nodes (>1)] [burst_interval_usec] [steady_interval_usec]\n", argv[0]);
+        exit(255);
+    }
+
+    if (pipe(fds) == -1) {
+        perror("pipe");
+        exit(255);
+    }
+
+    start_ts = rmc_usec_monotonic_timestamp();
+
+    for(ind = 0; ind < node_count; ++ind) {
+        pids[ind] = fork();
+        if (pids[ind] == -1) {
+            perror("fork");
+            while(ind--)
+                kill(pids[ind], SIGTERM);
+            exit(255);
+        }
+
+        if (!pids[ind]) {
+            close(fds[0]);
+            run_node(fds[1], node_count, burst, steady);
+        }
+    }
+
+    close(fds[1]);
+    for(ind = 0; ind < node_count; ++ind) {
+        usec_timestamp_t done_ts = -1;
+
+        if (read(fds[0], &done_ts, sizeof(done_ts)) != sizeof(done_ts) || done_ts == -1) {
+            failed++;
+            continue;
+        }
+
+        if (done_ts > mesh_ts)
+            mesh_ts = done_ts;
+
+        printf("node %3d: %8ld usec\n", ind, done_ts - start_ts);
+    }
+
+    for(ind = 0; ind < node_count; ++ind) {
+        kill(pids[ind], SIGTERM);
+        waitpid(pids[ind], 0, 0);
+    }
+
+    printf("nodes:            %d\n", node_count);
+    printf("burst interval:   %ld usec\n", burst);
+    printf("steady interval:  %ld usec\n", steady);
+    printf("timed out:        %d\n", failed);
+    printf("time to mesh:     %ld usec\n", mesh_ts - start_ts);
+    exit(failed?1:0);
+}
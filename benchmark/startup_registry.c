@@ -0,0 +1,95 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Measure the startup and lookup cost of a process serving a large
+// number of functions. Reports the CPU time spent before main(),
+// the time spent by dstc_setup() indexing all server functions,
+// and the time it takes to dispatch calls to them, using the
+// in-memory simulator transport.
+//
+// startup_registry_shared serves the same functions from a shared
+// object, built from this file with STARTUP_REGISTRY_SERVERS defined,
+// and linked to a main program built with STARTUP_REGISTRY_MAIN defined.
+//
+// Usage: startup_registry [calls]
+//        startup_registry_shared [calls]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "dstc_sim.h"
+
+#define SERVER(name) DSTC_SERVER(name, int,) void name(int value) { dispatched++; }
+#define NAME(name) #name,
+
+#define X8(m, p) m(p##0) m(p##1) m(p##2) m(p##3) m(p##4) m(p##5) m(p##6) m(p##7)
+#define X64(m, p) X8(m, p##0) X8(m, p##1) X8(m, p##2) X8(m, p##3) \
+    X8(m, p##4) X8(m, p##5) X8(m, p##6) X8(m, p##7)
+#define X512(m) X64(m, reg_0) X64(m, reg_1) X64(m, reg_2) X64(m, reg_3) \
+    X64(m, reg_4) X64(m, reg_5) X64(m, reg_6) X64(m, reg_7)
+
+#ifndef STARTUP_REGISTRY_MAIN
+uint32_t dispatched = 0;
+
+X512(SERVER)
+#else
+extern uint32_t dispatched;
+#endif
+
+#ifndef STARTUP_REGISTRY_SERVERS
+static char* names[] = { X512(NAME) };
+
+#define NAME_COUNT (sizeof(names) / sizeof(names[0]))
+
+static usec_timestamp_t cpu_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (usec_timestamp_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int main(int argc, char* argv[])
+{
+    usec_timestamp_t pre_main = cpu_usec();
+    int call_count = (argc > 1)?atoi(argv[1]):100000;
+    usec_timestamp_t start = 0;
+    usec_timestamp_t setup = 0;
+    int ind = 0;
+
+    if (call_count < 1) {
+        fprintf(stderr, "Usage: %s [calls (>0)]\n", argv[0]);
+        exit(255);
+    }
+
+    start = rmc_usec_monotonic_timestamp();
+    dstc_sim_setup(0);
+    setup = rmc_usec_monotonic_timestamp() - start;
+
+    dstc_sim_add_peer(0, 0);
+
+    start = rmc_usec_monotonic_timestamp();
+    for(ind = 0; ind < call_count; ++ind) {
+        dstc_sim_peer_call(0, names[ind % NAME_COUNT], &ind, sizeof(ind));
+
+        // Dispatch in batches to keep the simulator event list short.
+        if (ind % 1000 == 999)
+            dstc_process_events(0);
+    }
+
+    while(dispatched < call_count)
+        dstc_process_events(1000);
+
+    printf("%lu server functions\n", NAME_COUNT);
+    printf("pre-main cpu  %8.3f msec\n", pre_main / 1000.0);
+    printf("setup         %8.3f msec\n", setup / 1000.0);
+    printf("dispatch      %8.3f usec/call\n",
+           (double) (rmc_usec_monotonic_timestamp() - start) / call_count);
+    exit(0);
+}
+#endif
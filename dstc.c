@@ -10,46 +10,436 @@
 #define SYMTAB_SIZE 128
 #define MAX_CONNECTIONS 16
 
-
+#define _GNU_SOURCE // memfd_create(), F_ADD_SEALS, and accept4()
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
 #include <sys/time.h>
 
 #include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/epoll.h>
+#include <sys/uio.h>
+#include <link.h>
 #include "dstc.h"
 #include "rmc_log.h"
 
-// FIXME: Hash table.
+// Function invoked by an incoming call. Either func is set,
+// or ctx_func is set and invoked with ctx.
+typedef struct dstc_handler {
+    void (*func)(rmc_node_id_t node_id, uint8_t*);
+    void (*ctx_func)(void* ctx, rmc_node_id_t node_id, uint8_t*);
+    void* ctx;
+    // Invoked once with all tuples of a bulk call. Set instead of func.
+    void (*batch_func)(rmc_node_id_t node_id, uint32_t count, uint32_t tuple_size, uint8_t*);
+} dstc_handler_t;
+
+// Local server function. func_name points into the dstc_server_record_t
+// of a function declared with DSTC_SERVER(), and is allocated for one
+// registered at runtime.
 typedef struct dispatch_table {
-    char func_name[256];
-    void (*server_func)(rmc_node_id_t node_id, uint8_t*);
+    const char* func_name;     // 0 = Free slot
+    uint32_t name_len;
+    dstc_handler_t handler;
 } dispatch_table_t;
 
-static dispatch_table_t local_func[SYMTAB_SIZE];
-
-typedef void (*callback_t)(rmc_node_id_t node_id, uint8_t*);
-
-
-static callback_t local_callback[SYMTAB_SIZE];
+// Functions registered at runtime by dstc_register_local_function()
+static dispatch_table_t* registered_func = 0;
+static uint32_t registered_func_count = 0;
+static uint32_t registered_func_size = 0;
+
+// dstc_servers sections of shared objects. See dstc_register_server_records()
+static struct record_section {
+    const dstc_server_record_t* start;
+    const dstc_server_record_t* stop;
+} *record_sections = 0;
+static uint32_t record_section_count = 0;
+
+// Objects loaded when the sections were last looked for.
+// See dstc_scan_shared_objects()
+static unsigned long long record_scan_adds = 0;
+static void dstc_scan_shared_objects(void);
+
+// The dstc_servers section of the main program, set up by the linker.
+// Hidden, so as not to bind to the section exported by a shared object.
+extern const dstc_server_record_t __start_dstc_servers[] __attribute__((weak, visibility("hidden")));
+extern const dstc_server_record_t __stop_dstc_servers[] __attribute__((weak, visibility("hidden")));
+
+// Perfect hash of all local functions, built by dstc_build_local_index().
+// local_index[] holds, per bucket, the seed that hashes the names of the
+// bucket into free slots of local_func[], or -(slot + 1) for a bucket
+// with a single name.
+static dispatch_table_t* local_func = 0;
+static int32_t* local_index = 0;
+static uint32_t local_index_size = 0;
+static int local_index_dirty = 1;
+
+// registered_func[] entries covered by the index. Later registrations
+// are searched linearly until LOCAL_INDEX_BACKLOG of them have piled
+// up, so that functions registered one at a time at runtime don't
+// rebuild the index for every lookup in between.
+static uint32_t local_index_registered = 0;
+#define LOCAL_INDEX_BACKLOG 32
+
+typedef struct callback_table {
+    uint64_t func_addr; // Callback address carried in the call. 0 = Free slot
+    dstc_handler_t handler;
+} callback_table_t;
+
+static callback_table_t local_callback[SYMTAB_SIZE];
+
+// Callback addresses handed out by dstc_register_callback_ctx() are
+// CALLBACK_ID_FLAG, the node id, and a counter, to tell them apart
+// from function addresses.
+#define CALLBACK_ID_FLAG 0x4000000000000000ULL
+#define CALLBACK_ID_MASK 0x3FFFFFFFULL
+static uint64_t callback_next_id = 1;
+
+// Collective call collecting the replies of all servers of a function.
+// Replies carry the gather id as their callback address, with
+// GATHER_ID_FLAG set to tell it apart from function addresses, and
+// the node id and a counter laid out as in callback addresses.
+// See dstc_register_gather()
+#define GATHER_ID_FLAG 0x8000000000000000ULL
+#define GATHER_ID_NODE(id) ((rmc_node_id_t) (((id) & ~GATHER_ID_FLAG) >> 30))
+
+typedef struct dstc_gather {
+    struct dstc_gather* next;
+    uint64_t id;
+    void (*reduce)(void* user_data, rmc_node_id_t node_id, uint8_t* reply);
+    void (*complete)(void* user_data, dstc_gather_result_t* result);
+    void* user_data;
+    usec_timestamp_t deadline_ts; // Monotonic usec.
+    uint8_t started;              // Set when the call has been queued
+    uint8_t parked;               // Call parked until the function has a server
+    int status;                   // Error returned by the call. 0 = Queued
+    char name[256];               // Function called
+    uint32_t expected;
+    rmc_node_id_t* servers;       // Servers of the function when the call was made
+    uint32_t count;
+    uint32_t size;
+    dstc_gather_reply_t* replies;
+} dstc_gather_t;
+
+static dstc_gather_t* gathers = 0;
+static dstc_gather_t* next_call_gather = 0; // Started by the next queued call
+static uint64_t gather_next_id = 1;
+static dstc_gather_stats_t gather_stats;
 
 static struct remote_func_t {
     char func_name[256];
     uint32_t count; // Number of remotes supporting this function
+    uint8_t notify; // Report to remote_func_cb at next dstc_notify_remote_functions()
+    uint32_t local_count; // Remotes on this host, reached through a local peer
+    rmc_node_id_t* local_nodes;
+    uint32_t node_count;  // Nodes serving this function
+    rmc_node_id_t* nodes;
 } remote_func[SYMTAB_SIZE];
 
-static uint32_t local_func_ind = 0;
+static void (*remote_func_cb)(char* function_name, uint32_t remote_count) = 0;
+static uint32_t remote_notify_count = 0;
+
+// Function names sent to a new publisher by dstc_transport_node_subscribed().
+static uint8_t announce_buf[RMC_MAX_PAYLOAD];
+
+// Client side attributes of remote functions that we call.
+// Functions not found in this table use default attributes.
+static struct client_func_t {
+    char func_name[256];
+    uint8_t priority; // DSTC_PRIO_XXX
+    usec_timestamp_t deadline_usec; // Max age of a call. 0 = No deadline
+    uint8_t conflate;               // Replace pending calls with the same key
+    uint32_t key_offset;            // Conflation key location in serialized args
+    uint32_t key_len;               // 0 = All calls share the same key
+    uint32_t keyframe_interval;     // Delta encode calls. 0 = Disabled
+    uint32_t since_keyframe;        // Calls sent since the last keyframe
+    uint8_t keyframe_due;           // Send full arguments with the next call
+    uint32_t delta_seq;             // Sequence number of snapshot. 0 = None yet
+    uint32_t snapshot_len;
+    uint8_t* snapshot;              // Arguments of the last call
+    uint8_t no_server;              // DSTC_NO_SERVER_XXX
+    uint32_t max_parked;
+    uint32_t parked_count;
+    struct pending_call* parked_head; // Calls held while no remote serves the function
+    struct pending_call* parked_tail;
+    uint8_t cache_mode;             // DSTC_CACHE_XXX
+    uint32_t cache_max;             // Max cached calls
+    uint32_t cache_key_offset;      // Key location in serialized args for DSTC_CACHE_PER_KEY
+    uint32_t cache_key_len;
+    uint32_t cache_count;
+    struct cache_entry* cache_head; // Cached calls, oldest first
+    struct cache_entry* cache_tail;
+    uint8_t latency;                // Timestamp calls for dstc_get_latency_stats()
+} client_func[SYMTAB_SIZE];
+
+// Call kept by dstc_cache_call() for nodes that connect later.
+// Entries are on a list per function, and on a list of all entries
+// that is evicted from when the byte limit is reached.
+typedef struct cache_entry {
+    struct cache_entry* prev;       // All entries, oldest first
+    struct cache_entry* next;
+    struct cache_entry* func_prev;  // Entries of the same function, oldest first
+    struct cache_entry* func_next;
+    struct client_func_t* client;
+    uint64_t key;                   // Hash of the key of a DSTC_CACHE_PER_KEY call
+    uint32_t call_len;
+    uint8_t call[];                 // dstc_header_t followed by payload
+} cache_entry_t;
+
+static cache_entry_t* cache_head = 0;
+static cache_entry_t* cache_tail = 0;
+static uint32_t cache_max_bytes = 1024 * 1024;
+static dstc_cache_stats_t cache_stats;
+
+// Calls replayed to us by other nodes, waiting to be picked up
+// by dstc_transport_packets_ready() as any received packet.
+typedef struct replay_packet {
+    struct replay_packet* next;
+    void* payload;
+    payload_len_t payload_len;
+} replay_packet_t;
+
+static replay_packet_t* replay_head = 0;
+static replay_packet_t* replay_tail = 0;
+
+// Nodes that have subscribed to us since the event loop last ran,
+// waiting for dstc_replay_caches() to send them our cached calls.
+static rmc_node_id_t* replay_nodes = 0;
+static uint32_t replay_node_count = 0;
+
+// Outbound call staged by dstc_queue() until it is handed to the
+// transport by dstc_drain_pending(). call[] is what is transmitted.
+typedef struct pending_call {
+    struct pending_call* next;
+    usec_timestamp_t queued_ts;
+    usec_timestamp_t deadline; // CLOCK_REALTIME usec. 0 = No deadline
+    void (*complete)(void* user_data, int status); // Optional completion callback
+    void* complete_user_data;
+    int status;                // Reported to complete()
+    uint32_t call_count;       // Calls in call[]. See dstc_coalesce_reserve()
+    uint32_t call_len;
+    uint8_t call[];            // dstc_header_t followed by payload
+} pending_call_t;
+
+// One outbound FIFO per priority class.
+static struct pending_queue {
+    pending_call_t* head;
+    pending_call_t* tail;
+    uint32_t count;
+} pending[DSTC_PRIO_COUNT];
+
+// Inbound call sorted into its priority class by dstc_transport_packets_ready(),
+// waiting to be executed by dstc_process_function_call().
+typedef struct inbound_call {
+    dstc_header_t* call;
+    void* payload;             // Packet payload holding call. Retained.
+    usec_timestamp_t ready_ts;
+    uint8_t superseded;        // A newer call with the same conflation key is queued
+} inbound_call_t;
+
+static struct inbound_queue {
+    inbound_call_t* calls;
+    uint32_t count;
+    uint32_t size;
+
+    // Open addressed index, by conflation key hash, of the newest
+    // conflatable calls in calls[]. Each slot holds the call index + 1.
+    uint32_t* conflated;
+    uint32_t conflated_count;
+    uint32_t conflated_size;   // Power of two
+} inbound[DSTC_PRIO_COUNT];
+
+// Inbound packet payloads are allocated by dstc_transport_alloc_payload()
+// with a reference count in front of them.
+// The payload is aligned for the typed dynamic arrays of its calls.
+typedef struct inbound_payload {
+    uint64_t ref_count;
+    uint8_t data[] __attribute__((aligned(DSTC_ARRAY_ALIGN)));
+} inbound_payload_t;
+
+static dstc_priority_stats_t prio_stats[DSTC_PRIO_COUNT];
+
+// Latency of received calls to a function. See dstc_record_latency()
+typedef struct latency_func {
+    uint8_t name_len;
+    uint8_t name[255];
+    dstc_latency_stats_t stats;
+} latency_func_t;
+
+static latency_func_t* latency_funcs = 0;
+static uint32_t latency_func_count = 0;
+
+// Clock of a sending node, relative to ours.
+typedef struct latency_node {
+    rmc_node_id_t node_id;
+    usec_timestamp_t clock_offset;  // Added to the node's timestamps
+    usec_timestamp_t min_network;   // Lowest network delay seen. -1 = None yet
+    usec_timestamp_t window_min;    // Lowest network delay in the current window. -1 = None yet
+    usec_timestamp_t window_start;
+} latency_node_t;
+
+static latency_node_t* latency_nodes = 0;
+static uint32_t latency_node_count = 0;
+static uint8_t drain_mode = DSTC_DRAIN_STRICT;
+static uint32_t drain_weights[DSTC_PRIO_COUNT] = { 4, 2, 1 };
+static uint32_t max_in_flight = 0; // 0 = Unlimited
+static uint32_t in_flight_packets = 0; // Handed to the transport and not yet freed.
+
+// Token buckets pacing the packets handed to the transport. See dstc_set_pacing()
+static uint64_t pace_bytes_per_sec = 0; // 0 = Unlimited
+static uint32_t pace_packets_per_sec = 0; // 0 = Unlimited
+static double pace_burst_bytes = 0;
+static double pace_burst_packets = 0;
+static double pace_bytes = 0;        // Tokens available
+static double pace_packets = 0;
+static usec_timestamp_t pace_refill_ts = 0;
+static usec_timestamp_t pace_wait_ts = -1;  // When the held back call can be sent. -1 = None held back
+static usec_timestamp_t pace_wait_start = -1;
+static dstc_pacing_stats_t pacing_stats;
+
+// Outbound queue limits. See dstc_set_queue_limit()
+static uint32_t queue_max_bytes = 0; // 0 = Unlimited
+static uint32_t queue_max_packets = 0; // 0 = Unlimited
+static uint8_t queue_policy = DSTC_QUEUE_BLOCK;
+static uint32_t queue_low_watermark = 0;
+static int queue_watermark_armed = 0;
+static void (*queue_drained_cb)(dstc_queue_backlog_t* backlog) = 0;
+static dstc_queue_backlog_t backlog;
+
+static usec_timestamp_t next_call_deadline = 0;
+static void (*next_call_complete)(void* user_data, int status) = 0;
+static void* next_call_complete_user_data = 0;
+
+// Calls whose completion callback is to be invoked by
+// dstc_notify_completions() from the event loop.
+static pending_call_t* completed_head = 0;
+static pending_call_t* completed_tail = 0;
+static dstc_deadline_stats_t deadline_stats;
+static dstc_conflation_stats_t conflation_stats;
+static dstc_no_server_stats_t no_server_stats;
+
+// Arguments of the last delta encoded call received from a node,
+// which the next call to the same function is decoded against.
+typedef struct delta_snapshot {
+    rmc_node_id_t node_id;
+    uint8_t name_len;
+    uint8_t name[255];
+    uint32_t seq;              // 0 = Waiting for a keyframe
+    uint32_t len;
+    uint8_t* data;
+} delta_snapshot_t;
+
+static delta_snapshot_t* delta_snapshots = 0;
+static uint32_t delta_snapshot_count = 0;
+static uint32_t delta_snapshot_size = 0;
+static dstc_delta_stats_t delta_stats;
+
+// Delta encoded calls dropped before being sent, whose dependent staged
+// calls are yet to be fixed up by dstc_delta_fix_dropped()
+static struct delta_drop {
+    struct client_func_t* client;
+    uint32_t seq;
+} *delta_drops = 0;
+static uint32_t delta_drop_count = 0;
+static uint32_t delta_drop_size = 0;
+
+// Scratch buffers used by dstc_delta_prepare()
+static uint8_t delta_args[RMC_MAX_PAYLOAD];
+static uint8_t delta_buf[RMC_MAX_PAYLOAD];
+
+// Call scheduled by DSTC_SCHEDULE(), waiting in the timer wheel.
+// The serialized call is queued by dstc_fire_timer() at expiry.
+typedef struct dstc_timer {
+    struct dstc_timer* next;
+    struct dstc_timer** prev;    // Pointer to this timer in its wheel slot. 0 = Fired
+    struct dstc_timer* id_next;  // Next timer in the same timer_index[] bucket
+    dstc_timer_id_t id;
+    usec_timestamp_t expire_ts;  // Monotonic usec
+    uint64_t expire_tick;        // expire_ts rounded up to a tick
+    usec_timestamp_t period;     // 0 = One shot
+    usec_timestamp_t max_age;    // Deadline of each call. 0 = Function default
+    void (*complete)(void* user_data, int status);
+    void* complete_user_data;
+    uint8_t cancelled;
+    uint8_t name_len;            // 0 = Callback address
+    uint32_t bulk_count;         // Tuples of a bulk call. 0 = Not a bulk call
+    uint32_t tuple_size;
+    uint8_t aligned;             // Has typed dynamic arrays
+    uint32_t arg_sz;
+    uint8_t data[];              // Name, or callback address, followed by arguments
+} dstc_timer_t;
+
+// Hierarchical timer wheel. Level 0 has a slot per tick, and each
+// level above it has slots TIMER_WHEEL_SLOTS times as wide as the
+// level below. A slot is cascaded into the levels below when the
+// current tick reaches it.
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 4
+
+static dstc_timer_t* timer_wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+
+// Timers hashed by id, to find the timer to cancel.
+#define TIMER_INDEX_SIZE 256
+static dstc_timer_t* timer_index[TIMER_INDEX_SIZE];
+static dstc_timer_t* timers_fired = 0;    // Expired, in expiry order, being processed by dstc_process_timers()
+static dstc_timer_t** timers_fired_tail = &timers_fired;
+static usec_timestamp_t timer_base_ts = 0; // Monotonic usec of tick 0
+static uint64_t timer_tick = 0;           // Last processed tick
+static uint32_t timer_count = 0;
+static dstc_timer_id_t timer_next_id = 1;
+static int timers_in_progress = 0;
+
+static uint32_t next_call_bulk_count = 0; // 0 = Not a bulk call
+static uint32_t next_call_tuple_size = 0;
+static uint8_t next_call_aligned = 0;       // Has typed dynamic arrays
+
+static usec_timestamp_t next_call_delay = -1; // -1 = Not scheduled
+static usec_timestamp_t next_call_period = 0;
+static dstc_timer_id_t* next_call_timer_id = 0;
+
+// Packets being filled with calls fired by dstc_process_timers().
+// One per priority class.
+static pending_call_t* coalesced[DSTC_PRIO_COUNT];
+static int coalesce_calls = 0;
+
+// Size of the header extension marked by each bit of dstc_header_t::flags.
+static const uint8_t header_ext_size[8] = {
+    0, 0,                     // Priority class
+    sizeof(usec_timestamp_t), // DSTC_FLAG_DEADLINE
+    sizeof(uint64_t) + 2 * sizeof(uint32_t), // DSTC_FLAG_CONFLATE
+    2 * sizeof(uint32_t),     // DSTC_FLAG_DELTA
+    2 * sizeof(uint32_t),     // DSTC_FLAG_BULK
+    2 * sizeof(usec_timestamp_t), // DSTC_FLAG_LATENCY
+    sizeof(uint8_t)           // DSTC_FLAG_ALIGNED
+};
+
 static uint32_t callback_ind = 0;
 static uint32_t remote_func_ind = 0;
+static uint32_t client_func_ind = 0;
 static int initialized = 0;
 static int epoll_fd = -1;
 
+// Transport in use. See dstc_set_transport()
+static const dstc_transport_t rmc_transport;
+static const dstc_transport_t* transport = &rmc_transport;
+
+static usec_timestamp_t dstc_now(void)
+{
+    return transport->now();
+}
+
 
 #define MCAST_GROUP_ADDRESS "239.40.41.42" // Completely made up
 #define MCAST_GROUP_PORT 4723 // Completely made up
@@ -60,8 +450,66 @@ rmc_pub_context_t _dstc_pub_ctx;
 uint8_t sub_conn_vec_buf[sizeof(rmc_connection_t)*MAX_CONNECTIONS];
 uint8_t pub_conn_vec_buf[sizeof(rmc_connection_t)*MAX_CONNECTIONS];
 
+// Announce schedule. See dstc_set_announce_schedule()
+static usec_timestamp_t announce_burst_interval = 20000;
+static uint32_t announce_burst_count = 5;
+static usec_timestamp_t announce_steady_interval = 1000000;
+static usec_timestamp_t announce_interval = 0; // Current interval
+static usec_timestamp_t announce_backoff_ts = -1; // When to double announce_interval.
+
 #define USER_DATA_INDEX_MASK 0x0000FFFF
 #define USER_DATA_PUB_FLAG   0x00010000
+#define USER_DATA_LOCAL_FLAG 0x00020000 // Unix domain socket of a local peer
+#define USER_DATA_LOCAL_LISTEN (USER_DATA_LOCAL_FLAG | USER_DATA_INDEX_MASK)
+
+// Nodes on this host listen to a Unix domain socket in the abstract
+// namespace, named after their node id, for calls handed over as
+// sealed memfds. See dstc_set_memfd_threshold()
+#define LOCAL_SOCKET_NAME "dstc.%u"
+
+// A node that we have tried to reach through its local socket.
+typedef struct local_peer {
+    rmc_node_id_t node_id;
+    int descriptor; // Connected to the listen socket of the node. -1 = Not on this host
+} local_peer_t;
+
+static local_peer_t* local_peers = 0;
+static uint32_t local_peer_count = 0;
+static int local_listen_fd = -1;     // -1 = Calls are not handed over locally
+static int* local_conns = 0;         // Accepted connections. -1 = Free slot
+static uint32_t local_conn_count = 0;
+static uint32_t memfd_threshold = RMC_MAX_PAYLOAD;
+static dstc_memfd_stats_t memfd_stats;
+
+// Header extensions carried by a call handed over as a memfd, and the
+// largest message holding its header, extensions, and name.
+#define LOCAL_CALL_FLAGS (DSTC_FLAG_PRIO_MASK | DSTC_FLAG_DEADLINE | DSTC_FLAG_LATENCY)
+#define LOCAL_CALL_MAX (sizeof(dstc_header_t) + 3 * sizeof(usec_timestamp_t) + 256)
+
+// Max reads or writes made on an edge triggered socket per event loop
+// iteration. A socket with more to do is serviced again without waiting.
+#define EPOLL_EDGE_BUDGET 32
+
+// The lowest network delay seen from a node is replaced by that of the
+// last window of this length, so that it follows a route that got slower.
+#define LATENCY_WINDOW_USEC 10000000
+
+// Interest in a socket of the RMC transport, as requested by RMC and
+// as registered with epoll. See dstc_set_epoll_mode()
+typedef struct poll_interest {
+    int descriptor;              // -1 = Free entry
+    uint32_t event_user_data;
+    rmc_poll_action_t wanted;    // Requested by RMC
+    uint32_t registered;         // Events registered with epoll
+    uint8_t readable;            // Edge triggered socket not yet drained
+    uint8_t writable;            // Edge triggered socket with room to write
+} poll_interest_t;
+
+static poll_interest_t* poll_interest = 0;
+static uint32_t poll_interest_count = 0;
+static uint8_t poll_dirty = 0; // Batched interest changes not yet registered
+static uint8_t epoll_mode = DSTC_EPOLL_LEVEL;
+static dstc_epoll_stats_t epoll_stats;
 
 
 char* _op_res_string(uint8_t res)
@@ -107,66 +555,493 @@ char* _op_res_string(uint8_t res)
 }
 
 
-// Retrieve a function pointer by name previously registered with
-// dstc_register_local_function()
+// FNV-1a, finalized with the murmur3 mixer so that different
+// seeds give unrelated hashes of the same name.
+static uint32_t dstc_name_hash(uint32_t seed, const char* name, uint32_t name_len)
+{
+    uint32_t hash = 0x811c9dc5 ^ seed;
+
+    while(name_len--) {
+        hash ^= (uint8_t) *name++;
+        hash *= 0x01000193;
+    }
+
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+// Place the names of func[] into a perfect hash with size buckets and slots,
+// using hash and displace. Buckets are placed largest first, each with the
+// first seed that moves all of its names into free slots.
+// Returns 0 on success, or ERANGE if a bucket could not be placed.
+static int dstc_place_local_index(dispatch_table_t* func, uint32_t count, uint32_t size)
+{
+    uint32_t* bucket_size = calloc(size, sizeof(uint32_t));
+    uint32_t* bucket_start = calloc(size + 1, sizeof(uint32_t));
+    uint32_t* bucket_func = malloc(count * sizeof(uint32_t));
+    uint32_t* slots = malloc(count * sizeof(uint32_t));
+    uint32_t max_bucket_size = 0;
+    uint32_t free_slot = 0;
+    uint32_t ind = 0;
+    int res = 0;
+
+    local_func = calloc(size, sizeof(dispatch_table_t));
+    local_index = calloc(size, sizeof(int32_t));
+
+    // Sort functions into buckets.
+    for(ind = 0; ind < count; ++ind)
+        bucket_size[dstc_name_hash(0, func[ind].func_name, func[ind].name_len) % size]++;
+
+    for(ind = 0; ind < size; ++ind) {
+        bucket_start[ind + 1] = bucket_start[ind] + bucket_size[ind];
+        if (bucket_size[ind] > max_bucket_size)
+            max_bucket_size = bucket_size[ind];
+        bucket_size[ind] = 0;
+    }
+
+    for(ind = 0; ind < count; ++ind) {
+        uint32_t bucket = dstc_name_hash(0, func[ind].func_name, func[ind].name_len) % size;
+
+        bucket_func[bucket_start[bucket] + bucket_size[bucket]++] = ind;
+    }
+
+    for(ind = 0; ind < size * max_bucket_size && !res; ++ind) {
+        uint32_t bucket = ind % size;
+        uint32_t* members = bucket_func + bucket_start[bucket];
+        uint32_t member_count = bucket_size[bucket];
+        uint32_t seed = 0;
+        uint32_t member = 0;
+
+        // Pass n over the buckets places those of size max_bucket_size - n.
+        if (member_count != max_bucket_size - ind / size)
+            continue;
+
+        if (member_count == 1) {
+            while(local_func[free_slot].func_name)
+                free_slot++;
+
+            local_index[bucket] = -(int32_t) free_slot - 1;
+            local_func[free_slot] = func[members[0]];
+            continue;
+        }
+
+        for(seed = 1; seed < (1 << 20); ++seed) {
+            for(member = 0; member < member_count; ++member) {
+                uint32_t other = 0;
+
+                slots[member] = dstc_name_hash(seed,
+                                               func[members[member]].func_name,
+                                               func[members[member]].name_len) % size;
+
+                if (local_func[slots[member]].func_name)
+                    break;
+
+                while(other < member && slots[other] != slots[member])
+                    other++;
+
+                if (other < member)
+                    break;
+            }
+
+            if (member == member_count)
+                break;
+        }
+
+        if (member < member_count) {
+            res = ERANGE;
+            continue;
+        }
+
+        local_index[bucket] = seed;
+        for(member = 0; member < member_count; ++member)
+            local_func[slots[member]] = func[members[member]];
+    }
+
+    free(bucket_size);
+    free(bucket_start);
+    free(bucket_func);
+    free(slots);
+    return res;
+}
+
+// Functions sorted by dstc_build_local_index()
+static dispatch_table_t* sort_func = 0;
+
+// Order indexes into sort_func by name, and then by index.
+static int dstc_compare_local_func(const void* a, const void* b)
+{
+    dispatch_table_t* func_a = &sort_func[*(uint32_t*) a];
+    dispatch_table_t* func_b = &sort_func[*(uint32_t*) b];
+    uint32_t len = (func_a->name_len < func_b->name_len)?func_a->name_len:func_b->name_len;
+    int res = memcmp(func_a->func_name, func_b->func_name, len);
+
+    if (res)
+        return res;
+
+    if (func_a->name_len != func_b->name_len)
+        return (func_a->name_len < func_b->name_len)?-1:1;
+
+    return (*(uint32_t*) a < *(uint32_t*) b)?-1:1;
+}
+
+// Collect the records of all dstc_servers sections and all functions
+// registered at runtime, and index them with a perfect hash. Runtime
+// registrations take precedence over records with the same name.
+static void dstc_build_local_index(void)
+{
+    dispatch_table_t* func = 0;
+    dispatch_table_t* unique = 0;
+    uint32_t unique_count = 0;
+    uint32_t* order = 0;
+    uint32_t count = registered_func_count;
+    uint32_t size = 0;
+    uint32_t ind = 0;
+    uint32_t sect = 0;
+    const dstc_server_record_t* rec = 0;
+
+    for(sect = 0; sect < record_section_count; ++sect)
+        count += record_sections[sect].stop - record_sections[sect].start;
+
+    if (__start_dstc_servers)
+        count += __stop_dstc_servers - __start_dstc_servers;
+
+    func = malloc((count?count:1) * sizeof(dispatch_table_t));
+    count = 0;
+
+    for(sect = 0; sect <= record_section_count; ++sect) {
+        const dstc_server_record_t* start = __start_dstc_servers;
+        const dstc_server_record_t* stop = __stop_dstc_servers;
+
+        if (sect < record_section_count) {
+            start = record_sections[sect].start;
+            stop = record_sections[sect].stop;
+        }
+
+        for(rec = start; rec && rec < stop; ++rec) {
+            func[count].func_name = rec->name;
+            func[count].name_len = strlen(rec->name);
+            func[count].handler.func = rec->func;
+            func[count].handler.ctx_func = 0;
+            func[count].handler.ctx = 0;
+            func[count].handler.batch_func = rec->batch_func;
+            count++;
+        }
+    }
+
+    if (registered_func_count)
+        memcpy(func + count, registered_func, registered_func_count * sizeof(dispatch_table_t));
+    count += registered_func_count;
+
+    // Drop all but the last function with a given name. Sorting by
+    // name, and then by position, puts it last among its namesakes.
+    order = malloc((count?count:1) * sizeof(uint32_t));
+    for(ind = 0; ind < count; ++ind)
+        order[ind] = ind;
+
+    sort_func = func;
+    qsort(order, count, sizeof(uint32_t), dstc_compare_local_func);
+
+    unique = malloc((count?count:1) * sizeof(dispatch_table_t));
+    for(ind = 0; ind < count; ++ind) {
+        dispatch_table_t* cur = &func[order[ind]];
+        dispatch_table_t* next = (ind + 1 < count)?&func[order[ind + 1]]:0;
+
+        if (!next ||
+            next->name_len != cur->name_len ||
+            memcmp(next->func_name, cur->func_name, cur->name_len))
+            unique[unique_count++] = *cur;
+    }
+
+    free(order);
+    free(func);
+    func = unique;
+    count = unique_count;
+
+    free(local_func);
+    free(local_index);
+    local_func = 0;
+    local_index = 0;
+    local_index_size = 0;
+    local_index_dirty = 0;
+    local_index_registered = registered_func_count;
+
+    // A larger table makes placement easier, and is retried should
+    // a bucket fail to find a seed.
+    for(size = count; count && dstc_place_local_index(func, count, size); size *= 2) {
+        free(local_func);
+        free(local_index);
+    }
+
+    local_index_size = count?size:0;
+    free(func);
+}
+
+// Bring the index up to date with all registered functions.
+static void dstc_update_local_index(void)
+{
+    dstc_scan_shared_objects();
+
+    if (local_index_dirty || local_index_registered != registered_func_count)
+        dstc_build_local_index();
+}
+
+static dstc_handler_t* dstc_find_local_function(char* name, int name_len);
+
+// A function not in the index may be served by a shared object
+// loaded since the index was built. Look again if there is one.
+static dstc_handler_t* dstc_find_loaded_function(char* name, int name_len)
+{
+    unsigned long long adds = record_scan_adds;
+
+    dstc_scan_shared_objects();
+    if (!local_index_dirty && adds == record_scan_adds)
+        return 0;
+
+    dstc_build_local_index();
+    return dstc_find_local_function(name, name_len);
+}
+
+// Retrieve a function pointer by name previously registered through
+// DSTC_SERVER() or dstc_register_local_function()
 //
-static void (*dstc_find_local_function(char* name, int name_len))(rmc_node_id_t node_id, uint8_t*)
+static dstc_handler_t* dstc_find_local_function(char* name, int name_len)
 {
-    int i = local_func_ind;
-    while(i--) {
-        if (!strncmp(local_func[i].func_name, name, name_len))
-            return local_func[i].server_func;
+    dispatch_table_t* entry = 0;
+    int32_t seed = 0;
+    uint32_t ind = registered_func_count;
+
+    if (local_index_dirty)
+        dstc_build_local_index();
+
+    // Functions registered since the index was built take precedence.
+    while(ind-- > local_index_registered) {
+        entry = &registered_func[ind];
+        if (entry->name_len == name_len && !memcmp(entry->func_name, name, name_len))
+            return &entry->handler;
     }
-    return (void (*) (rmc_node_id_t, uint8_t*)) 0;
+
+    if (!local_index_size)
+        return dstc_find_loaded_function(name, name_len);
+
+    seed = local_index[dstc_name_hash(0, name, name_len) % local_index_size];
+    if (seed < 0)
+        entry = &local_func[-seed - 1];
+    else
+        entry = &local_func[dstc_name_hash(seed, name, name_len) % local_index_size];
+
+    if (!entry->func_name ||
+        entry->name_len != name_len ||
+        memcmp(entry->func_name, name, name_len))
+        return dstc_find_loaded_function(name, name_len);
+
+    return &entry->handler;
 }
 
+static void dstc_register_local_handler(char* name, dstc_handler_t* handler)
+{
+    if (registered_func_count == registered_func_size) {
+        registered_func_size = registered_func_size?registered_func_size * 2:16;
+        registered_func = realloc(registered_func, registered_func_size * sizeof(dispatch_table_t));
+    }
 
-// Register a function name - pointer relationship.
-// Called by file constructor function _dstc_register_[name]()
-// generated by DSTC_SERVER() macro.
+    registered_func[registered_func_count].func_name = strdup(name);
+    registered_func[registered_func_count].name_len = strlen(name);
+    registered_func[registered_func_count].handler = *handler;
+    registered_func_count++;
+
+    if (registered_func_count - local_index_registered > LOCAL_INDEX_BACKLOG)
+        local_index_dirty = 1;
+}
+
+// Add the dstc_servers section of a shared object.
+// Called by dstc_scan_shared_objects(), and by the constructor
+// generated by DSTC_REGISTER_SHARED_OBJECT().
+void dstc_register_server_records(const dstc_server_record_t* start,
+                                  const dstc_server_record_t* stop)
+{
+    uint32_t ind = 0;
+
+    // The section of the main program is always searched.
+    if (!start || !stop || start == __start_dstc_servers)
+        return;
+
+    for(ind = 0; ind < record_section_count; ++ind)
+        if (record_sections[ind].start == start)
+            return;
+
+    record_sections = realloc(record_sections, (record_section_count + 1) * sizeof(struct record_section));
+    record_sections[record_section_count].start = start;
+    record_sections[record_section_count].stop = stop;
+    record_section_count++;
+    local_index_dirty = 1;
+}
+
+// Dynamic section entries hold addresses, or offsets from the load
+// address of the object if the dynamic linker left them unrelocated.
+#define DYNAMIC_ADDR(info, ptr)                                         \
+    ((const void*) ((ptr) < (info)->dlpi_addr?(info)->dlpi_addr + (ptr):(ptr)))
+
+// Look up a symbol defined by a loaded object in its dynamic symbol
+// table, through its GNU or SysV hash table.
+// Returns its address, or 0 if the object does not define it.
+static const void* dstc_find_object_symbol(struct dl_phdr_info* info, const char* name)
+{
+    const ElfW(Dyn)* dyn = 0;
+    const ElfW(Sym)* symtab = 0;
+    const ElfW(Sym)* sym = 0;
+    const char* strtab = 0;
+    const uint32_t* gnu_hash = 0;
+    const ElfW(Word)* sysv_hash = 0;
+    const unsigned char* ptr = 0;
+    uint32_t hash = 0;
+    uint32_t ind = 0;
+
+    for(ind = 0; ind < info->dlpi_phnum; ++ind)
+        if (info->dlpi_phdr[ind].p_type == PT_DYNAMIC)
+            dyn = (const ElfW(Dyn)*) (info->dlpi_addr + info->dlpi_phdr[ind].p_vaddr);
+
+    for(; dyn && dyn->d_tag != DT_NULL; ++dyn) {
+        switch(dyn->d_tag) {
+        case DT_SYMTAB:
+            symtab = DYNAMIC_ADDR(info, dyn->d_un.d_ptr);
+            break;
+        case DT_STRTAB:
+            strtab = DYNAMIC_ADDR(info, dyn->d_un.d_ptr);
+            break;
+        case DT_GNU_HASH:
+            gnu_hash = DYNAMIC_ADDR(info, dyn->d_un.d_ptr);
+            break;
+        case DT_HASH:
+            sysv_hash = DYNAMIC_ADDR(info, dyn->d_un.d_ptr);
+            break;
+        }
+    }
+
+    if (!symtab || !strtab)
+        return 0;
+
+    if (gnu_hash) {
+        // Buckets and chains follow the header and the bloom filter.
+        uint32_t bucket_count = gnu_hash[0];
+        uint32_t sym_offset = gnu_hash[1];
+        const uint32_t* buckets = gnu_hash + 4 + gnu_hash[2] * (sizeof(ElfW(Addr)) / sizeof(uint32_t));
+        const uint32_t* chain = buckets + bucket_count;
+
+        hash = 5381;
+        for(ptr = (const unsigned char*) name; *ptr; ++ptr)
+            hash = hash * 33 + *ptr;
+
+        for(ind = buckets[hash % bucket_count]; ind && ind >= sym_offset; ++ind) {
+            if ((chain[ind - sym_offset] | 1) == (hash | 1) &&
+                !strcmp(strtab + symtab[ind].st_name, name)) {
+                sym = &symtab[ind];
+                break;
+            }
+
+            if (chain[ind - sym_offset] & 1)
+                break;
+        }
+    } else if (sysv_hash) {
+        for(ptr = (const unsigned char*) name; *ptr; ++ptr) {
+            hash = (hash << 4) + *ptr;
+            hash = (hash ^ ((hash & 0xf0000000) >> 24)) & 0x0fffffff;
+        }
+
+        for(ind = sysv_hash[2 + hash % sysv_hash[0]]; ind; ind = sysv_hash[2 + sysv_hash[0] + ind])
+            if (!strcmp(strtab + symtab[ind].st_name, name)) {
+                sym = &symtab[ind];
+                break;
+            }
+    }
+
+    if (!sym || sym->st_shndx == SHN_UNDEF)
+        return 0;
+
+    return (const void*) (info->dlpi_addr + sym->st_value);
+}
+
+static int dstc_scan_object(struct dl_phdr_info* info, size_t size, void* data)
+{
+    dstc_register_server_records(dstc_find_object_symbol(info, "__start_dstc_servers"),
+                                 dstc_find_object_symbol(info, "__stop_dstc_servers"));
+    return 0;
+}
+
+static int dstc_count_objects(struct dl_phdr_info* info, size_t size, void* data)
+{
+    *(unsigned long long*) data = info->dlpi_adds;
+    return 1;
+}
+
+// Add the dstc_servers sections of all loaded shared objects. The
+// linker exports the bounds of the section of each object that has
+// servers. Looked for at startup, and again as objects are loaded.
+static void dstc_scan_shared_objects(void)
+{
+    unsigned long long adds = 0;
+
+    dl_iterate_phdr(dstc_count_objects, &adds);
+    if (adds == record_scan_adds)
+        return;
+
+    record_scan_adds = adds;
+    dl_iterate_phdr(dstc_scan_object, 0);
+}
+
+// Register a function name - pointer relationship at runtime.
+// Functions declared with DSTC_SERVER() are registered through
+// their dstc_server_record_t instead.
 //
 void dstc_register_local_function(char* name, void (*server_func)(rmc_node_id_t node_id, uint8_t*))
 {
-    if (local_func_ind == SYMTAB_SIZE - 1) {
-        RMC_LOG_FATAL("Out of memory trying to register local function. SYMTAB_SIZE=%d\n", SYMTAB_SIZE);
-        exit(255);
-    }
-        
-    strcpy(local_func[local_func_ind].func_name, name);
-    local_func[local_func_ind].server_func = server_func;
-    local_func_ind++;
+    dstc_handler_t handler = { .func = server_func, .ctx_func = 0, .ctx = 0 };
+
+    dstc_register_local_handler(name, &handler);
+}
+
+// Register a function name - pointer relationship where the
+// function is invoked with ctx as its first argument.
+// Used by language bindings, such as dstc.hpp, to register closures.
+//
+void dstc_register_local_function_ctx(char* name,
+                                      void (*server_func)(void* ctx, rmc_node_id_t node_id, uint8_t*),
+                                      void* ctx)
+{
+    dstc_handler_t handler = { .func = 0, .ctx_func = server_func, .ctx = ctx };
+
+    dstc_register_local_handler(name, &handler);
 }
 
 // Retrieve a callback function. Each time it is invoked, it will be deleted.
 // dstc_register_local_function()
+// Returns 0 if the callback was not found.
 //
-static void (*dstc_find_callback(uint64_t func_addr))(rmc_node_id_t node_id, uint8_t*)
+static int dstc_find_callback(uint64_t func_addr, dstc_handler_t* result)
 {
     int i = 0;
     while(i < callback_ind) {
-        if ((uint64_t) local_callback[i] == func_addr) {
-            callback_t res = local_callback[i];
+        if (local_callback[i].func_addr == func_addr) {
+            *result = local_callback[i].handler;
             // Nill out the callback since it is a one-time shot thing.
-            local_callback[i] = 0;
-            return res;
+            local_callback[i].func_addr = 0;
+            return 1;
         }
         ++i;
     }
     RMC_LOG_COMMENT("Did not find callback [%lX]\n", func_addr);
-    return (callback_t) 0;
+    return 0;
 }
 
-
-// Register a function name - pointer relationship.
-// Called by file constructor function _dstc_register_[name]()
-// generated by DSTC_SERVER() macro.
-//
-void dstc_register_callback(void (*callback)(rmc_node_id_t node_id, uint8_t*))
+static void dstc_register_callback_handler(uint64_t func_addr, dstc_handler_t* handler)
 {
     int ind = 0;
     // Find a previously freed slot, or allocate a new one
     while(ind < callback_ind) {
-        if (!local_callback[ind])
+        if (!local_callback[ind].func_addr)
             break;
         ++ind;
     }
@@ -176,592 +1051,4774 @@ void dstc_register_callback(void (*callback)(rmc_node_id_t node_id, uint8_t*))
         RMC_LOG_FATAL("Out of memory trying to register callback. SYMTAB_SIZE=%d\n", SYMTAB_SIZE);
         exit(255);
     }
-    local_callback[callback_ind] = callback;;
-    RMC_LOG_FATAL("Registered callback [%lX]", (uint64_t) callback);
-    callback_ind++;
+    local_callback[ind].func_addr = func_addr;
+    local_callback[ind].handler = *handler;
+    RMC_LOG_DEBUG("Registered callback [%lX]", func_addr);
+    if (ind == callback_ind)
+        callback_ind++;
+}
+
+// Register a function name - pointer relationship.
+// Called by file constructor function _dstc_register_[name]()
+// generated by DSTC_SERVER() macro.
+//
+void dstc_register_callback(void (*callback)(rmc_node_id_t node_id, uint8_t*))
+{
+    dstc_handler_t handler = { .func = callback, .ctx_func = 0, .ctx = 0 };
+
+    dstc_register_callback_handler((uint64_t) callback, &handler);
+}
+
+// Register a one-shot callback invoked with ctx as its first argument.
+// Returns the callback address to give to the server. The address
+// carries the node id, and is not reused, so a late reply can't reach
+// a newer callback with the same ctx.
+uint64_t dstc_register_callback_ctx(void (*callback)(void* ctx, rmc_node_id_t node_id, uint8_t*),
+                                    void* ctx)
+{
+    dstc_handler_t handler = { .func = 0, .ctx_func = callback, .ctx = ctx };
+    uint64_t func_addr = 0;
+
+    if (!initialized)
+        dstc_setup();
+
+    func_addr = CALLBACK_ID_FLAG | ((uint64_t) dstc_get_node_id() << 30) |
+        (callback_next_id++ & CALLBACK_ID_MASK);
+
+    dstc_register_callback_handler(func_addr, &handler);
+    return func_addr;
+}
+
+// Delete a callback registered by dstc_register_callback_ctx() that
+// has not yet been invoked.
+// Returns its ctx, to be released by the caller, or 0 if it was not found.
+void* dstc_cancel_callback_ctx(uint64_t func_addr)
+{
+    dstc_handler_t handler = { .func = 0, .ctx_func = 0, .ctx = 0 };
+
+    dstc_find_callback(func_addr, &handler);
+    return handler.ctx;
 }
 
 void dstc_cancel_callback(void (*callback)(rmc_node_id_t node_id, uint8_t*))
 {
+    dstc_handler_t handler;
+
     // Will delete the callback.
-    dstc_find_callback((uint64_t) callback);
+    dstc_find_callback((uint64_t) callback, &handler);
 }
 
-static struct remote_func_t* dstc_find_remote_func(char* func_name)
+static struct client_func_t* dstc_find_client_func(char* func_name)
 {
-    int ind = remote_func_ind;
+    int ind = client_func_ind;
 
     while(ind--) {
-        if (!strcmp(func_name, remote_func[ind].func_name))
-            return &remote_func[ind];
+        if (!strcmp(func_name, client_func[ind].func_name))
+            return &client_func[ind];
     }
     return 0;
 }
 
-// Register a remote function as provided by the remote DSTC server
-// through a control message call processed by
-// dstc_subscriber_control_message_cb()
-//
-void dstc_register_remote_function(char* name)
+// Find the client attributes of a function, creating
+// a default entry if it does not exist.
+static struct client_func_t* dstc_get_client_func(char* func_name)
 {
-    struct remote_func_t* remote = dstc_find_remote_func(name);
+    struct client_func_t* client = dstc_find_client_func(func_name);
+
+    if (client)
+        return client;
 
-    // Is this an additional registration of an existing function.
-    if (remote) {
-        remote->count++;
-        RMC_LOG_INFO("Remote function [%s] now supported by %d nodes", remote->func_name, remote->count);
-        return;
-    }
-    
     // Are we out of memory
-    if (remote_func_ind == SYMTAB_SIZE) {
-        RMC_LOG_FATAL("Out of memory trying to register remote func. SYMTAB_SIZE=%d\n", SYMTAB_SIZE);
+    if (client_func_ind == SYMTAB_SIZE) {
+        RMC_LOG_FATAL("Out of memory trying to register client func. SYMTAB_SIZE=%d\n", SYMTAB_SIZE);
         exit(255);
     }
 
-    remote = &remote_func[remote_func_ind];
-    ++remote_func_ind;
-
-    strncpy(remote->func_name, (uint8_t*) name, sizeof(remote->func_name));
-    remote->func_name[sizeof(remote->func_name)-1] = 0;
-    remote->count = 1;
-    RMC_LOG_INFO("Remote [%s] now supported by one (first) node", remote->func_name, remote->count);
+    client = &client_func[client_func_ind];
+    ++client_func_ind;
+
+    strncpy(client->func_name, func_name, sizeof(client->func_name));
+    client->func_name[sizeof(client->func_name)-1] = 0;
+    client->priority = DSTC_PRIO_NORMAL;
+    client->deadline_usec = 0;
+    client->conflate = 0;
+    client->key_offset = 0;
+    client->key_len = 0;
+    client->keyframe_interval = 0;
+    client->since_keyframe = 0;
+    client->keyframe_due = 0;
+    client->delta_seq = 0;
+    client->snapshot_len = 0;
+    client->snapshot = 0;
+    client->no_server = DSTC_NO_SERVER_SEND;
+    client->max_parked = 0;
+    client->parked_count = 0;
+    client->parked_head = 0;
+    client->parked_tail = 0;
+    client->cache_mode = DSTC_CACHE_NONE;
+    client->cache_max = 0;
+    client->cache_key_offset = 0;
+    client->cache_key_len = 0;
+    client->cache_count = 0;
+    client->cache_head = 0;
+    client->cache_tail = 0;
+    client->latency = 0;
+    return client;
 }
 
+int dstc_set_client_priority(char* function_name, uint8_t priority)
+{
+    if (priority >= DSTC_PRIO_COUNT)
+        return EINVAL;
 
+    dstc_get_client_func(function_name)->priority = priority;
+    return 0;
+}
 
-
-static void poll_add(user_data_t user_data,
-                     int descriptor,
-                     uint32_t event_user_data,
-                     rmc_poll_action_t action)
+int dstc_set_drain_mode(uint8_t mode, uint32_t weights[DSTC_PRIO_COUNT])
 {
-    struct epoll_event ev = {
-        .data.u32 = event_user_data,
-        .events = 0 // EPOLLONESHOT
-    };
+    int prio = 0;
 
-    if (action & RMC_POLLREAD)
-        ev.events |= EPOLLIN;
+    if (mode != DSTC_DRAIN_STRICT && mode != DSTC_DRAIN_WEIGHTED)
+        return EINVAL;
 
-    if (action & RMC_POLLWRITE)
-        ev.events |= EPOLLOUT;
+    drain_mode = mode;
+    if (!weights)
+        return 0;
 
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, descriptor, &ev) == -1) {
-        RMC_LOG_INDEX_FATAL(event_user_data & USER_DATA_INDEX_MASK, "epoll_ctl(add)");
-        exit(255);
-    }
-}
+    // A zero weight would starve the class forever.
+    for(prio = 0; prio < DSTC_PRIO_COUNT; ++prio)
+        drain_weights[prio] = weights[prio]?weights[prio]:1;
 
+    return 0;
+}
 
-static void poll_add_sub(user_data_t user_data,
-                         int descriptor,
-                         rmc_index_t index,
-                         rmc_poll_action_t action)
+void dstc_set_client_deadline(char* function_name, usec_timestamp_t max_age_usec)
 {
-    poll_add(user_data, descriptor, (uint32_t) index, action);
+    dstc_get_client_func(function_name)->deadline_usec = max_age_usec;
 }
 
-static void poll_add_pub(user_data_t user_data,
-                         int descriptor,
-                         rmc_index_t index,
-                         rmc_poll_action_t action)
+// Deadline applied to the next queued call only,
+// overriding the deadline of the function.
+void dstc_set_next_call_deadline(usec_timestamp_t max_age_usec)
 {
-    poll_add(user_data, descriptor, ((uint32_t) index) | USER_DATA_PUB_FLAG, action);
+    next_call_deadline = max_age_usec;
 }
 
+// Pad the arguments of the next queued call to DSTC_ARRAY_ALIGN bytes.
+// Set by client functions with DECL_DYNAMIC_ARRAY() arguments.
+void dstc_set_next_call_aligned(void)
+{
+    next_call_aligned = 1;
+}
 
-
-static void poll_modify(user_data_t user_data,
-                        int descriptor,
-                        uint32_t event_user_data,
-                        rmc_poll_action_t old_action,
-                        rmc_poll_action_t new_action)
+void dstc_get_deadline_stats(dstc_deadline_stats_t* stats)
 {
-    struct epoll_event ev = {
-        .data.u32 = event_user_data,
-        .events = 0 // EPOLLONESHOT
-    };
+    *stats = deadline_stats;
+}
 
-    if (old_action == new_action)
-        return ;
-    
-    if (new_action & RMC_POLLREAD)
-        ev.events |= EPOLLIN;
+// Mark a function as conflatable. The key is key_len bytes at
+// key_offset in the serialized arguments, which is the sum of the
+// sizes of all arguments ahead of the key argument.
+// A key_len of zero conflates all calls to the function.
+void dstc_set_client_conflation(char* function_name, uint32_t key_offset, uint32_t key_len)
+{
+    struct client_func_t* client = dstc_get_client_func(function_name);
 
-    if (new_action & RMC_POLLWRITE)
-        ev.events |= EPOLLOUT;
+    client->conflate = 1;
+    client->key_offset = key_offset;
+    client->key_len = key_len;
+}
 
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, descriptor, &ev) == -1) {
-        RMC_LOG_INDEX_FATAL(event_user_data & USER_DATA_INDEX_MASK, "epoll_ctl(modify): %s", strerror(errno));
-        exit(255);
-    }
+void dstc_get_conflation_stats(dstc_conflation_stats_t* stats)
+{
+    *stats = conflation_stats;
 }
 
-static void poll_modify_pub(user_data_t user_data,
-                            int descriptor,
-                            rmc_index_t index,
-                            rmc_poll_action_t old_action,
-                            rmc_poll_action_t new_action)
+// FNV-1a hash of a conflation key.
+static uint64_t dstc_conflation_key(uint8_t* key, uint32_t key_len)
 {
-    poll_modify(user_data,
-                descriptor,
-                ((uint32_t) index) | USER_DATA_PUB_FLAG,
-                old_action,
-                new_action);
+    uint64_t hash = 0xcbf29ce484222325;
+
+    while(key_len--) {
+        hash ^= *key++;
+        hash *= 0x100000001b3;
+    }
+    return hash;
 }
 
-static void poll_modify_sub(user_data_t user_data,
-                            int descriptor,
-                            rmc_index_t index,
-                            rmc_poll_action_t old_action,
-                            rmc_poll_action_t new_action)
+// Deadlines are compared across nodes and use the wall clock,
+// which is expected to be kept in sync by NTP or similar.
+static usec_timestamp_t dstc_realtime_usec(void)
 {
-    poll_modify(user_data,
-                descriptor,
-                (uint32_t) index,
-                old_action,
-                new_action);
-}
+    struct timespec ts;
 
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (usec_timestamp_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
-static void poll_remove(user_data_t user_data,
-                        int descriptor,
-                        rmc_index_t index)
+static uint32_t dstc_header_ext_len(uint8_t flags)
 {
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, descriptor, 0) == -1) {
-        RMC_LOG_INDEX_WARNING(index, "epoll_ctl(delete): %s", strerror(errno));
-        return;
-    }
-    RMC_LOG_INDEX_COMMENT(index, "poll_remove()");
+    uint32_t len = 0;
+    int bit = 0;
+
+    for(bit = 0; bit < 8; ++bit)
+        if (flags & (1 << bit))
+            len += header_ext_size[bit];
+
+    return len;
 }
 
+// Return the header extension for flag, or 0 if the call does not carry it.
+static uint8_t* dstc_header_ext(dstc_header_t* call, uint8_t flag)
+{
+    if (!(call->flags & flag))
+        return 0;
+
+    // Extensions of lower flag bits come first.
+    return call->payload + dstc_header_ext_len(call->flags & (flag - 1));
+}
 
-usec_timestamp_t dstc_get_timeout_timestamp()
+uint32_t dstc_call_count(dstc_header_t* call)
 {
-    usec_timestamp_t sub_event_tout_ts = 0;
-    usec_timestamp_t pub_event_tout_ts = 0;
+    uint8_t* bulk = dstc_header_ext(call, DSTC_FLAG_BULK);
+    uint32_t count = 1;
 
-    rmc_pub_timeout_get_next(&_dstc_pub_ctx, &pub_event_tout_ts);
-    rmc_sub_timeout_get_next(&_dstc_sub_ctx, &sub_event_tout_ts);
+    if (bulk)
+        memcpy(&count, bulk, sizeof(uint32_t));
 
-    // Figure out the shortest event timeout between pub and sub context
-    if (pub_event_tout_ts == -1 && sub_event_tout_ts == -1)
-        return -1;
+    return count;
+}
 
-    if (pub_event_tout_ts == -1 && sub_event_tout_ts != -1)
-        return sub_event_tout_ts;
+// Function name, or callback address if name_len is zero.
+static uint8_t* dstc_call_name(dstc_header_t* call)
+{
+    return call->payload + dstc_header_ext_len(call->flags);
+}
 
-    if (pub_event_tout_ts != -1 && sub_event_tout_ts == -1)
-        return pub_event_tout_ts;
+static uint8_t* dstc_call_args(dstc_header_t* call)
+{
+    uint8_t* pad = dstc_header_ext(call, DSTC_FLAG_ALIGNED);
 
-    return (pub_event_tout_ts < sub_event_tout_ts)?
-        pub_event_tout_ts:sub_event_tout_ts;
+    return dstc_call_name(call) + (call->name_len?call->name_len:sizeof(uint64_t)) + (pad?*pad:0);
 }
 
+// Return the conflation key bytes of a call, or 0 if the key does not
+// fit inside its arguments.
+static uint8_t* dstc_call_conflation_key(dstc_header_t* call, uint32_t* key_len)
+{
+    uint8_t* ext = dstc_header_ext(call, DSTC_FLAG_CONFLATE);
+    uint8_t* args = dstc_call_args(call);
+    uint32_t args_len = call->payload_len - (args - call->payload);
+    uint32_t key_offset = *(uint32_t*) (ext + sizeof(uint64_t));
 
-int dstc_get_timeout_msec(void)
+    *key_len = *(uint32_t*) (ext + sizeof(uint64_t) + sizeof(uint32_t));
+    if (key_offset > args_len || *key_len > args_len - key_offset)
+        return 0;
+
+    return args + key_offset;
+}
+
+// Do two conflatable calls share the same function name and key?
+static int dstc_call_conflates(dstc_header_t* a, dstc_header_t* b)
 {
-    usec_timestamp_t tout = dstc_get_timeout_timestamp();
+    uint8_t* a_key = 0;
+    uint8_t* b_key = 0;
+    uint32_t a_key_len = 0;
+    uint32_t b_key_len = 0;
 
-    if (tout == -1)
-        return -1;
+    if (!(a->flags & DSTC_FLAG_CONFLATE) || !(b->flags & DSTC_FLAG_CONFLATE))
+        return 0;
 
-    // Convert to relative timestamp.
-    tout -= rmc_usec_monotonic_timestamp();
-    if (tout < 0)
+    if (a->node_id != b->node_id || a->name_len != b->name_len || !a->name_len)
+        return 0;
+
+    if (*(uint64_t*) dstc_header_ext(a, DSTC_FLAG_CONFLATE) !=
+        *(uint64_t*) dstc_header_ext(b, DSTC_FLAG_CONFLATE))
         return 0;
-    
-    return tout / 1000 + 1;
-}
 
+    if (memcmp(dstc_call_name(a), dstc_call_name(b), a->name_len))
+        return 0;
 
-int dstc_process_single_event(int timeout)
-{
-    int nfds = 0;
-    struct epoll_event events[dstc_get_socket_count()];
-        
-    nfds = epoll_wait(epoll_fd, events, sizeof(events) / sizeof(events[0]), timeout);
+    // Same hash. Make sure it is the same key, and not a collision.
+    a_key = dstc_call_conflation_key(a, &a_key_len);
+    b_key = dstc_call_conflation_key(b, &b_key_len);
 
-    if (nfds == -1) {
-        RMC_LOG_FATAL("epoll_wait(): %s", strerror(errno));
-        exit(255);
-    }
+    return a_key && b_key && a_key_len == b_key_len && !memcmp(a_key, b_key, a_key_len);
+}
 
-    // Timeout
-    if (nfds == 0) 
-        return ETIME;
+static int dstc_call_expired(dstc_header_t* call, usec_timestamp_t now)
+{
+    uint8_t* deadline = dstc_header_ext(call, DSTC_FLAG_DEADLINE);
 
-    // Process all pending events.
-    while(nfds--) 
-        dstc_process_epoll_result(&events[nfds]);
+    return deadline && *(usec_timestamp_t*) deadline < now;
 }
 
-int dstc_process_events(usec_timestamp_t timeout_arg)
+// Delta encode the arguments of calls to a function against those of
+// the previous call, with full arguments sent every keyframe_interval
+// calls. A keyframe_interval of zero disables delta encoding.
+void dstc_set_client_delta(char* function_name, uint32_t keyframe_interval)
 {
-    usec_timestamp_t timeout_ts = 0;
-    usec_timestamp_t now = 0;
-    
-    if (!initialized)
-        dstc_setup();
+    struct client_func_t* client = dstc_get_client_func(function_name);
 
-    // Calculate an absolute timeout timestamp based on relative
-    // timestamp provided in argument.
-    
-    timeout_ts = (timeout_arg == -1)?-1:(rmc_usec_monotonic_timestamp() + timeout_arg);
+    client->keyframe_interval = keyframe_interval;
+    client->keyframe_due = 1;
+}
 
-    // Process evdents until we reach the timeout therhold.
-    while((now = rmc_usec_monotonic_timestamp()) < timeout_ts || timeout_ts == -1) {
-        usec_timestamp_t timeout = 0;
-        char is_arg_timeout = 0;
-        usec_timestamp_t event_tout_ts = 0;
+void dstc_get_delta_stats(dstc_delta_stats_t* stats)
+{
+    *stats = delta_stats;
+}
 
-        event_tout_ts = dstc_get_timeout_timestamp();
+// Have the next call to every delta encoded function carry full
+// arguments, allowing nodes that missed earlier calls to resync.
+static void dstc_delta_force_keyframes(void)
+{
+    int ind = client_func_ind;
 
-        // Figure out the shortest timeout between argument and event timeout
-        if (timeout_ts == -1 && event_tout_ts == -1) {
-            RMC_LOG_DEBUG("Both argument and event timeout are -1 -> -1");
-            timeout = -1;
-        }
+    while(ind--)
+        client_func[ind].keyframe_due = 1;
+}
 
-        if (timeout_ts == -1 && event_tout_ts != -1) {
-            timeout = (event_tout_ts - now) / 1000 + 1 ;
-            RMC_LOG_DEBUG("arg timeout == -1. Event timeout != -1 -> %ld", timeout);
-        }
+static void dstc_retire_pending(pending_call_t* pend, int status);
 
-        if (timeout_ts != -1 && event_tout_ts == -1) {
-            timeout = (timeout_ts - now) / 1000 + 1 ;
-            RMC_LOG_DEBUG("arg timeout != -1. Event timeout == -1 -> %ld", timeout);
-        }
+// Is delta sequence number a later than b? Sequence numbers wrap.
+static int dstc_delta_seq_after(uint32_t a, uint32_t b)
+{
+    return (int32_t) (a - b) > 0;
+}
 
-        if (timeout_ts != -1 && event_tout_ts != -1) {
-            if (event_tout_ts < timeout_ts) {
-                timeout = (event_tout_ts - now) / 1000 + 1;
-                
-                is_arg_timeout = 0;
-            } else {
-                timeout = (timeout_ts - now) / 1000 + 1;
-                is_arg_timeout = 1;
-            }
-                
-            if (event_tout_ts < timeout_ts) {
-                RMC_LOG_DEBUG("event timeout is less than arg timeout -> %ld", timeout);
-            }
-            else {
-                RMC_LOG_DEBUG("arg timeout is less than event timeout -> %ld", timeout);
-            }
-        }
+// Remove the call at offset from a staged packet.
+// The packet is unlinked and retired if it has no calls left.
+static void dstc_pending_remove_call(uint8_t prio, pending_call_t** link,
+                                     pending_call_t* prev, uint32_t offset)
+{
+    pending_call_t* pend = *link;
+    dstc_header_t* call = (dstc_header_t*) (pend->call + offset);
+    uint32_t len = sizeof(dstc_header_t) + call->payload_len;
 
-        if (dstc_process_single_event((int) timeout) == ETIME) {
-            // Did we time out on an RMC event to be processed, or did
-            // we time out on the argument provided to
-            // dstc_process_events()?
-            if (is_arg_timeout) {
-                RMC_LOG_DEBUG("Timed out on argument. returning" );
-                return ETIME;
-            }
+    memmove(pend->call + offset, pend->call + offset + len, pend->call_len - offset - len);
+    pend->call_len -= len;
+    pend->call_count = pend->call_count?pend->call_count - 1:0;
+    backlog.staged_bytes -= len;
 
-            // Make rmc calls to handle scheduled events.
-            dstc_process_timeout();
-            continue;
-        }
-    }
+    if (pend->call_len)
+        return;
 
-    return 0;
+    *link = pend->next;
+    if (pending[prio].tail == pend)
+        pending[prio].tail = prev;
+
+    pending[prio].count--;
+    backlog.staged_packets--;
+    dstc_retire_pending(pend, ECANCELED);
 }
 
-extern void dstc_process_epoll_result(struct epoll_event* event)
+// Turn the staged call at offset into a keyframe carrying the current
+// snapshot of client, which holds the arguments of its newest call.
+// Returns 0, or ENOMEM if the packet could not be resized.
+static int dstc_pending_make_keyframe(struct client_func_t* client,
+                                      uint8_t prio,
+                                      pending_call_t** link,
+                                      uint32_t offset)
 {
-    int res = 0;
-    uint8_t op_res = 0;
-    rmc_index_t c_ind = (rmc_index_t) event->data.u32 & USER_DATA_INDEX_MASK;
-    int is_pub = (event->data.u32 & USER_DATA_PUB_FLAG)?1:0;
+    pending_call_t* pend = *link;
+    dstc_header_t* call = (dstc_header_t*) (pend->call + offset);
+    uint32_t head_len = dstc_call_args(call) - pend->call - offset;
+    uint32_t old_len = sizeof(dstc_header_t) + call->payload_len;
+    uint32_t new_len = head_len + client->snapshot_len;
+    uint32_t tail_len = pend->call_len - offset - old_len;
 
-    RMC_LOG_INDEX_DEBUG(c_ind, "%s: %s%s%s",
-                        (is_pub?"pub":"sub"),
-                        ((event->events & EPOLLIN)?" read":""),
-                        ((event->events & EPOLLOUT)?" write":""),
-                        ((event->events & EPOLLHUP)?" disconnect":""));
+    if (pend->call_len - old_len + new_len > RMC_MAX_PAYLOAD)
+        return ENOMEM;
 
+    if (new_len > old_len) {
+        pending_call_t* grown = realloc(pend, sizeof(pending_call_t) + pend->call_len - old_len + new_len);
 
-    if (event->events & EPOLLIN) {
-        if (is_pub)
-            res = rmc_pub_read(&_dstc_pub_ctx, c_ind, &op_res);
-        else
-            res = rmc_sub_read(&_dstc_sub_ctx, c_ind, &op_res);
+        if (!grown)
+            return ENOMEM;
 
-        RMC_LOG_INDEX_DEBUG(c_ind, "read result: %s - %s", _op_res_string(op_res),   strerror(res));
+        if (pending[prio].tail == pend)
+            pending[prio].tail = grown;
+
+        *link = pend = grown;
+        call = (dstc_header_t*) (pend->call + offset);
     }
 
-    if (event->events & EPOLLOUT) {
-        if (is_pub) {
-            if (rmc_pub_write(&_dstc_pub_ctx, c_ind, &op_res) != 0) 
-                rmc_pub_close_connection(&_dstc_pub_ctx, c_ind);
-        } else {
-            if (rmc_sub_write(&_dstc_sub_ctx, c_ind, &op_res) != 0)
-                rmc_sub_close_connection(&_dstc_sub_ctx, c_ind);
+    memmove(pend->call + offset + new_len, pend->call + offset + old_len, tail_len);
+    memcpy(pend->call + offset + head_len, client->snapshot, client->snapshot_len);
+    call->payload_len = new_len - sizeof(dstc_header_t);
+    *(uint32_t*) (dstc_header_ext(call, DSTC_FLAG_DELTA) + sizeof(uint32_t)) = 0;
+
+    backlog.staged_bytes += new_len;
+    backlog.staged_bytes -= old_len;
+    pend->call_len += new_len;
+    pend->call_len -= old_len;
+    return 0;
+}
+
+// A delta encoded call was dropped before being sent. The staged calls
+// encoded against it, up to the next keyframe, cannot be decoded.
+// The newest of them, whose arguments are still in the snapshot, is
+// turned into a keyframe, and the rest are dropped. If there are no
+// such calls, the next call will be a keyframe.
+static void dstc_delta_fix_dependents(struct client_func_t* client, uint8_t* name, uint32_t seq)
+{
+    uint8_t name_len = strlen(client->func_name);
+    uint32_t keyframe_seq = 0;
+    int pass = 0;
+
+    // The first pass finds the first keyframe staged after the dropped
+    // call. The second one fixes up the calls in between.
+    for(pass = 0; pass < 2; ++pass) {
+        int prio = 0;
+
+        for(prio = 0; prio < DSTC_PRIO_COUNT; ++prio) {
+            pending_call_t** link = &pending[prio].head;
+            pending_call_t* prev = 0;
+
+            while(*link) {
+                pending_call_t* pend = *link;
+                uint32_t offset = 0;
+
+                while(offset < pend->call_len) {
+                    dstc_header_t* staged = (dstc_header_t*) (pend->call + offset);
+                    uint8_t* ext = dstc_header_ext(staged, DSTC_FLAG_DELTA);
+                    uint32_t staged_seq = ext?*(uint32_t*) ext:0;
+                    uint32_t staged_base = ext?*(uint32_t*) (ext + sizeof(uint32_t)):0;
+
+                    if (!ext || staged->name_len != name_len ||
+                        memcmp(dstc_call_name(staged), name, name_len) ||
+                        !dstc_delta_seq_after(staged_seq, seq) ||
+                        (pass && keyframe_seq && !dstc_delta_seq_after(keyframe_seq, staged_seq))) {
+                        offset += sizeof(dstc_header_t) + staged->payload_len;
+                        continue;
+                    }
+
+                    if (!pass) {
+                        if (!staged_base && (!keyframe_seq || dstc_delta_seq_after(keyframe_seq, staged_seq)))
+                            keyframe_seq = staged_seq;
+
+                        offset += sizeof(dstc_header_t) + staged->payload_len;
+                        continue;
+                    }
+
+                    if (staged_seq == client->delta_seq &&
+                        !dstc_pending_make_keyframe(client, prio, link, offset)) {
+                        pend = *link;
+                        staged = (dstc_header_t*) (pend->call + offset);
+                        offset += sizeof(dstc_header_t) + staged->payload_len;
+                        delta_stats.keyframes++;
+                        continue;
+                    }
+
+                    dstc_pending_remove_call(prio, link, prev, offset);
+
+                    // The packet was retired. link now points to the next one.
+                    if (*link != pend)
+                        break;
+                }
+
+                if (*link != pend)
+                    continue;
+
+                prev = pend;
+                link = &pend->next;
+            }
         }
     }
 }
 
-extern void dstc_process_timeout(void)
+// Fix up the calls encoded against the calls recorded by
+// dstc_delta_call_dropped(). Done before staged calls are sent, since
+// calls are dropped while the staging queues are being walked.
+static void dstc_delta_fix_dropped(void)
 {
-    rmc_pub_timeout_process(&_dstc_pub_ctx);
-    rmc_sub_timeout_process(&_dstc_sub_ctx);
+    uint32_t ind = 0;
+
+    for(ind = 0; ind < delta_drop_count; ++ind)
+        dstc_delta_fix_dependents(delta_drops[ind].client,
+                                  (uint8_t*) delta_drops[ind].client->func_name,
+                                  delta_drops[ind].seq);
+
+    delta_drop_count = 0;
 }
 
-static uint32_t dstc_process_function_call(uint8_t* data, uint32_t data_len)
+// A delta encoded call was dropped before being sent. Resync with a
+// keyframe, and have dstc_delta_fix_dropped() deal with the staged
+// calls encoded against it.
+static void dstc_delta_call_dropped(dstc_header_t* call)
 {
-    dstc_header_t* call = (dstc_header_t*) data;
-    void (*local_func_ptr)(rmc_node_id_t node_id, uint8_t*) = 0;
+    struct client_func_t* client = 0;
+    int ind = client_func_ind;
 
-    if (data_len < sizeof(dstc_header_t)) {
-        RMC_LOG_WARNING("Packet header too short! Wanted %ld bytes, got %d",
-                        sizeof(dstc_header_t), data_len);
-        return data_len; // Emtpy buffer
+    while(ind--) {
+        if (strlen(client_func[ind].func_name) == call->name_len &&
+            !memcmp(client_func[ind].func_name, dstc_call_name(call), call->name_len)) {
+            client = &client_func[ind];
+            break;
+        }
     }
 
-    if (data_len - sizeof(dstc_header_t) < call->payload_len) {
-        RMC_LOG_WARNING("Packet payload too short! Wanted %d bytes, got %d",
-                        call->payload_len, data_len - sizeof(dstc_header_t));
-        return data_len; // Emtpy buffer
-    }
+    if (!client)
+        return;
 
-    // Retrieve function pointer from name, as previously
-    // registered with dstc_register_local_function()
-    RMC_LOG_DEBUG("DSTC Serve: node_id[%lu] name_len[%d] name[%.*s] payload_len[%d]",
-                  call->node_id, 
-                  call->name_len,
-                  call->name_len, call->payload, call->payload_len - call->name_len);
-    if (call->name_len)
-        local_func_ptr = dstc_find_local_function(call->payload, call->name_len);
-    else
-        local_func_ptr = dstc_find_callback(*(uint64_t*)call->payload);
-        
+    client->keyframe_due = 1;
 
-    if (!local_func_ptr) {
-        RMC_LOG_COMMENT("Function [%.*s] not loaded. Ignored", call->name_len, call->payload);
-        return sizeof(dstc_header_t) + call->payload_len;
+    if (delta_drop_count == delta_drop_size) {
+        uint32_t size = delta_drop_size?delta_drop_size * 2:16;
+        void* drops = realloc(delta_drops, size * sizeof(*delta_drops));
+
+        // The receiver will skip the calls until the next keyframe.
+        if (!drops)
+            return;
+
+        delta_drops = drops;
+        delta_drop_size = size;
     }
 
-    (*local_func_ptr)(call->node_id, call->payload + (call->name_len?call->name_len:sizeof(uint64_t))); 
-    return sizeof(dstc_header_t) + call->payload_len;
+    delta_drops[delta_drop_count].client = client;
+    delta_drops[delta_drop_count].seq = *(uint32_t*) dstc_header_ext(call, DSTC_FLAG_DELTA);
+    delta_drop_count++;
 }
 
+static uint32_t dstc_put_varint(uint8_t* buf, uint32_t val)
+{
+    uint32_t len = 0;
+
+    while(val >= 0x80) {
+        buf[len++] = (val & 0x7F) | 0x80;
+        val >>= 7;
+    }
+    buf[len++] = val;
+    return len;
+}
 
-static void dstc_subscription_complete(rmc_sub_context_t* sub_ctx,
-                                       uint32_t listen_ip,
-                                       in_port_t listen_port,
-                                       rmc_node_id_t node_id)
+// Returns the number of bytes consumed, or 0 if the varint is truncated.
+static uint32_t dstc_get_varint(uint8_t* buf, uint32_t buf_len, uint32_t* val)
 {
-    int ind = local_func_ind;
-    RMC_LOG_COMMENT("Subscription complete. Sending supported functions.");
+    uint32_t len = 0;
 
-    // Retrieve function pointer from name, as previously
-    // registered with dstc_register_local_function()
-    // Include null terminator for an easier life.
-    while(ind--) {
-        RMC_LOG_COMMENT("  [%s]", local_func[ind].func_name);
-        rmc_sub_write_control_message_by_node_id(sub_ctx, 
-                                                 node_id, 
-                                                 local_func[ind].func_name, 
-                                                 strlen(local_func[ind].func_name) + 1);
-        
+    *val = 0;
+    while(len < buf_len && len < 5) {
+        *val |= (uint32_t) (buf[len] & 0x7F) << (7 * len);
+        if (!(buf[len++] & 0x80))
+            return len;
     }
-    RMC_LOG_COMMENT("Done sending functions");
-    return;
+    return 0;
 }
 
-static void dstc_process_incoming(rmc_sub_context_t* sub_ctx)
+// XOR args with snapshot and run length encode the result as a series
+// of unchanged byte count, changed byte count, and changed bytes XORed
+// with snapshot. Counts are varints. Trailing unchanged bytes are left out.
+// Returns the encoded length, or len if encoding does not save anything.
+static uint32_t dstc_delta_encode(uint8_t* snapshot, uint8_t* args, uint32_t len, uint8_t* out)
 {
-    sub_packet_t* pack = rmc_sub_get_next_dispatch_ready(sub_ctx);
-    RMC_LOG_DEBUG("Processing incoming");
-    while(pack) {
-        uint32_t ind = 0;
+    uint32_t pos = 0;
+    uint32_t out_len = 0;
+
+    while(pos < len) {
+        uint32_t skip_start = pos;
+        uint32_t lit_start = 0;
+        uint32_t lit_end = 0;
+
+        while(pos < len && snapshot[pos] == args[pos])
+            pos++;
+
+        if (pos == len)
+            break;
 
-        RMC_LOG_DEBUG("Got packet. payload_len[%d]", pack->payload_len);
-        while(ind < pack->payload_len) {
-            RMC_LOG_DEBUG("Processing function call. ind[%d]", ind);
-            ind += dstc_process_function_call(((uint8_t*) pack->payload) + ind, pack->payload_len - ind);
+        // A changed run ends at three unchanged bytes in a row, where
+        // starting a new run costs less than carrying them along.
+        lit_start = lit_end = pos;
+        while(pos < len && pos - lit_end < 3) {
+            if (snapshot[pos] != args[pos])
+                lit_end = pos + 1;
+            pos++;
         }
+        pos = lit_end;
+
+        if (out_len + 10 + (lit_end - lit_start) >= len)
+            return len;
 
-        rmc_sub_packet_dispatched(sub_ctx, pack);
-        pack = rmc_sub_get_next_dispatch_ready(sub_ctx);            
+        out_len += dstc_put_varint(out + out_len, lit_start - skip_start);
+        out_len += dstc_put_varint(out + out_len, lit_end - lit_start);
+        while(lit_start < lit_end) {
+            out[out_len++] = snapshot[lit_start] ^ args[lit_start];
+            lit_start++;
+        }
     }
-    return;
+    return out_len;
 }
 
-
-static void dstc_subscriber_control_message_cb(rmc_pub_context_t* ctx,
-                                               uint32_t publisher_address,
-                                               uint16_t publisher_port,
-                                               rmc_node_id_t node_id,
-                                               void* payload,
-                                               payload_len_t payload_len)
+// Apply a delta produced by dstc_delta_encode() to snapshot.
+// Returns 0 on success or EPROTO if the delta is malformed, in which
+// case snapshot is left partially updated.
+static int dstc_delta_apply(uint8_t* snapshot, uint32_t len, uint8_t* delta, uint32_t delta_len)
 {
-    dstc_register_remote_function((char*) payload);
-    return;
-}
+    uint32_t pos = 0;
+    uint32_t ind = 0;
 
+    while(ind < delta_len) {
+        uint32_t skip = 0;
+        uint32_t lit = 0;
+        uint32_t used = 0;
 
-uint32_t dstc_get_socket_count(void)
-{
-    if (!initialized)
-        return 0;
-  
-    // Grab the count of all open sockets.
-    return rmc_sub_get_socket_count(&_dstc_sub_ctx) + 
-        rmc_pub_get_socket_count(&_dstc_pub_ctx);
-}
+        if (!(used = dstc_get_varint(delta + ind, delta_len - ind, &skip)))
+            return EPROTO;
+        ind += used;
 
+        if (!(used = dstc_get_varint(delta + ind, delta_len - ind, &lit)))
+            return EPROTO;
+        ind += used;
 
-static void free_published_packets(void* pl, payload_len_t len, user_data_t dt)
-{
-    RMC_LOG_DEBUG("Freeing %p", pl);
-    free(pl);
-}
+        if (skip > len - pos || lit > len - pos - skip || lit > delta_len - ind)
+            return EPROTO;
 
+        pos += skip;
+        while(lit--)
+            snapshot[pos++] ^= delta[ind++];
+    }
+    return 0;
+}
 
-static int dstc_setup_internal(rmc_pub_context_t* pub_ctx,
-                               rmc_sub_context_t* sub_ctx,
-                               int epoll_fd_arg,
-                               user_data_t user_data)
+// Gather the arguments of a call to a delta encoded function, and
+// make them the snapshot that the next call is encoded against.
+// result is set to the encoded arguments, or to the full arguments
+// for a keyframe. Returns the sequence number that the call is
+// encoded against, or 0 for a keyframe.
+static uint32_t dstc_delta_prepare(struct client_func_t* client,
+                                   struct iovec* arg_iov, int arg_iovcnt, uint32_t arg_sz,
+                                   struct iovec* result)
 {
-    uint8_t* sub_conn_vec_mem = 0;
-    uint8_t* pub_conn_vec_mem = 0;
+    uint32_t base_seq = client->delta_seq;
+    uint32_t len = arg_sz;
+    uint32_t offset = 0;
+    int ind = 0;
 
+    for(ind = 0; ind < arg_iovcnt; ++ind) {
+        memcpy(delta_args + offset, arg_iov[ind].iov_base, arg_iov[ind].iov_len);
+        offset += arg_iov[ind].iov_len;
+    }
 
-    // Already intialized?
-    if (initialized) 
-        return EBUSY;
+    if (!client->keyframe_due &&
+        base_seq &&
+        client->snapshot_len == arg_sz &&
+        client->since_keyframe + 1 < client->keyframe_interval)
+        len = dstc_delta_encode(client->snapshot, delta_args, arg_sz, delta_buf);
 
-    epoll_fd = epoll_fd_arg,
-    rmc_log_set_start_time();
-    pub_conn_vec_mem = malloc(sizeof(rmc_connection_t)*MAX_CONNECTIONS);
-    memset(pub_conn_vec_mem, 0, sizeof(rmc_connection_t)*MAX_CONNECTIONS);
+    if (client->snapshot_len != arg_sz) {
+        client->snapshot = realloc(client->snapshot, arg_sz);
+        client->snapshot_len = arg_sz;
+    }
+    memcpy(client->snapshot, delta_args, arg_sz);
 
-    rmc_pub_init_context(&_dstc_pub_ctx,
-                         0, // Random node_id
+    // Sequence number 0 is reserved for keyframe bases.
+    if (!++client->delta_seq)
+        client->delta_seq = 1;
+
+    delta_stats.arg_bytes += arg_sz;
+
+    if (len >= arg_sz) {
+        client->since_keyframe = 0;
+        client->keyframe_due = 0;
+        delta_stats.keyframes++;
+        delta_stats.encoded_bytes += arg_sz;
+        result->iov_base = client->snapshot;
+        result->iov_len = arg_sz;
+        return 0;
+    }
+
+    client->since_keyframe++;
+    delta_stats.deltas++;
+    delta_stats.encoded_bytes += len;
+    result->iov_base = delta_buf;
+    result->iov_len = len;
+    return base_seq;
+}
+
+// Find the snapshot of the calls made by node_id to a function,
+// creating an empty one if it does not exist.
+static delta_snapshot_t* dstc_get_delta_snapshot(rmc_node_id_t node_id, uint8_t* name, uint8_t name_len)
+{
+    delta_snapshot_t* snap = 0;
+    uint32_t ind = delta_snapshot_count;
+
+    while(ind--) {
+        snap = &delta_snapshots[ind];
+        if (snap->node_id == node_id &&
+            snap->name_len == name_len &&
+            !memcmp(snap->name, name, name_len))
+            return snap;
+    }
+
+    if (delta_snapshot_count == delta_snapshot_size) {
+        delta_snapshot_size = delta_snapshot_size?delta_snapshot_size * 2:16;
+        delta_snapshots = realloc(delta_snapshots, delta_snapshot_size * sizeof(delta_snapshot_t));
+    }
+
+    snap = &delta_snapshots[delta_snapshot_count++];
+    snap->node_id = node_id;
+    snap->name_len = name_len;
+    memcpy(snap->name, name, name_len);
+    snap->seq = 0;
+    snap->len = 0;
+    snap->data = 0;
+    return snap;
+}
+
+// Rebuild the arguments of a delta encoded call into the snapshot kept
+// for its node and function. Returns the rebuilt arguments, or 0 if the
+// call cannot be decoded until the next keyframe.
+static uint8_t* dstc_delta_decode(dstc_header_t* call, uint32_t* result_len)
+{
+    uint8_t* ext = dstc_header_ext(call, DSTC_FLAG_DELTA);
+    uint32_t seq = *(uint32_t*) ext;
+    uint32_t base_seq = *(uint32_t*) (ext + sizeof(uint32_t));
+    uint8_t* args = dstc_call_args(call);
+    uint32_t args_len = call->payload_len - (args - call->payload);
+    delta_snapshot_t* snap = 0;
+
+    // Don't keep snapshots of functions that we do not serve.
+    if (!call->name_len || !dstc_find_local_function((char*) dstc_call_name(call), call->name_len))
+        return 0;
+
+    snap = dstc_get_delta_snapshot(call->node_id, dstc_call_name(call), call->name_len);
+
+    if (!base_seq) {
+        if (snap->len != args_len) {
+            snap->data = realloc(snap->data, args_len);
+            snap->len = args_len;
+        }
+        memcpy(snap->data, args, args_len);
+        snap->seq = seq;
+        *result_len = snap->len;
+        return snap->data;
+    }
+
+    if (!snap->seq || snap->seq != base_seq ||
+        dstc_delta_apply(snap->data, snap->len, args, args_len)) {
+        snap->seq = 0;
+        delta_stats.missed_inbound++;
+        return 0;
+    }
+
+    snap->seq = seq;
+    delta_stats.decoded_inbound++;
+    *result_len = snap->len;
+    return snap->data;
+}
+
+void dstc_set_max_in_flight(uint32_t max_packets)
+{
+    max_in_flight = max_packets;
+}
+
+// A burst of zero allows a single full packet.
+void dstc_set_pacing(uint64_t bytes_per_sec, uint32_t packets_per_sec,
+                     uint32_t burst_bytes, uint32_t burst_packets)
+{
+    pace_bytes_per_sec = bytes_per_sec;
+    pace_packets_per_sec = packets_per_sec;
+    pace_burst_bytes = burst_bytes?burst_bytes:RMC_MAX_PAYLOAD;
+    pace_burst_packets = burst_packets?burst_packets:1;
+
+    // Start out with a full burst.
+    pace_bytes = pace_burst_bytes;
+    pace_packets = pace_burst_packets;
+    pace_refill_ts = dstc_now();
+    pace_wait_ts = -1;
+    pace_wait_start = -1;
+}
+
+void dstc_get_pacing_stats(dstc_pacing_stats_t* stats)
+{
+    *stats = pacing_stats;
+}
+
+static void dstc_pace_refill(usec_timestamp_t now)
+{
+    double elapsed = (now - pace_refill_ts) / 1000000.0;
+
+    pace_refill_ts = now;
+    if (elapsed <= 0)
+        return;
+
+    pace_bytes += elapsed * pace_bytes_per_sec;
+    if (pace_bytes > pace_burst_bytes)
+        pace_bytes = pace_burst_bytes;
+
+    pace_packets += elapsed * pace_packets_per_sec;
+    if (pace_packets > pace_burst_packets)
+        pace_packets = pace_burst_packets;
+}
+
+// Can a packet of len bytes be handed to the transport now? If not,
+// pace_wait_ts is set to when it can, and no other packet is let through
+// until dstc_drain_pending() is called again. A packet larger than
+// the burst only needs a full bucket, and leaves it in debt.
+static int dstc_pace_allows(uint32_t len)
+{
+    double need_bytes = (len < pace_burst_bytes)?len:pace_burst_bytes;
+    usec_timestamp_t now = 0;
+    usec_timestamp_t wait = 0;
+
+    if (!pace_bytes_per_sec && !pace_packets_per_sec)
+        return 1;
+
+    if (pace_wait_ts != -1)
+        return 0;
+
+    now = dstc_now();
+    dstc_pace_refill(now);
+
+    if ((!pace_bytes_per_sec || pace_bytes >= need_bytes) &&
+        (!pace_packets_per_sec || pace_packets >= 1.0))
+        return 1;
+
+    if (pace_bytes_per_sec && pace_bytes < need_bytes)
+        wait = (usec_timestamp_t) ((need_bytes - pace_bytes) * 1000000.0 / pace_bytes_per_sec) + 1;
+
+    if (pace_packets_per_sec && pace_packets < 1.0) {
+        usec_timestamp_t packet_wait = (usec_timestamp_t) ((1.0 - pace_packets) * 1000000.0 / pace_packets_per_sec) + 1;
+
+        if (packet_wait > wait)
+            wait = packet_wait;
+    }
+
+    pace_wait_ts = now + wait;
+    if (pace_wait_start == -1) {
+        pace_wait_start = now;
+        pacing_stats.waits++;
+    }
+    return 0;
+}
+
+// Take the tokens of a packet handed to the transport.
+static void dstc_pace_consume(uint32_t len)
+{
+    usec_timestamp_t wait = 0;
+
+    if (!pace_bytes_per_sec && !pace_packets_per_sec)
+        return;
+
+    dstc_pace_refill(dstc_now());
+    pace_bytes -= len;
+    pace_packets -= 1.0;
+    pacing_stats.sent_packets++;
+    pacing_stats.sent_bytes += len;
+
+    if (pace_wait_start == -1)
+        return;
+
+    wait = dstc_now() - pace_wait_start;
+    pace_wait_start = -1;
+    pacing_stats.wait_usec_total += wait;
+    if (wait > pacing_stats.wait_usec_max)
+        pacing_stats.wait_usec_max = wait;
+}
+
+int dstc_get_priority_stats(uint8_t priority, dstc_priority_stats_t* stats)
+{
+    if (priority >= DSTC_PRIO_COUNT || !stats)
+        return EINVAL;
+
+    *stats = prio_stats[priority];
+    return 0;
+}
+
+void dstc_reset_priority_stats(void)
+{
+    memset(prio_stats, 0, sizeof(prio_stats));
+}
+
+// Have calls to a function carry the time they were made, and the time
+// they were handed to the transport, for the receiver to break down
+// their latency. See dstc_get_latency_stats().
+void dstc_set_client_latency(char* function_name, uint8_t enabled)
+{
+    dstc_get_client_func(function_name)->latency = enabled?1:0;
+}
+
+static latency_node_t* dstc_get_latency_node(rmc_node_id_t node_id)
+{
+    uint32_t ind = 0;
+
+    for(ind = 0; ind < latency_node_count; ++ind)
+        if (latency_nodes[ind].node_id == node_id)
+            return &latency_nodes[ind];
+
+    latency_nodes = realloc(latency_nodes, sizeof(latency_node_t) * ++latency_node_count);
+    latency_nodes[ind].node_id = node_id;
+    latency_nodes[ind].clock_offset = 0;
+    latency_nodes[ind].min_network = -1;
+    latency_nodes[ind].window_min = -1;
+    latency_nodes[ind].window_start = dstc_now();
+    return &latency_nodes[ind];
+}
+
+// Timestamps are taken from the monotonic clock, which is shared by
+// all processes on a host. offset_usec, estimated by the application,
+// converts timestamps of a node on another host to our clock.
+void dstc_set_node_clock_offset(rmc_node_id_t node_id, usec_timestamp_t offset_usec)
+{
+    latency_node_t* node = dstc_get_latency_node(node_id);
+
+    node->clock_offset = offset_usec;
+    node->min_network = -1;
+    node->window_min = -1;
+    node->window_start = dstc_now();
+}
+
+static void dstc_latency_add(dstc_latency_histogram_t* hist, usec_timestamp_t usec)
+{
+    uint32_t bucket = 0;
+
+    // Clock offset estimates are not exact.
+    if (usec < 0)
+        usec = 0;
+
+    while(bucket < DSTC_LATENCY_BUCKETS - 1 && (usec >> bucket))
+        bucket++;
+
+    hist->count++;
+    hist->usec_total += usec;
+    if (usec > hist->usec_max)
+        hist->usec_max = usec;
+
+    hist->buckets[bucket]++;
+}
+
+// Record the latency of a received call carrying DSTC_FLAG_LATENCY,
+// about to be executed. ready_ts is when its packet was received.
+// Only calls to our own server functions are recorded, which bounds
+// the number of functions tracked.
+static void dstc_record_latency(dstc_header_t* call, usec_timestamp_t ready_ts)
+{
+    uint8_t* ext = dstc_header_ext(call, DSTC_FLAG_LATENCY);
+    latency_node_t* node = 0;
+    latency_func_t* func = 0;
+    usec_timestamp_t call_ts = 0;
+    usec_timestamp_t sent_ts = 0;
+    usec_timestamp_t network = 0;
+    usec_timestamp_t now = dstc_now();
+    uint32_t ind = 0;
+
+    if (!call->name_len || !dstc_find_local_function((char*) dstc_call_name(call), call->name_len))
+        return;
+
+    node = dstc_get_latency_node(call->node_id);
+    call_ts = *(usec_timestamp_t*) ext + node->clock_offset;
+    sent_ts = *(usec_timestamp_t*) (ext + sizeof(usec_timestamp_t)) + node->clock_offset;
+    network = ready_ts - sent_ts;
+
+    for(ind = 0; ind < latency_func_count; ++ind) {
+        if (latency_funcs[ind].name_len == call->name_len &&
+            !memcmp(latency_funcs[ind].name, dstc_call_name(call), call->name_len)) {
+            func = &latency_funcs[ind];
+            break;
+        }
+    }
+
+    if (!func) {
+        func = realloc(latency_funcs, sizeof(latency_func_t) * (latency_func_count + 1));
+        if (!func)
+            return;
+
+        latency_funcs = func;
+        func = &latency_funcs[latency_func_count++];
+        memset(func, 0, sizeof(latency_func_t));
+        func->name_len = call->name_len;
+        memcpy(func->name, dstc_call_name(call), call->name_len);
+    }
+
+    // The fastest delivery seen is taken as the transit time. Anything
+    // above it was spent waiting for retransmits or earlier packets.
+    // It is renewed each LATENCY_WINDOW_USEC from the fastest delivery
+    // of the window just ended.
+    if (node->window_min == -1 || network < node->window_min)
+        node->window_min = (network < 0)?0:network;
+
+    if (node->min_network == -1 || network < node->min_network)
+        node->min_network = (network < 0)?0:network;
+
+    if (now - node->window_start >= LATENCY_WINDOW_USEC) {
+        node->min_network = node->window_min;
+        node->window_min = -1;
+        node->window_start = now;
+    }
+
+    dstc_latency_add(&func->stats.queue, sent_ts - call_ts);
+    dstc_latency_add(&func->stats.transit, node->min_network);
+    dstc_latency_add(&func->stats.retransmit, network - node->min_network);
+    dstc_latency_add(&func->stats.dispatch, now - ready_ts);
+    dstc_latency_add(&func->stats.total, now - call_ts);
+}
+
+// Returns ENOENT if no timestamped calls to function_name have been received.
+int dstc_get_latency_stats(char* function_name, dstc_latency_stats_t* stats)
+{
+    uint32_t name_len = strlen(function_name);
+    uint32_t ind = 0;
+
+    for(ind = 0; ind < latency_func_count; ++ind) {
+        if (latency_funcs[ind].name_len == name_len &&
+            !memcmp(latency_funcs[ind].name, function_name, name_len)) {
+            *stats = latency_funcs[ind].stats;
+            return 0;
+        }
+    }
+    return ENOENT;
+}
+
+void dstc_reset_latency_stats(void)
+{
+    uint32_t ind = 0;
+
+    for(ind = 0; ind < latency_func_count; ++ind)
+        memset(&latency_funcs[ind].stats, 0, sizeof(dstc_latency_stats_t));
+}
+
+static struct remote_func_t* dstc_find_remote_func(char* func_name)
+{
+    int ind = remote_func_ind;
+
+    while(ind--) {
+        if (!strcmp(func_name, remote_func[ind].func_name))
+            return &remote_func[ind];
+    }
+    return 0;
+}
+
+// Register a remote function as provided by the remote DSTC server
+// through a control message call processed by
+// dstc_transport_control_message()
+//
+void dstc_register_remote_function(char* name)
+{
+    struct remote_func_t* remote = dstc_find_remote_func(name);
+
+    // Is this an additional registration of an existing function.
+    if (remote) {
+        remote->count++;
+        RMC_LOG_INFO("Remote function [%s] now supported by %d nodes", remote->func_name, remote->count);
+        if (!remote->notify++)
+            remote_notify_count++;
+        return;
+    }
+    
+    // Are we out of memory
+    if (remote_func_ind == SYMTAB_SIZE) {
+        RMC_LOG_FATAL("Out of memory trying to register remote func. SYMTAB_SIZE=%d\n", SYMTAB_SIZE);
+        exit(255);
+    }
+
+    remote = &remote_func[remote_func_ind];
+    ++remote_func_ind;
+
+    strncpy(remote->func_name, (uint8_t*) name, sizeof(remote->func_name));
+    remote->func_name[sizeof(remote->func_name)-1] = 0;
+    remote->count = 1;
+    remote->notify = 1;
+    remote_notify_count++;
+    RMC_LOG_INFO("Remote [%s] now supported by one (first) node", remote->func_name, remote->count);
+}
+
+// Record the node serving a remote function registered by
+// dstc_register_remote_function(), for the collective calls made to it.
+static void dstc_register_remote_server(char* name, rmc_node_id_t node_id)
+{
+    struct remote_func_t* remote = dstc_find_remote_func(name);
+    rmc_node_id_t* nodes = 0;
+    uint32_t ind = 0;
+
+    for(ind = 0; ind < remote->node_count; ++ind)
+        if (remote->nodes[ind] == node_id)
+            return;
+
+    nodes = (rmc_node_id_t*) realloc(remote->nodes, sizeof(rmc_node_id_t) * (remote->node_count + 1));
+    if (!nodes) {
+        RMC_LOG_WARNING("Could not record node %u as server of [%s]: %s",
+                        node_id, name, strerror(errno));
+        return;
+    }
+
+    remote->nodes = nodes;
+    remote->nodes[remote->node_count++] = node_id;
+}
+
+void dstc_set_remote_function_callback(void (*callback)(char* function_name,
+                                                        uint32_t remote_count))
+{
+    remote_func_cb = callback;
+}
+
+static void dstc_flush_parked(struct client_func_t* client);
+
+// Report newly registered remote functions to the callback installed by
+// dstc_set_remote_function_callback(). Done from the event loop, once
+// the transport is done processing, so that the callback can make calls.
+static void dstc_notify_remote_functions(void)
+{
+    struct client_func_t* client = 0;
+    int ind = 0;
+
+    if (!remote_notify_count)
+        return;
+
+    remote_notify_count = 0;
+    for(ind = 0; ind < remote_func_ind; ++ind) {
+        if (!remote_func[ind].notify)
+            continue;
+
+        remote_func[ind].notify = 0;
+
+        // Calls parked while the function had no server go out
+        // ahead of any calls made by the callback.
+        client = dstc_find_client_func(remote_func[ind].func_name);
+        if (client && client->parked_head)
+            dstc_flush_parked(client);
+
+        if (remote_func_cb)
+            (*remote_func_cb)(remote_func[ind].func_name, remote_func[ind].count);
+    }
+}
+
+
+
+
+// Select how the RMC transport registers its sockets with epoll.
+// DSTC_EPOLL_LEVEL registers the read and write interest changes made
+// by RMC once per event loop iteration, skipping those that cancel out.
+// DSTC_EPOLL_EDGE registers each socket once, for both reading and
+// writing, and reads until EAGAIN when the socket becomes readable.
+int dstc_set_epoll_mode(uint8_t mode)
+{
+    if (mode > DSTC_EPOLL_IMMEDIATE)
+        return EINVAL;
+
+    if (initialized)
+        return EBUSY;
+
+    epoll_mode = mode;
+    return 0;
+}
+
+void dstc_get_epoll_stats(dstc_epoll_stats_t* stats)
+{
+    *stats = epoll_stats;
+}
+
+static uint32_t poll_events(rmc_poll_action_t action)
+{
+    uint32_t events = 0;
+
+    if (epoll_mode == DSTC_EPOLL_EDGE)
+        return EPOLLIN | EPOLLOUT | EPOLLET;
+
+    if (action & RMC_POLLREAD)
+        events |= EPOLLIN;
+
+    if (action & RMC_POLLWRITE)
+        events |= EPOLLOUT;
+
+    return events;
+}
+
+static poll_interest_t* poll_find(int descriptor)
+{
+    uint32_t ind = 0;
+
+    for(ind = 0; ind < poll_interest_count; ++ind)
+        if (poll_interest[ind].descriptor == descriptor)
+            return &poll_interest[ind];
+
+    return 0;
+}
+
+static int poll_register(poll_interest_t* pi, int op)
+{
+    struct epoll_event ev = {
+        .data.u32 = pi->event_user_data,
+        .events = poll_events(pi->wanted)
+    };
+
+    epoll_stats.ctls++;
+    if (epoll_ctl(epoll_fd, op, pi->descriptor, &ev) == -1)
+        return errno;
+
+    pi->registered = ev.events;
+    return 0;
+}
+
+static void poll_add(user_data_t user_data,
+                     int descriptor,
+                     uint32_t event_user_data,
+                     rmc_poll_action_t action)
+{
+    poll_interest_t* pi = poll_find(-1);
+
+    if (!pi) {
+        poll_interest = realloc(poll_interest, sizeof(poll_interest_t) * ++poll_interest_count);
+        pi = &poll_interest[poll_interest_count - 1];
+    }
+
+    pi->descriptor = descriptor;
+    pi->event_user_data = event_user_data;
+    pi->wanted = action;
+    pi->readable = 0;
+    pi->writable = 0;
+
+    if (poll_register(pi, EPOLL_CTL_ADD)) {
+        RMC_LOG_INDEX_FATAL(event_user_data & USER_DATA_INDEX_MASK, "epoll_ctl(add)");
+        exit(255);
+    }
+}
+
+
+static void poll_add_sub(user_data_t user_data,
+                         int descriptor,
+                         rmc_index_t index,
+                         rmc_poll_action_t action)
+{
+    poll_add(user_data, descriptor, (uint32_t) index, action);
+}
+
+static void poll_add_pub(user_data_t user_data,
+                         int descriptor,
+                         rmc_index_t index,
+                         rmc_poll_action_t action)
+{
+    poll_add(user_data, descriptor, ((uint32_t) index) | USER_DATA_PUB_FLAG, action);
+}
+
+
+
+// Record a change of interest. Only DSTC_EPOLL_IMMEDIATE registers
+// it right away. Batched changes are registered by poll_flush().
+static void poll_modify(user_data_t user_data,
+                        int descriptor,
+                        uint32_t event_user_data,
+                        rmc_poll_action_t old_action,
+                        rmc_poll_action_t new_action)
+{
+    poll_interest_t* pi = poll_find(descriptor);
+    int res = 0;
+
+    if (old_action == new_action || !pi)
+        return ;
+
+    epoll_stats.interest_changes++;
+    pi->wanted = new_action;
+
+    if (epoll_mode == DSTC_EPOLL_LEVEL)
+        poll_dirty = 1;
+
+    if (epoll_mode != DSTC_EPOLL_IMMEDIATE)
+        return;
+
+    if ((res = poll_register(pi, EPOLL_CTL_MOD))) {
+        RMC_LOG_INDEX_FATAL(event_user_data & USER_DATA_INDEX_MASK, "epoll_ctl(modify): %s", strerror(res));
+        exit(255);
+    }
+}
+
+// Register the interest changes batched since the last event
+// loop iteration. Changes that cancelled out cost nothing.
+static void poll_flush(void)
+{
+    uint32_t ind = 0;
+    int res = 0;
+
+    if (!poll_dirty)
+        return;
+
+    poll_dirty = 0;
+    for(ind = 0; ind < poll_interest_count; ++ind) {
+        poll_interest_t* pi = &poll_interest[ind];
+
+        if (pi->descriptor == -1 || poll_events(pi->wanted) == pi->registered)
+            continue;
+
+        if ((res = poll_register(pi, EPOLL_CTL_MOD))) {
+            RMC_LOG_INDEX_FATAL(pi->event_user_data & USER_DATA_INDEX_MASK,
+                                "epoll_ctl(modify): %s", strerror(res));
+            exit(255);
+        }
+    }
+}
+
+static void poll_modify_pub(user_data_t user_data,
+                            int descriptor,
+                            rmc_index_t index,
+                            rmc_poll_action_t old_action,
+                            rmc_poll_action_t new_action)
+{
+    poll_modify(user_data,
+                descriptor,
+                ((uint32_t) index) | USER_DATA_PUB_FLAG,
+                old_action,
+                new_action);
+}
+
+static void poll_modify_sub(user_data_t user_data,
+                            int descriptor,
+                            rmc_index_t index,
+                            rmc_poll_action_t old_action,
+                            rmc_poll_action_t new_action)
+{
+    poll_modify(user_data,
+                descriptor,
+                (uint32_t) index,
+                old_action,
+                new_action);
+}
+
+
+static void poll_remove(user_data_t user_data,
+                        int descriptor,
+                        rmc_index_t index)
+{
+    poll_interest_t* pi = poll_find(descriptor);
+
+    if (pi)
+        pi->descriptor = -1;
+
+    epoll_stats.ctls++;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, descriptor, 0) == -1) {
+        RMC_LOG_INDEX_WARNING(index, "epoll_ctl(delete): %s", strerror(errno));
+        return;
+    }
+    RMC_LOG_INDEX_COMMENT(index, "poll_remove()");
+}
+
+
+// Return the earliest of two timeout timestamps, where -1 is no timeout.
+static usec_timestamp_t dstc_earliest_timeout(usec_timestamp_t a, usec_timestamp_t b)
+{
+    if (a == -1)
+        return b;
+
+    if (b == -1)
+        return a;
+
+    return (a < b)?a:b;
+}
+
+static usec_timestamp_t dstc_timer_timeout(void);
+static usec_timestamp_t dstc_gather_timeout(void);
+
+usec_timestamp_t dstc_get_timeout_timestamp()
+{
+    // Figure out the shortest event timeout between the transport
+    // and our own timers.
+    // pace_wait_ts is when a call held back by pacing can be sent.
+    return dstc_earliest_timeout(dstc_earliest_timeout(transport->get_next_timeout(), pace_wait_ts),
+                                 dstc_earliest_timeout(dstc_earliest_timeout(announce_backoff_ts,
+                                                                             dstc_timer_timeout()),
+                                                       dstc_gather_timeout()));
+}
+
+// Start announcing at the burst interval. After burst_count announces,
+// the interval is doubled at each announce until it reaches the steady
+// state interval.
+static void dstc_restart_announce_schedule(void)
+{
+    announce_interval = announce_burst_interval;
+    transport->set_announce_interval(announce_interval);
+
+    announce_backoff_ts = (announce_interval < announce_steady_interval)?
+        (dstc_now() + announce_interval * announce_burst_count):-1;
+}
+
+static void dstc_process_announce_schedule(void)
+{
+    if (announce_backoff_ts == -1 || dstc_now() < announce_backoff_ts)
+        return;
+
+    announce_interval *= 2;
+    if (announce_interval >= announce_steady_interval)
+        announce_interval = announce_steady_interval;
+
+    RMC_LOG_DEBUG("Announce interval now %ld usec", announce_interval);
+    transport->set_announce_interval(announce_interval);
+
+    announce_backoff_ts = (announce_interval < announce_steady_interval)?
+        (dstc_now() + announce_interval):-1;
+}
+
+void dstc_set_announce_schedule(usec_timestamp_t burst_interval,
+                                uint32_t burst_count,
+                                usec_timestamp_t steady_interval)
+{
+    announce_burst_interval = burst_interval;
+    announce_burst_count = burst_count;
+    announce_steady_interval = (steady_interval > burst_interval)?steady_interval:burst_interval;
+
+    if (initialized)
+        dstc_restart_announce_schedule();
+}
+
+
+int dstc_get_timeout_msec(void)
+{
+    usec_timestamp_t tout = dstc_get_timeout_timestamp();
+
+    if (tout == -1)
+        return -1;
+
+    // Convert to relative timestamp.
+    tout -= dstc_now();
+    if (tout < 0)
+        return 0;
+    
+    // Round up, so that we never wake up ahead of the timeout.
+    return (tout + 999) / 1000;
+}
+
+
+static void dstc_process_deferred(void);
+
+int dstc_process_single_event(int timeout)
+{
+    // Timeout
+    if (transport->process_events(timeout) == ETIME)
+        return ETIME;
+
+    dstc_process_deferred();
+    return 0;
+}
+
+int dstc_process_events(usec_timestamp_t timeout_arg)
+{
+    usec_timestamp_t timeout_ts = 0;
+    usec_timestamp_t now = 0;
+    
+    if (!initialized)
+        dstc_setup();
+
+    // Calculate an absolute timeout timestamp based on relative
+    // timestamp provided in argument.
+    
+    timeout_ts = (timeout_arg == -1)?-1:(dstc_now() + timeout_arg);
+
+    // Process evdents until we reach the timeout therhold.
+    while((now = dstc_now()) < timeout_ts || timeout_ts == -1) {
+        usec_timestamp_t timeout = 0;
+        char is_arg_timeout = 0;
+        usec_timestamp_t event_tout_ts = 0;
+
+        event_tout_ts = dstc_get_timeout_timestamp();
+
+        // Figure out the shortest timeout between argument and event timeout
+        if (timeout_ts == -1 && event_tout_ts == -1) {
+            RMC_LOG_DEBUG("Both argument and event timeout are -1 -> -1");
+            timeout = -1;
+        }
+
+        if (timeout_ts == -1 && event_tout_ts != -1) {
+            timeout = (event_tout_ts - now + 999) / 1000;
+            RMC_LOG_DEBUG("arg timeout == -1. Event timeout != -1 -> %ld", timeout);
+        }
+
+        if (timeout_ts != -1 && event_tout_ts == -1) {
+            timeout = (timeout_ts - now) / 1000 + 1 ;
+            RMC_LOG_DEBUG("arg timeout != -1. Event timeout == -1 -> %ld", timeout);
+        }
+
+        if (timeout_ts != -1 && event_tout_ts != -1) {
+            if (event_tout_ts < timeout_ts) {
+                timeout = (event_tout_ts - now + 999) / 1000;
+                
+                is_arg_timeout = 0;
+            } else {
+                timeout = (timeout_ts - now) / 1000 + 1;
+                is_arg_timeout = 1;
+            }
+                
+            if (event_tout_ts < timeout_ts) {
+                RMC_LOG_DEBUG("event timeout is less than arg timeout -> %ld", timeout);
+            }
+            else {
+                RMC_LOG_DEBUG("arg timeout is less than event timeout -> %ld", timeout);
+            }
+        }
+
+        // A timeout that has already passed must not block forever.
+        if ((timeout_ts != -1 || event_tout_ts != -1) && timeout < 0)
+            timeout = 0;
+
+        if (dstc_process_single_event((int) timeout) == ETIME) {
+            // Did we time out on an RMC event to be processed, or did
+            // we time out on the argument provided to
+            // dstc_process_events()?
+            if (is_arg_timeout) {
+                RMC_LOG_DEBUG("Timed out on argument. returning" );
+                return ETIME;
+            }
+
+            // Make rmc calls to handle scheduled events.
+            dstc_process_timeout();
+            continue;
+        }
+    }
+
+    return 0;
+}
+
+static void dstc_drain_pending(void);
+static void dstc_check_queue_watermark(void);
+static void dstc_notify_remote_functions(void);
+static void dstc_notify_completions(void);
+static void dstc_process_timers(void);
+static void dstc_process_gathers(void);
+static void dstc_replay_caches(void);
+static void dstc_rmc_process_event(struct epoll_event* event);
+static void dstc_local_process_event(struct epoll_event* event);
+static void dstc_local_setup(rmc_node_id_t node_id);
+static uint32_t dstc_local_socket_count(void);
+
+// Work deferred until the transport is done processing events.
+static void dstc_process_deferred(void)
+{
+    // Don't let a busy socket hold back scheduled calls.
+    dstc_process_timers();
+
+    // Bring newly subscribed nodes up to date before new calls reach them.
+    dstc_replay_caches();
+
+    // Acknowledged packets may have opened up the in flight window.
+    dstc_drain_pending();
+    dstc_check_queue_watermark();
+    dstc_notify_remote_functions();
+    dstc_notify_completions();
+    dstc_process_gathers();
+}
+
+// Process an event of the RMC transport reported by an
+// external epoll loop. See dstc_setup_epoll()
+extern void dstc_process_epoll_result(struct epoll_event* event)
+{
+    dstc_rmc_process_event(event);
+    dstc_process_deferred();
+}
+
+extern void dstc_process_timeout(void)
+{
+    transport->process_timeout();
+    dstc_process_announce_schedule();
+    dstc_process_timers();
+    dstc_replay_caches();
+    dstc_drain_pending();
+    dstc_check_queue_watermark();
+    dstc_notify_completions();
+    dstc_process_gathers();
+}
+
+// Reference counted inbound payload. This allows us to hold on to
+// calls after the transport has handed over the packet.
+void* dstc_transport_alloc_payload(payload_len_t len)
+{
+    inbound_payload_t* pl = 0;
+
+    if (posix_memalign((void**) &pl, DSTC_ARRAY_ALIGN, sizeof(inbound_payload_t) + len))
+        return 0;
+
+    pl->ref_count = 1;
+    return pl->data;
+}
+
+void dstc_transport_retain_payload(void* data)
+{
+    ((inbound_payload_t*) ((uint8_t*) data - offsetof(inbound_payload_t, data)))->ref_count++;
+}
+
+void dstc_transport_release_payload(void* data)
+{
+    inbound_payload_t* pl = (inbound_payload_t*) ((uint8_t*) data - offsetof(inbound_payload_t, data));
+
+    if (--pl->ref_count)
+        return;
+
+    free(pl);
+}
+
+// Write queued data to an RMC socket. A full socket (EAGAIN) is left
+// for the next write event. Any other error closes the connection.
+// Returns 0 or the error.
+static int dstc_rmc_write(int is_pub, rmc_index_t c_ind)
+{
+    uint8_t op_res = 0;
+    int res = 0;
+
+    if (is_pub)
+        res = rmc_pub_write(&_dstc_pub_ctx, c_ind, &op_res);
+    else
+        res = rmc_sub_write(&_dstc_sub_ctx, c_ind, &op_res);
+
+    if (!res || res == EAGAIN || res == EWOULDBLOCK)
+        return res;
+
+    RMC_LOG_INDEX_WARNING(c_ind, "%s write: %s. Closing connection",
+                          (is_pub?"pub":"sub"), strerror(res));
+    if (is_pub)
+        rmc_pub_close_connection(&_dstc_pub_ctx, c_ind);
+    else
+        rmc_sub_close_connection(&_dstc_sub_ctx, c_ind);
+
+    return res;
+}
+
+// Does an edge triggered socket have reading or writing left to do?
+static int poll_edge_ready(poll_interest_t* pi)
+{
+    return pi->descriptor != -1 &&
+        (pi->readable || (pi->writable && (pi->wanted & RMC_POLLWRITE)));
+}
+
+// Read an edge triggered socket until EAGAIN, and write while RMC
+// has data to send, up to EPOLL_EDGE_BUDGET operations each.
+// RMC may add and remove sockets meanwhile, which can move or reuse
+// the entry, so it is looked up again after each operation.
+static void dstc_rmc_service_edge(uint32_t ind)
+{
+    poll_interest_t* pi = &poll_interest[ind];
+    int descriptor = pi->descriptor;
+    rmc_index_t c_ind = (rmc_index_t) pi->event_user_data & USER_DATA_INDEX_MASK;
+    int is_pub = (pi->event_user_data & USER_DATA_PUB_FLAG)?1:0;
+    uint32_t budget = EPOLL_EDGE_BUDGET;
+    uint8_t op_res = 0;
+    int res = 0;
+
+    while(pi->descriptor == descriptor && pi->readable && budget--) {
+        if (is_pub)
+            res = rmc_pub_read(&_dstc_pub_ctx, c_ind, &op_res);
+        else
+            res = rmc_sub_read(&_dstc_sub_ctx, c_ind, &op_res);
+
+        // Drained (EAGAIN), failed, or disconnected.
+        pi = &poll_interest[ind];
+        epoll_stats.edge_reads++;
+        if ((res || op_res == RMC_READ_DISCONNECT || op_res == RMC_ERROR) &&
+            pi->descriptor == descriptor)
+            pi->readable = 0;
+    }
+
+    budget = EPOLL_EDGE_BUDGET;
+    while(pi->descriptor == descriptor && pi->writable &&
+          (pi->wanted & RMC_POLLWRITE) && budget--) {
+        res = dstc_rmc_write(is_pub, c_ind);
+
+        // Wait for the next edge once the socket is full.
+        pi = &poll_interest[ind];
+        if (res && pi->descriptor == descriptor)
+            pi->writable = 0;
+    }
+}
+
+static void dstc_rmc_service_edges(void)
+{
+    uint32_t ind = 0;
+
+    for(ind = 0; ind < poll_interest_count; ++ind)
+        if (poll_edge_ready(&poll_interest[ind]))
+            dstc_rmc_service_edge(ind);
+}
+
+// Process the RMC socket of an epoll event.
+static void dstc_rmc_process_event(struct epoll_event* event)
+{
+    int res = 0;
+    uint8_t op_res = 0;
+    rmc_index_t c_ind = (rmc_index_t) event->data.u32 & USER_DATA_INDEX_MASK;
+    int is_pub = (event->data.u32 & USER_DATA_PUB_FLAG)?1:0;
+
+    // Local sockets are level triggered in all epoll modes.
+    if (event->data.u32 & USER_DATA_LOCAL_FLAG) {
+        dstc_local_process_event(event);
+        return;
+    }
+
+    // An edge is reported once, and is serviced until drained.
+    if (epoll_mode == DSTC_EPOLL_EDGE) {
+        uint32_t ind = 0;
+
+        for(ind = 0; ind < poll_interest_count; ++ind) {
+            poll_interest_t* pi = &poll_interest[ind];
+
+            if (pi->descriptor == -1 || pi->event_user_data != event->data.u32)
+                continue;
+
+            pi->readable |= (event->events & (EPOLLIN | EPOLLHUP | EPOLLERR))?1:0;
+            pi->writable |= (event->events & EPOLLOUT)?1:0;
+            dstc_rmc_service_edge(ind);
+            return;
+        }
+        return;
+    }
+
+    RMC_LOG_INDEX_DEBUG(c_ind, "%s: %s%s%s",
+                        (is_pub?"pub":"sub"),
+                        ((event->events & EPOLLIN)?" read":""),
+                        ((event->events & EPOLLOUT)?" write":""),
+                        ((event->events & EPOLLHUP)?" disconnect":""));
+
+
+    if (event->events & EPOLLIN) {
+        if (is_pub)
+            res = rmc_pub_read(&_dstc_pub_ctx, c_ind, &op_res);
+        else
+            res = rmc_sub_read(&_dstc_sub_ctx, c_ind, &op_res);
+
+        RMC_LOG_INDEX_DEBUG(c_ind, "read result: %s - %s", _op_res_string(op_res),   strerror(res));
+    }
+
+    if (event->events & EPOLLOUT)
+        dstc_rmc_write(is_pub, c_ind);
+}
+
+static int dstc_rmc_process_events(int timeout)
+{
+    int nfds = 0;
+    struct epoll_event events[dstc_get_socket_count()];
+
+    poll_flush();
+    epoll_stats.waits++;
+    nfds = epoll_wait(epoll_fd, events, sizeof(events) / sizeof(events[0]), timeout);
+
+    if (nfds == -1) {
+        RMC_LOG_FATAL("epoll_wait(): %s", strerror(errno));
+        exit(255);
+    }
+
+    // Timeout
+    if (nfds == 0) 
+        return ETIME;
+
+    // Process all pending events.
+    while(nfds--) 
+        dstc_rmc_process_event(&events[nfds]);
+
+    return 0;
+}
+
+// Called ahead of each wait for events, by our own event loop as well
+// as by an external one, which makes it the place to register batched
+// interest changes. Edge triggered sockets with work left are due now.
+static usec_timestamp_t dstc_rmc_get_next_timeout(void)
+{
+    usec_timestamp_t sub_event_tout_ts = 0;
+    usec_timestamp_t pub_event_tout_ts = 0;
+    uint32_t ind = 0;
+
+    poll_flush();
+    for(ind = 0; epoll_mode == DSTC_EPOLL_EDGE && ind < poll_interest_count; ++ind)
+        if (poll_edge_ready(&poll_interest[ind]))
+            return rmc_usec_monotonic_timestamp();
+
+    rmc_pub_timeout_get_next(&_dstc_pub_ctx, &pub_event_tout_ts);
+    rmc_sub_timeout_get_next(&_dstc_sub_ctx, &sub_event_tout_ts);
+
+    // Figure out the shortest event timeout between pub and sub context
+    return dstc_earliest_timeout(pub_event_tout_ts, sub_event_tout_ts);
+}
+
+static void dstc_rmc_process_timeout(void)
+{
+    rmc_pub_timeout_process(&_dstc_pub_ctx);
+    rmc_sub_timeout_process(&_dstc_sub_ctx);
+
+    if (epoll_mode == DSTC_EPOLL_EDGE)
+        dstc_rmc_service_edges();
+}
+
+static uint32_t dstc_rmc_get_socket_count(void)
+{
+    // Grab the count of all open sockets.
+    return rmc_sub_get_socket_count(&_dstc_sub_ctx) + 
+        rmc_pub_get_socket_count(&_dstc_pub_ctx) +
+        dstc_local_socket_count();
+}
+
+static rmc_node_id_t dstc_rmc_node_id(void)
+{
+    return rmc_pub_node_id(&_dstc_pub_ctx);
+}
+
+static int dstc_rmc_queue_packet(void* payload, payload_len_t payload_len)
+{
+    return rmc_pub_queue_packet(&_dstc_pub_ctx, payload, payload_len, 0);
+}
+
+static int dstc_rmc_write_control_message(rmc_node_id_t node_id,
+                                          void* payload,
+                                          payload_len_t payload_len)
+{
+    return rmc_sub_write_control_message_by_node_id(&_dstc_sub_ctx, node_id, payload, payload_len);
+}
+
+static void dstc_rmc_set_announce_interval(usec_timestamp_t interval)
+{
+    rmc_pub_set_announce_interval(&_dstc_pub_ctx, interval);
+}
+
+static void* dstc_rmc_next_packet(payload_len_t* payload_len)
+{
+    sub_packet_t* pack = rmc_sub_get_next_dispatch_ready(&_dstc_sub_ctx);
+    void* payload = 0;
+
+    if (!pack)
+        return 0;
+
+    payload = pack->payload;
+    *payload_len = pack->payload_len;
+
+    // RMC releases its own reference through free_inbound_payload()
+    // once the packet is dispatched.
+    dstc_transport_retain_payload(payload);
+    rmc_sub_packet_dispatched(&_dstc_sub_ctx, pack);
+    return payload;
+}
+
+static void* alloc_inbound_payload(payload_len_t len, user_data_t dt)
+{
+    return dstc_transport_alloc_payload(len);
+}
+
+static void free_inbound_payload(void* data, payload_len_t len, user_data_t dt)
+{
+    dstc_transport_release_payload(data);
+}
+
+static void free_published_packets(void* pl, payload_len_t len, user_data_t dt)
+{
+    dstc_transport_packet_delivered(pl);
+}
+
+static void dstc_rmc_packet_ready(rmc_sub_context_t* sub_ctx)
+{
+    dstc_transport_packets_ready();
+}
+
+static void dstc_rmc_subscription_complete(rmc_sub_context_t* sub_ctx,
+                                           uint32_t listen_ip,
+                                           in_port_t listen_port,
+                                           rmc_node_id_t node_id)
+{
+    dstc_transport_node_subscribed(node_id);
+}
+
+static void dstc_rmc_control_message(rmc_pub_context_t* ctx,
+                                     uint32_t publisher_address,
+                                     uint16_t publisher_port,
+                                     rmc_node_id_t node_id,
+                                     void* payload,
+                                     payload_len_t payload_len)
+{
+    dstc_transport_control_message(node_id, payload, payload_len);
+}
+
+static int dstc_rmc_setup(int epoll_fd_arg)
+{
+    uint8_t* sub_conn_vec_mem = 0;
+    uint8_t* pub_conn_vec_mem = 0;
+
+    epoll_fd = epoll_fd_arg,
+    rmc_log_set_start_time();
+    pub_conn_vec_mem = malloc(sizeof(rmc_connection_t)*MAX_CONNECTIONS);
+    memset(pub_conn_vec_mem, 0, sizeof(rmc_connection_t)*MAX_CONNECTIONS);
+
+    rmc_pub_init_context(&_dstc_pub_ctx,
+                         0, // Random node_id
                          MCAST_GROUP_ADDRESS, MCAST_GROUP_PORT, 
                          "0.0.0.0", // Bind to any address for tcp control listen
                          0, // Use ephereal tcp port for tcp control
-                         user_data,
+                         // user_data to be provided to poll_add, poll_modify, and poll_remove
+                         user_data_nil(),
                          poll_add_pub, poll_modify_pub, poll_remove,
                          pub_conn_vec_mem, MAX_CONNECTIONS,
                          free_published_packets);
 
 
-    // Setup a subscriber callback, allowing us to know when a subscribe that can
-    // execute the function has attached.
-    rmc_pub_set_control_message_callback(&_dstc_pub_ctx, dstc_subscriber_control_message_cb);
+    // Setup a subscriber callback, allowing us to know when a subscribe that can
+    // execute the function has attached.
+    rmc_pub_set_control_message_callback(&_dstc_pub_ctx, dstc_rmc_control_message);
+
+    // Subscriber init.
+
+    sub_conn_vec_mem = malloc(sizeof(rmc_connection_t)*MAX_CONNECTIONS);
+    memset(sub_conn_vec_mem, 0, sizeof(rmc_connection_t)*MAX_CONNECTIONS);
+
+    rmc_sub_init_context(&_dstc_sub_ctx,
+                         // Reuse pub node id to detect and avoid loopback messages
+                         rmc_pub_node_id(&_dstc_pub_ctx), 
+                         MCAST_GROUP_ADDRESS,
+                         "0.0.0.0", // Any interface for multicast address
+                         MCAST_GROUP_PORT,  
+                         user_data_nil(),
+                         poll_add_sub, poll_modify_sub, poll_remove,
+                         sub_conn_vec_mem, MAX_CONNECTIONS,
+                         alloc_inbound_payload, free_inbound_payload);
+    
+    rmc_sub_set_packet_ready_callback(&_dstc_sub_ctx, dstc_rmc_packet_ready);
+    rmc_sub_set_subscription_complete_callback(&_dstc_sub_ctx, dstc_rmc_subscription_complete);
+
+    rmc_pub_activate_context(&_dstc_pub_ctx);
+    rmc_sub_activate_context(&_dstc_sub_ctx);
+
+    // Nodes on this host hand large calls over through a local socket.
+    dstc_local_setup(rmc_pub_node_id(&_dstc_pub_ctx));
+    return 0;
+}
+
+// Reliable multicast over UDP, the default transport.
+static const dstc_transport_t rmc_transport = {
+    .setup = dstc_rmc_setup,
+    .node_id = dstc_rmc_node_id,
+    .now = rmc_usec_monotonic_timestamp,
+    .process_events = dstc_rmc_process_events,
+    .get_next_timeout = dstc_rmc_get_next_timeout,
+    .process_timeout = dstc_rmc_process_timeout,
+    .get_socket_count = dstc_rmc_get_socket_count,
+    .queue_packet = dstc_rmc_queue_packet,
+    .write_control_message = dstc_rmc_write_control_message,
+    .set_announce_interval = dstc_rmc_set_announce_interval,
+    .next_packet = dstc_rmc_next_packet,
+};
+
+// Register a collective call, started by the next queued call.
+// Returns the id to pass to the servers as their callback address,
+// or 0 if out of memory, in which case replies are ignored.
+uint64_t dstc_register_gather(void (*reduce)(void* user_data, rmc_node_id_t node_id, uint8_t* reply),
+                              void (*complete)(void* user_data, dstc_gather_result_t* result),
+                              void* user_data,
+                              usec_timestamp_t timeout_usec)
+{
+    dstc_gather_t* gather = (dstc_gather_t*) calloc(1, sizeof(dstc_gather_t));
+
+    if (!gather) {
+        RMC_LOG_WARNING("Could not allocate collective call: %s", strerror(errno));
+        return 0;
+    }
+
+    if (!initialized)
+        dstc_setup();
+
+    gather->id = GATHER_ID_FLAG | ((uint64_t) dstc_get_node_id() << 30) |
+        (gather_next_id++ & CALLBACK_ID_MASK);
+    gather->reduce = reduce;
+    gather->complete = complete;
+    gather->user_data = user_data;
+    gather->deadline_ts = dstc_now() +
+        (timeout_usec?timeout_usec:DSTC_GATHER_TIMEOUT_USEC);
+    gather->next = gathers;
+    gathers = gather;
+    next_call_gather = gather;
+    gather_stats.started++;
+    return gather->id;
+}
+
+void dstc_get_gather_stats(dstc_gather_stats_t* stats)
+{
+    *stats = gather_stats;
+}
+
+static dstc_gather_t* dstc_find_gather(uint64_t id)
+{
+    dstc_gather_t* gather = gathers;
+
+    while(gather && gather->id != id)
+        gather = gather->next;
+
+    return gather;
+}
+
+// Record the current servers of the function as those replies are
+// expected from.
+static void dstc_expect_servers(dstc_gather_t* gather)
+{
+    struct remote_func_t* remote = dstc_find_remote_func(gather->name);
+
+    if (!remote || !remote->node_count)
+        return;
+
+    gather->servers = (rmc_node_id_t*) malloc(sizeof(rmc_node_id_t) * remote->node_count);
+    if (!gather->servers) {
+        RMC_LOG_WARNING("Could not allocate servers of collective call [%s]: %s",
+                        gather->name, strerror(errno));
+        gather->status = ENOMEM;
+        return;
+    }
+
+    memcpy(gather->servers, remote->nodes, sizeof(rmc_node_id_t) * remote->node_count);
+    gather->expected = remote->node_count;
+}
+
+// Called as the call of a collective call is queued. Replies are
+// expected from the current servers of the function. A call without
+// servers fails with ENOENT, unless parked under DSTC_NO_SERVER_PARK,
+// in which case the servers are recorded as the call is sent.
+static void dstc_start_gather(dstc_gather_t* gather, uint8_t* name, uint8_t name_len)
+{
+    struct client_func_t* client = 0;
+
+    gather->started = 1;
+
+    if (!name_len) {
+        gather->status = ENOENT;
+        return;
+    }
+
+    memcpy(gather->name, name, name_len);
+    gather->name[name_len] = 0;
+    dstc_expect_servers(gather);
+
+    if (gather->expected || gather->status)
+        return;
+
+    client = dstc_find_client_func(gather->name);
+    if (client && client->no_server == DSTC_NO_SERVER_PARK)
+        gather->parked = 1;
+    else
+        gather->status = ENOENT;
+}
+
+// Has the node replied to the collective call?
+static int dstc_gather_replied(dstc_gather_t* gather, rmc_node_id_t node_id)
+{
+    uint32_t ind = 0;
+
+    for(ind = 0; ind < gather->count; ++ind)
+        if (gather->replies[ind].node_id == node_id)
+            return 1;
+
+    return 0;
+}
+
+// Have all servers replied? DSTC is not told when a node goes away,
+// so a departed server is waited for until the deadline.
+static int dstc_gather_done(dstc_gather_t* gather)
+{
+    uint32_t ind = 0;
+
+    if (!gather->started)
+        return 0;
+
+    if (gather->status)
+        return 1;
+
+    if (gather->parked)
+        return 0;
+
+    for(ind = 0; ind < gather->expected; ++ind)
+        if (!dstc_gather_replied(gather, gather->servers[ind]))
+            return 0;
+
+    return 1;
+}
+
+// Collect a reply, sent by a server to its callback argument.
+static void dstc_gather_reply(uint64_t id, rmc_node_id_t node_id, uint8_t* args, uint32_t args_len)
+{
+    dstc_gather_t* gather = 0;
+    dstc_gather_reply_t* reply = 0;
+    uint32_t ind = 0;
+
+    // Replies to the collective calls of other nodes are seen as well.
+    if (GATHER_ID_NODE(id) != dstc_get_node_id())
+        return;
+
+    if (!(gather = dstc_find_gather(id))) {
+        gather_stats.late_replies++;
+        return;
+    }
+
+    // Only the servers the call was made to are counted, each once.
+    for(ind = 0; ind < gather->expected; ++ind)
+        if (gather->servers[ind] == node_id)
+            break;
+
+    if (ind == gather->expected) {
+        gather_stats.unexpected_replies++;
+        return;
+    }
+
+    if (dstc_gather_replied(gather, node_id))
+        return;
+
+    if (gather->count == gather->size) {
+        uint32_t size = gather->size?gather->size * 2:8;
+        dstc_gather_reply_t* replies = realloc(gather->replies, size * sizeof(dstc_gather_reply_t));
+
+        if (!replies) {
+            RMC_LOG_WARNING("Could not store reply of node %u to [%s]: %s",
+                            node_id, gather->name, strerror(errno));
+            return;
+        }
+
+        gather->replies = replies;
+        gather->size = size;
+    }
+
+    // Aligned like an inbound payload, for typed dynamic arrays.
+    reply = &gather->replies[gather->count];
+    reply->node_id = node_id;
+    reply->length = args_len;
+    if (posix_memalign((void**) &reply->data, DSTC_ARRAY_ALIGN, args_len?args_len:1))
+        return;
+
+    memcpy(reply->data, args, args_len);
+    gather->count++;
+    gather_stats.replies++;
+
+    if (gather->reduce)
+        (*gather->reduce)(gather->user_data, node_id, reply->data);
+}
+
+// Earliest deadline of the collective calls, or now if one of them
+// has all its replies.
+static usec_timestamp_t dstc_gather_timeout(void)
+{
+    usec_timestamp_t timeout_ts = -1;
+    dstc_gather_t* gather = 0;
+
+    for(gather = gathers; gather; gather = gather->next) {
+        if (dstc_gather_done(gather))
+            return dstc_now();
+
+        if (timeout_ts == -1 || gather->deadline_ts < timeout_ts)
+            timeout_ts = gather->deadline_ts;
+    }
+    return timeout_ts;
+}
+
+// Complete the collective calls that have all their replies, or are
+// past their deadline. Done from the event loop, once the transport
+// is done processing, so that the completion functions can make calls.
+static void dstc_process_gathers(void)
+{
+    usec_timestamp_t now = dstc_now();
+    dstc_gather_t** prev = &gathers;
+    dstc_gather_t* done = 0;
+
+    // Unlinked first, as completion functions may start new ones.
+    while(*prev) {
+        dstc_gather_t* gather = *prev;
+
+        // Parked calls are flushed once the function has a server.
+        if (gather->parked && dstc_get_remote_count(gather->name)) {
+            gather->parked = 0;
+            dstc_expect_servers(gather);
+        }
+
+        if (!dstc_gather_done(gather) && now < gather->deadline_ts) {
+            prev = &gather->next;
+            continue;
+        }
+
+        *prev = gather->next;
+        gather->next = done;
+        done = gather;
+    }
+
+    while(done) {
+        dstc_gather_t* gather = done;
+        dstc_gather_result_t result = {
+            .status = gather->status,
+            .expected = gather->expected,
+            .count = gather->count,
+            .replies = gather->replies
+        };
+        uint32_t ind = 0;
+
+        done = gather->next;
+
+        if (!result.status && !dstc_gather_done(gather))
+            result.status = ETIME;
+
+        if (result.status)
+            gather_stats.expired++;
+        else
+            gather_stats.completed++;
+
+        if (next_call_gather == gather)
+            next_call_gather = 0;
+
+        if (gather->complete)
+            (*gather->complete)(gather->user_data, &result);
+
+        for(ind = 0; ind < gather->count; ++ind)
+            free(gather->replies[ind].data);
+
+        free(gather->replies);
+        free(gather->servers);
+        free(gather);
+    }
+}
+
+// Log a bulk call that a DSTC_SERVER_BULK() or DSTC_SERVER_BULK_SOA()
+// server could not take. A tuple size other than that of the server
+// means that client and server disagree on the tuple type.
+void dstc_bulk_call_dropped(const char* name, uint32_t count,
+                            uint32_t tuple_size, uint32_t server_tuple_size)
+{
+    if (tuple_size != server_tuple_size) {
+        RMC_LOG_WARNING("Bulk call [%s] of %u tuples of %u bytes, server tuples are %u bytes. Ignored",
+                        name, count, tuple_size, server_tuple_size);
+        return;
+    }
+
+    RMC_LOG_WARNING("Bulk call [%s] of %u tuples: Out of memory. Ignored", name, count);
+}
+
+static void dstc_process_function_call(dstc_header_t* call, uint8_t* args, uint32_t args_len)
+{
+    dstc_handler_t handler = { .func = 0, .ctx_func = 0, .ctx = 0 };
+    dstc_handler_t* local = 0;
+    uint8_t* name = dstc_call_name(call);
+    uint8_t* bulk = dstc_header_ext(call, DSTC_FLAG_BULK);
+    uint32_t count = 1;
+    uint32_t tuple_size = args_len;
+    uint8_t* aligned_args = 0;
+
+    // Retrieve function pointer from name, as previously
+    // registered with dstc_register_local_function()
+    RMC_LOG_DEBUG("DSTC Serve: node_id[%lu] name_len[%d] name[%.*s] payload_len[%d]",
+                  call->node_id, 
+                  call->name_len,
+                  call->name_len, name, call->payload_len - call->name_len);
+
+    // Reply to a collective call.
+    if (!call->name_len && (*(uint64_t*) name & GATHER_ID_FLAG)) {
+        dstc_gather_reply(*(uint64_t*) name, call->node_id, args, args_len);
+        return;
+    }
+
+    if (call->name_len) {
+        if ((local = dstc_find_local_function(name, call->name_len)))
+            handler = *local;
+    } else
+        dstc_find_callback(*(uint64_t*) name, &handler);
+        
+
+    if (!handler.func && !handler.ctx_func && !handler.batch_func) {
+        RMC_LOG_COMMENT("Function [%.*s] not loaded. Ignored", call->name_len, name);
+        return;
+    }
+
+    if (bulk) {
+        count = *(uint32_t*) bulk;
+        tuple_size = *(uint32_t*) (bulk + sizeof(uint32_t));
+
+        if ((uint64_t) count * tuple_size != args_len) {
+            RMC_LOG_WARNING("Bulk call of %u tuples of %u bytes has %u bytes of arguments. Ignored",
+                            count, tuple_size, args_len);
+            return;
+        }
+    }
+
+    // Typed dynamic arrays are aligned relative to the start of the
+    // arguments. Calls rebuilt from a delta, or replayed from a cache,
+    // are copied to an aligned buffer before their server sees them.
+    if ((call->flags & DSTC_FLAG_ALIGNED) && args_len &&
+        ((uintptr_t) args & (DSTC_ARRAY_ALIGN - 1))) {
+        if (posix_memalign((void**) &aligned_args, DSTC_ARRAY_ALIGN, args_len))
+            return;
+
+        memcpy(aligned_args, args, args_len);
+        args = aligned_args;
+    }
+
+    if (handler.batch_func)
+        (*handler.batch_func)(call->node_id, count, tuple_size, args);
+    else {
+        // A server without batch handler gets one call per tuple.
+        while(count--) {
+            if (handler.ctx_func)
+                (*handler.ctx_func)(handler.ctx, call->node_id, args);
+            else
+                (*handler.func)(call->node_id, args);
+
+            args += tuple_size;
+        }
+    }
+
+    free(aligned_args);
+}
+
+
+void dstc_set_memfd_threshold(uint32_t threshold_bytes)
+{
+    memfd_threshold = threshold_bytes;
+}
+
+void dstc_get_memfd_stats(dstc_memfd_stats_t* stats)
+{
+    *stats = memfd_stats;
+}
+
+// Abstract namespace address of the local socket of node_id.
+static socklen_t dstc_local_socket_addr(rmc_node_id_t node_id, struct sockaddr_un* addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    return offsetof(struct sockaddr_un, sun_path) + 1 +
+        snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, LOCAL_SOCKET_NAME, node_id);
+}
+
+static void dstc_local_poll_add(int descriptor, uint32_t user_data)
+{
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = user_data };
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, descriptor, &ev) == -1) {
+        RMC_LOG_FATAL("epoll_ctl(add, local): %s", strerror(errno));
+        exit(255);
+    }
+}
+
+// Listen for calls handed over by nodes on this host. A node that
+// cannot bind its local socket sends and receives all calls through RMC.
+static void dstc_local_setup(rmc_node_id_t node_id)
+{
+    struct sockaddr_un addr;
+    socklen_t addr_len = dstc_local_socket_addr(node_id, &addr);
+
+    local_listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (local_listen_fd == -1)
+        return;
+
+    if (bind(local_listen_fd, (struct sockaddr*) &addr, addr_len) == -1 ||
+        listen(local_listen_fd, MAX_CONNECTIONS) == -1) {
+        RMC_LOG_WARNING("Local socket of node %u: %s. Calls go through RMC only",
+                        node_id, strerror(errno));
+        close(local_listen_fd);
+        local_listen_fd = -1;
+        return;
+    }
+
+    dstc_local_poll_add(local_listen_fd, USER_DATA_LOCAL_LISTEN);
+}
+
+// Find node_id among the local peers, trying to connect to its local
+// socket the first time. The socket is only reachable from this host.
+static local_peer_t* dstc_local_peer(rmc_node_id_t node_id)
+{
+    struct sockaddr_un addr;
+    socklen_t addr_len = 0;
+    local_peer_t* peer = 0;
+    uint32_t ind = 0;
+
+    if (local_listen_fd == -1)
+        return 0;
+
+    for(ind = 0; ind < local_peer_count; ++ind)
+        if (local_peers[ind].node_id == node_id)
+            return &local_peers[ind];
+
+    local_peers = (local_peer_t*) realloc(local_peers, sizeof(local_peer_t) * (local_peer_count + 1));
+    peer = &local_peers[local_peer_count++];
+    peer->node_id = node_id;
+    peer->descriptor = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    // Called from the transport's control message callback, which must
+    // not block. A connection still in progress completes by itself, and
+    // sendmsg() fails with EAGAIN until it has.
+    addr_len = dstc_local_socket_addr(node_id, &addr);
+    if (peer->descriptor != -1 &&
+        connect(peer->descriptor, (struct sockaddr*) &addr, addr_len) == -1 &&
+        errno != EINPROGRESS) {
+        close(peer->descriptor);
+        peer->descriptor = -1;
+    }
+
+    if (peer->descriptor != -1) {
+        RMC_LOG_INFO("Node %u is on this host", node_id);
+        memfd_stats.local_peers++;
+    }
+    return peer;
+}
+
+// A local peer has gone away. Its functions are no longer
+// considered served by this host only.
+static void dstc_drop_local_peer(local_peer_t* peer)
+{
+    int ind = remote_func_ind;
+
+    RMC_LOG_INFO("Lost local socket of node %u", peer->node_id);
+    close(peer->descriptor);
+    peer->descriptor = -1;
+    memfd_stats.local_peers--;
+
+    while(ind--) {
+        struct remote_func_t* remote = &remote_func[ind];
+        uint32_t node_ind = remote->local_count;
+
+        while(node_ind--)
+            if (remote->local_nodes[node_ind] == peer->node_id)
+                remote->local_nodes[node_ind] = remote->local_nodes[--remote->local_count];
+    }
+}
+
+// Record that a remote function registered by
+// dstc_register_remote_function() is served by a local peer.
+static void dstc_register_local_server(char* name, rmc_node_id_t node_id)
+{
+    struct remote_func_t* remote = dstc_find_remote_func(name);
+    uint32_t ind = 0;
+
+    for(ind = 0; ind < remote->local_count; ++ind)
+        if (remote->local_nodes[ind] == node_id)
+            return;
+
+    remote->local_nodes = (rmc_node_id_t*) realloc(remote->local_nodes,
+                                                   sizeof(rmc_node_id_t) * (remote->local_count + 1));
+    remote->local_nodes[remote->local_count++] = node_id;
+}
+
+// Returns the remote function if all of its servers are local peers.
+// A single server elsewhere has the call go through RMC to everyone.
+static struct remote_func_t* dstc_local_route(char* name)
+{
+    struct remote_func_t* remote = dstc_find_remote_func(name);
+
+    if (!remote || !remote->count || remote->local_count != remote->count)
+        return 0;
+
+    return remote;
+}
+
+static void dstc_cache_call(struct client_func_t* client, dstc_header_t* call,
+                            uint8_t* args, uint32_t args_len);
+static void dstc_flush_coalesced(void);
+
+// Report status to the completion callback of a call that never
+// made it to the staging queues.
+static void dstc_report_completion(void (*complete)(void*, int), void* user_data, int status)
+{
+    pending_call_t* pend = 0;
+
+    if (!complete)
+        return;
+
+    pend = (pending_call_t*) malloc(sizeof(pending_call_t));
+    if (!pend) {
+        RMC_LOG_WARNING("Could not allocate completion: %s", strerror(errno));
+        return;
+    }
+
+    pend->complete = complete;
+    pend->complete_user_data = user_data;
+    pend->call_len = 0;
+    dstc_retire_pending(pend, status);
+}
+
+// Does a staged packet carry a call to name?
+static int dstc_packet_has_call(pending_call_t* pend, uint8_t* name, uint8_t name_len)
+{
+    uint32_t offset = 0;
+
+    while(offset < pend->call_len) {
+        dstc_header_t* call = (dstc_header_t*) (pend->call + offset);
+
+        if (call->name_len == name_len && !memcmp(dstc_call_name(call), name, name_len))
+            return 1;
+
+        offset += sizeof(dstc_header_t) + call->payload_len;
+    }
+    return 0;
+}
+
+// Is a call to name staged, and not yet handed to the transport?
+static int dstc_function_staged(uint8_t* name, uint8_t name_len)
+{
+    pending_call_t* pend = 0;
+    int prio = 0;
+
+    for(prio = 0; prio < DSTC_PRIO_COUNT; ++prio) {
+        if (coalesced[prio] && dstc_packet_has_call(coalesced[prio], name, name_len))
+            return 1;
+
+        for(pend = pending[prio].head; pend; pend = pend->next)
+            if (dstc_packet_has_call(pend, name, name_len))
+                return 1;
+    }
+    return 0;
+}
+
+// Hand the staged calls to name to the transport, ahead of a call
+// that is too large to be staged behind them. Only DSTC_QUEUE_BLOCK
+// waits for them. The other queue policies return EAGAIN.
+static int dstc_flush_function(uint8_t* name, uint8_t name_len)
+{
+    dstc_flush_coalesced();
+    dstc_drain_pending();
+
+    while(dstc_function_staged(name, name_len)) {
+        if (queue_policy != DSTC_QUEUE_BLOCK) {
+            backlog.rejected++;
+            return EAGAIN;
+        }
+
+        if (dstc_process_single_event(dstc_get_timeout_msec()) == ETIME)
+            dstc_process_timeout();
+    }
+    return 0;
+}
+
+// Write the arguments of a call to a sealed memfd, and pass it to
+// each local server. The memfd is freed by the kernel once the last
+// server has unmapped it.
+static int dstc_queue_memfd(struct client_func_t* client, struct remote_func_t* remote,
+                            uint8_t prio, uint8_t* name, uint8_t name_len,
+                            struct iovec* arg_iov, int arg_iovcnt, uint32_t arg_sz,
+                            usec_timestamp_t max_age,
+                            void (*complete)(void* user_data, int status),
+                            void* complete_user_data)
+{
+    uint8_t buf[LOCAL_CALL_MAX];
+    dstc_header_t* call = (dstc_header_t*) buf;
+    uint8_t latency = client && client->latency;
+    uint8_t flags = (prio & DSTC_FLAG_PRIO_MASK) |
+        (max_age?DSTC_FLAG_DEADLINE:0) |
+        (latency?DSTC_FLAG_LATENCY:0);
+    union {
+        struct cmsghdr hdr;
+        uint8_t buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct iovec iov = {
+        .iov_base = buf,
+        .iov_len = sizeof(dstc_header_t) + dstc_header_ext_len(flags) + name_len
+    };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf)
+    };
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    uint32_t delivered = 0;
+    int status = 0;
+    int fd = -1;
+    int ind = 0;
+
+    fd = memfd_create("dstc_call", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1)
+        return errno;
+
+    for(ind = 0; ind < arg_iovcnt; ++ind) {
+        uint8_t* data = (uint8_t*) arg_iov[ind].iov_base;
+        size_t left = arg_iov[ind].iov_len;
+
+        while(left) {
+            ssize_t res = write(fd, data, left);
+
+            if (res == -1) {
+                status = errno;
+                close(fd);
+                return status;
+            }
+            data += res;
+            left -= res;
+        }
+    }
+
+    // Servers map the arguments and must see them as written.
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1) {
+        status = errno;
+        close(fd);
+        return status;
+    }
+
+    // The header carries no arguments. They are in the memfd. The call
+    // is handed over at once, so there is no staged call to conflate it
+    // with, and it is sent as it is made.
+    call->payload_len = dstc_header_ext_len(flags) + name_len;
+    call->node_id = dstc_get_node_id();
+    call->name_len = name_len;
+    call->flags = flags;
+    memcpy(dstc_call_name(call), name, name_len);
+
+    if (max_age)
+        *(usec_timestamp_t*) dstc_header_ext(call, DSTC_FLAG_DEADLINE) = dstc_realtime_usec() + max_age;
+
+    if (latency) {
+        *(usec_timestamp_t*) dstc_header_ext(call, DSTC_FLAG_LATENCY) = dstc_now();
+        *(usec_timestamp_t*) (dstc_header_ext(call, DSTC_FLAG_LATENCY) + sizeof(usec_timestamp_t)) =
+            dstc_now();
+    }
+
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    // A server with a full socket buffer fails the call rather than
+    // blocking us, since it may in turn be waiting for us.
+    for(ind = remote->local_count - 1; ind >= 0; --ind) {
+        local_peer_t* peer = dstc_local_peer(remote->local_nodes[ind]);
+
+        if (sendmsg(peer->descriptor, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) != -1) {
+            delivered++;
+            continue;
+        }
+
+        if (!status)
+            status = errno;
+
+        if (errno != EAGAIN)
+            dstc_drop_local_peer(peer);
+    }
+    close(fd);
+
+    if (!delivered)
+        return status;
+
+    // Handed over to some servers, which will execute the call. The
+    // call is not retried, and the completion reports the first failure.
+    if (status)
+        memfd_stats.partial++;
+
+    memfd_stats.sent++;
+    memfd_stats.sent_bytes += arg_sz;
+
+    // Calls that fit in a replay are cached as if sent through RMC.
+    if (client && client->cache_mode &&
+        sizeof(dstc_header_t) + name_len + arg_sz < sizeof(announce_buf)) {
+        uint8_t* args = malloc(arg_sz?arg_sz:1);
+        uint8_t* data = args;
+
+        for(ind = 0; args && ind < arg_iovcnt; ++ind) {
+            memcpy(data, arg_iov[ind].iov_base, arg_iov[ind].iov_len);
+            data += arg_iov[ind].iov_len;
+        }
+
+        if (args)
+            dstc_cache_call(client, call, args, arg_sz);
+
+        free(args);
+    }
+
+    dstc_report_completion(complete, complete_user_data, status);
+    return 0;
+}
+
+// Map the arguments of a call handed over by a local peer,
+// and execute it.
+static void dstc_local_dispatch(dstc_header_t* call, int fd)
+{
+    struct stat st;
+    uint8_t* args = 0;
+    usec_timestamp_t ready_ts = dstc_now();
+    int seals = fcntl(fd, F_GET_SEALS);
+
+    // An unsealed memfd could be changed or truncated under the server.
+    if (seals == -1 ||
+        (seals & (F_SEAL_SHRINK | F_SEAL_WRITE)) != (F_SEAL_SHRINK | F_SEAL_WRITE) ||
+        fstat(fd, &st) == -1 || st.st_size > UINT32_MAX) {
+        RMC_LOG_WARNING("Call [%.*s] from node %u is not a sealed memfd. Ignored",
+                        call->name_len, dstc_call_name(call), call->node_id);
+        memfd_stats.rejected++;
+        return;
+    }
+
+    // Private and writable, as the servers may treat the arguments as a packet.
+    if (st.st_size) {
+        args = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (args == MAP_FAILED) {
+            RMC_LOG_WARNING("mmap() of %ld bytes for call [%.*s]: %s. Ignored",
+                            (long) st.st_size, call->name_len, dstc_call_name(call), strerror(errno));
+            memfd_stats.rejected++;
+            return;
+        }
+    }
+
+    memfd_stats.received++;
+    if (call->flags & DSTC_FLAG_LATENCY)
+        dstc_record_latency(call, ready_ts);
+
+    dstc_process_function_call(call, args, (uint32_t) st.st_size);
+
+    if (args)
+        munmap(args, st.st_size);
+}
+
+static void dstc_local_close(uint32_t ind)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, local_conns[ind], 0);
+    close(local_conns[ind]);
+    local_conns[ind] = -1;
+}
+
+// Receive calls from a local peer until its socket is drained.
+static void dstc_local_read(uint32_t ind)
+{
+    uint8_t buf[LOCAL_CALL_MAX];
+    dstc_header_t* call = (dstc_header_t*) buf;
+    union {
+        struct cmsghdr hdr;
+        uint8_t buf[CMSG_SPACE(sizeof(int))];
+    } control;
+
+    while(ind < local_conn_count && local_conns[ind] != -1) {
+        struct iovec iov = { .iov_base = buf, .iov_len = sizeof(buf) };
+        struct msghdr msg = {
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = control.buf,
+            .msg_controllen = sizeof(control.buf)
+        };
+        struct cmsghdr* cmsg = 0;
+        ssize_t len = recvmsg(local_conns[ind], &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+        int fd = -1;
+
+        if (len == -1 && (errno == EAGAIN || errno == EINTR))
+            return;
+
+        // Closed by the peer.
+        if (len <= 0) {
+            dstc_local_close(ind);
+            return;
+        }
+
+        cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+            cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+            memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+        if (fd == -1 ||
+            (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) ||
+            len < sizeof(dstc_header_t) ||
+            !call->name_len ||
+            (call->flags & ~LOCAL_CALL_FLAGS) ||
+            call->payload_len != dstc_header_ext_len(call->flags) + call->name_len ||
+            len != sizeof(dstc_header_t) + call->payload_len) {
+            RMC_LOG_WARNING("Malformed call of %ld bytes on local socket. Ignored", (long) len);
+            memfd_stats.rejected++;
+        } else if (dstc_call_expired(call, dstc_realtime_usec()))
+            deadline_stats.expired_inbound++;
+        else
+            dstc_local_dispatch(call, fd);
+
+        if (fd != -1)
+            close(fd);
+    }
+}
+
+// Accept connections from nodes that found us on this host.
+static void dstc_local_accept(void)
+{
+    int descriptor = -1;
+
+    while((descriptor = accept4(local_listen_fd, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        uint32_t ind = 0;
+
+        while(ind < local_conn_count && local_conns[ind] != -1)
+            ++ind;
+
+        if (ind == local_conn_count) {
+            local_conns = (int*) realloc(local_conns, sizeof(int) * (local_conn_count + 1));
+            local_conn_count++;
+        }
+
+        local_conns[ind] = descriptor;
+        dstc_local_poll_add(descriptor, USER_DATA_LOCAL_FLAG | ind);
+    }
+}
+
+static void dstc_local_process_event(struct epoll_event* event)
+{
+    if (event->data.u32 == USER_DATA_LOCAL_LISTEN)
+        dstc_local_accept();
+    else
+        dstc_local_read(event->data.u32 & USER_DATA_INDEX_MASK);
+}
+
+static uint32_t dstc_local_socket_count(void)
+{
+    uint32_t count = (local_listen_fd != -1)?1:0;
+    uint32_t ind = 0;
+
+    for(ind = 0; ind < local_conn_count; ++ind)
+        if (local_conns[ind] != -1)
+            count++;
+
+    return count;
+}
+
+// Find the index slot of the newest queued call that conflates with call,
+// or the empty slot where it should go.
+static uint32_t* dstc_inbound_conflated_slot(struct inbound_queue* queue, dstc_header_t* call)
+{
+    uint32_t mask = queue->conflated_size - 1;
+    uint32_t ind = (uint32_t) *(uint64_t*) dstc_header_ext(call, DSTC_FLAG_CONFLATE) & mask;
+
+    while(queue->conflated[ind] &&
+          !dstc_call_conflates(queue->calls[queue->conflated[ind] - 1].call, call))
+        ind = (ind + 1) & mask;
+
+    return &queue->conflated[ind];
+}
+
+// Mark the newest queued call with the same conflation key as call as
+// superseded, and index call, which is about to be appended to the queue,
+// in its place. Older calls with the key were superseded when that call
+// was queued, so only one call needs to be looked up.
+static void dstc_inbound_supersede(struct inbound_queue* queue, dstc_header_t* call)
+{
+    uint32_t* slot = 0;
+
+    // Keep the index at most half full.
+    if ((queue->conflated_count + 1) * 2 > queue->conflated_size) {
+        uint32_t* old = queue->conflated;
+        uint32_t old_size = queue->conflated_size;
+        uint32_t* conflated = calloc(old_size?old_size * 2:64, sizeof(uint32_t));
+        uint32_t ind = 0;
+
+        if (!conflated) {
+            RMC_LOG_WARNING("Could not grow conflation index. Call not conflated.");
+            return;
+        }
+
+        queue->conflated = conflated;
+        queue->conflated_size = old_size?old_size * 2:64;
+        for(ind = 0; ind < old_size; ++ind)
+            if (old[ind])
+                *dstc_inbound_conflated_slot(queue, queue->calls[old[ind] - 1].call) = old[ind];
+        free(old);
+    }
+
+    slot = dstc_inbound_conflated_slot(queue, call);
+    if (*slot)
+        queue->calls[*slot - 1].superseded = 1;
+    else
+        queue->conflated_count++;
+
+    *slot = queue->count + 1;
+}
+
+// Validate a single call in a received packet and add it to the
+// inbound queue of its priority class.
+// Returns the number of bytes consumed from data.
+static uint32_t dstc_queue_inbound_call(void* payload,
+                                        uint8_t* data,
+                                        uint32_t data_len,
+                                        usec_timestamp_t ready_ts)
+{
+    dstc_header_t* call = (dstc_header_t*) data;
+    struct inbound_queue* queue = 0;
+    uint8_t prio = 0;
+
+    if (data_len < sizeof(dstc_header_t)) {
+        RMC_LOG_WARNING("Packet header too short! Wanted %ld bytes, got %d",
+                        sizeof(dstc_header_t), data_len);
+        return data_len; // Emtpy buffer
+    }
+
+    if (data_len - sizeof(dstc_header_t) < call->payload_len) {
+        RMC_LOG_WARNING("Packet payload too short! Wanted %d bytes, got %d",
+                        call->payload_len, data_len - sizeof(dstc_header_t));
+        return data_len; // Emtpy buffer
+    }
+
+    if (call->payload_len < dstc_header_ext_len(call->flags) +
+        (call->name_len?call->name_len:sizeof(uint64_t))) {
+        RMC_LOG_WARNING("Call payload too short for its header extensions and name. Ignored");
+        return sizeof(dstc_header_t) + call->payload_len;
+    }
+
+    if (dstc_call_args(call) - call->payload > call->payload_len) {
+        RMC_LOG_WARNING("Call payload too short for its argument pad. Ignored");
+        return sizeof(dstc_header_t) + call->payload_len;
+    }
+
+    prio = call->flags & DSTC_FLAG_PRIO_MASK;
+    if (prio >= DSTC_PRIO_COUNT)
+        prio = DSTC_PRIO_BULK;
+
+    queue = &inbound[prio];
+
+    // Skip the older call, not yet executed, that this one replaces.
+    if (call->flags & DSTC_FLAG_CONFLATE)
+        dstc_inbound_supersede(queue, call);
+
+    if (queue->count == queue->size) {
+        queue->size = queue->size?queue->size * 2:64;
+        queue->calls = realloc(queue->calls, queue->size * sizeof(inbound_call_t));
+    }
+
+    dstc_transport_retain_payload(payload);
+    queue->calls[queue->count].call = call;
+    queue->calls[queue->count].payload = payload;
+    queue->calls[queue->count].ready_ts = ready_ts;
+    queue->calls[queue->count].superseded = 0;
+    queue->count++;
+
+    return sizeof(dstc_header_t) + call->payload_len;
+}
+
+// Execute all inbound calls, highest priority class first.
+static void dstc_dispatch_inbound(void)
+{
+    int prio = 0;
+
+    for(prio = 0; prio < DSTC_PRIO_COUNT; ++prio) {
+        struct inbound_queue* queue = &inbound[prio];
+        uint32_t ind = 0;
+
+        for(ind = 0; ind < queue->count; ++ind) {
+            inbound_call_t* in = &queue->calls[ind];
+            usec_timestamp_t wait = dstc_now() - in->ready_ts;
+            uint8_t* args = dstc_call_args(in->call);
+            uint32_t args_len = in->call->payload_len - (args - in->call->payload);
+
+            // Delta encoded calls are rebuilt in order, even if they
+            // are not executed, to keep the snapshot current.
+            if ((in->call->flags & DSTC_FLAG_DELTA) &&
+                !(args = dstc_delta_decode(in->call, &args_len))) {
+                dstc_transport_release_payload(in->payload);
+                continue;
+            }
+
+            if (in->superseded) {
+                conflation_stats.conflated_inbound++;
+                dstc_transport_release_payload(in->payload);
+                continue;
+            }
+
+            if ((in->call->flags & DSTC_FLAG_DEADLINE) &&
+                dstc_call_expired(in->call, dstc_realtime_usec())) {
+                deadline_stats.expired_inbound++;
+                dstc_transport_release_payload(in->payload);
+                continue;
+            }
+
+            prio_stats[prio].dispatched++;
+            prio_stats[prio].dispatch_usec_total += wait;
+            if (wait > prio_stats[prio].dispatch_usec_max)
+                prio_stats[prio].dispatch_usec_max = wait;
+
+            if (in->call->flags & DSTC_FLAG_LATENCY)
+                dstc_record_latency(in->call, in->ready_ts);
+
+            dstc_process_function_call(in->call, args, args_len);
+            dstc_transport_release_payload(in->payload);
+        }
+        queue->count = 0;
+
+        if (queue->conflated_count) {
+            memset(queue->conflated, 0, queue->conflated_size * sizeof(uint32_t));
+            queue->conflated_count = 0;
+        }
+    }
+}
+
+
+static void dstc_cache_remove(cache_entry_t* entry)
+{
+    struct client_func_t* client = entry->client;
+
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        cache_head = entry->next;
+
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        cache_tail = entry->prev;
+
+    if (entry->func_prev)
+        entry->func_prev->func_next = entry->func_next;
+    else
+        client->cache_head = entry->func_next;
+
+    if (entry->func_next)
+        entry->func_next->func_prev = entry->func_prev;
+    else
+        client->cache_tail = entry->func_prev;
+
+    client->cache_count--;
+    cache_stats.entries--;
+    cache_stats.bytes -= sizeof(cache_entry_t) + entry->call_len;
+    free(entry);
+}
+
+// Evict the oldest entries until the cache is within its limits.
+static void dstc_cache_trim(struct client_func_t* client)
+{
+    while(client->cache_count > client->cache_max) {
+        dstc_cache_remove(client->cache_head);
+        cache_stats.evicted++;
+    }
+
+    while(cache_head && cache_stats.bytes > cache_max_bytes) {
+        dstc_cache_remove(cache_head);
+        cache_stats.evicted++;
+    }
+}
+
+// Keep a copy of an outbound call, with args being its full arguments,
+// for dstc_replay_cache(). The copy is neither conflated nor delta
+// encoded, since the node it is replayed to has seen no earlier calls.
+static void dstc_cache_call(struct client_func_t* client, dstc_header_t* call,
+                            uint8_t* args, uint32_t args_len)
+{
+    // Replayed calls are packed, and not at an aligned offset. Their
+    // arguments are aligned by dstc_process_function_call() instead.
+    uint8_t flags = call->flags & (DSTC_FLAG_PRIO_MASK | DSTC_FLAG_DEADLINE | DSTC_FLAG_BULK |
+                                   DSTC_FLAG_ALIGNED);
+    uint32_t ext_len = dstc_header_ext_len(flags);
+    uint32_t call_len = sizeof(dstc_header_t) + ext_len + call->name_len + args_len;
+    uint64_t key = 0;
+    cache_entry_t* entry = 0;
+    dstc_header_t* cached = 0;
+
+    // Replayed calls are packed behind a one byte marker.
+    if (call_len + 1 > sizeof(announce_buf))
+        return;
+
+    if (client->cache_mode == DSTC_CACHE_PER_KEY) {
+        // The key of a bulk call's first tuple says nothing about the rest.
+        if ((flags & DSTC_FLAG_BULK) ||
+            client->cache_key_offset + client->cache_key_len > args_len)
+            return;
+
+        key = dstc_conflation_key(args + client->cache_key_offset, client->cache_key_len);
+        for(entry = client->cache_head; entry; entry = entry->func_next) {
+            if (entry->key == key) {
+                dstc_cache_remove(entry);
+                cache_stats.replaced++;
+                break;
+            }
+        }
+    }
+
+    entry = (cache_entry_t*) malloc(sizeof(cache_entry_t) + call_len);
+    entry->client = client;
+    entry->key = key;
+    entry->call_len = call_len;
+
+    cached = (dstc_header_t*) entry->call;
+    cached->node_id = call->node_id;
+    cached->name_len = call->name_len;
+    cached->flags = flags;
+    cached->payload_len = ext_len + call->name_len + args_len;
+
+    if (flags & DSTC_FLAG_DEADLINE)
+        memcpy(dstc_header_ext(cached, DSTC_FLAG_DEADLINE),
+               dstc_header_ext(call, DSTC_FLAG_DEADLINE), sizeof(usec_timestamp_t));
+
+    if (flags & DSTC_FLAG_BULK)
+        memcpy(dstc_header_ext(cached, DSTC_FLAG_BULK),
+               dstc_header_ext(call, DSTC_FLAG_BULK), 2 * sizeof(uint32_t));
+
+    if (flags & DSTC_FLAG_ALIGNED)
+        *dstc_header_ext(cached, DSTC_FLAG_ALIGNED) = 0;
+
+    memcpy(dstc_call_name(cached), dstc_call_name(call), call->name_len);
+    memcpy(dstc_call_args(cached), args, args_len);
+
+    entry->next = 0;
+    entry->prev = cache_tail;
+    if (cache_tail)
+        cache_tail->next = entry;
+    else
+        cache_head = entry;
+    cache_tail = entry;
+
+    entry->func_next = 0;
+    entry->func_prev = client->cache_tail;
+    if (client->cache_tail)
+        client->cache_tail->func_next = entry;
+    else
+        client->cache_head = entry;
+    client->cache_tail = entry;
+
+    client->cache_count++;
+    cache_stats.cached++;
+    cache_stats.entries++;
+    cache_stats.bytes += sizeof(cache_entry_t) + call_len;
+    dstc_cache_trim(client);
+}
+
+// Send all cached calls to node_id, oldest first, in as few control
+// messages as possible. A leading zero byte, which cannot start a
+// function name, tells the receiver that the message carries calls.
+static void dstc_replay_cache(rmc_node_id_t node_id)
+{
+    usec_timestamp_t now = dstc_realtime_usec();
+    cache_entry_t* entry = 0;
+    uint32_t count = 0;
+    uint32_t len = 1;
+
+    announce_buf[0] = 0;
+    for(entry = cache_head; entry; entry = entry->next) {
+        if (dstc_call_expired((dstc_header_t*) entry->call, now))
+            continue;
+
+        if (len + entry->call_len > sizeof(announce_buf)) {
+            transport->write_control_message(node_id, announce_buf, len);
+            len = 1;
+        }
+
+        memcpy(announce_buf + len, entry->call, entry->call_len);
+        len += entry->call_len;
+        count++;
+    }
+
+    if (!count)
+        return;
+
+    transport->write_control_message(node_id, announce_buf, len);
+    cache_stats.replays++;
+    cache_stats.replayed_calls += count;
+}
+
+// Replay the cache to the nodes recorded by dstc_transport_node_subscribed()
+static void dstc_replay_caches(void)
+{
+    uint32_t ind = 0;
+
+    if (!replay_node_count)
+        return;
+
+    for(ind = 0; ind < replay_node_count; ++ind)
+        dstc_replay_cache(replay_nodes[ind]);
+
+    free(replay_nodes);
+    replay_nodes = 0;
+    replay_node_count = 0;
+}
+
+// Cache calls to a function, and replay them to each node that
+// connects later, so that it starts out with the current state.
+// DSTC_CACHE_PER_KEY locates the key in the serialized arguments
+// the same way as dstc_set_client_conflation(). DSTC_CACHE_NONE
+// drops all calls cached for the function.
+int dstc_set_client_cache(char* function_name, uint8_t mode, uint32_t max_calls,
+                          uint32_t key_offset, uint32_t key_len)
+{
+    struct client_func_t* client = 0;
+
+    if (mode > DSTC_CACHE_PER_KEY || (mode != DSTC_CACHE_NONE && !max_calls))
+        return EINVAL;
+
+    client = dstc_get_client_func(function_name);
+
+    // Entries cached under another key are of no use.
+    if (mode != client->cache_mode || key_offset != client->cache_key_offset ||
+        key_len != client->cache_key_len)
+        while(client->cache_head)
+            dstc_cache_remove(client->cache_head);
+
+    client->cache_mode = mode;
+    client->cache_max = (mode == DSTC_CACHE_NONE)?0:max_calls;
+    client->cache_key_offset = key_offset;
+    client->cache_key_len = key_len;
+    dstc_cache_trim(client);
+    return 0;
+}
+
+// Limit the memory used by cached calls of all functions.
+// The oldest calls are evicted first. The default is 1 MB.
+void dstc_set_cache_limit(uint32_t max_bytes)
+{
+    cache_max_bytes = max_bytes;
+    while(cache_head && cache_stats.bytes > cache_max_bytes) {
+        dstc_cache_remove(cache_head);
+        cache_stats.evicted++;
+    }
+}
+
+void dstc_get_cache_stats(dstc_cache_stats_t* stats)
+{
+    *stats = cache_stats;
+}
+
+// We have subscribed to the publisher node_id.
+// Tell it which functions we serve, and bring it up to date
+// with the cached calls it missed.
+void dstc_transport_node_subscribed(rmc_node_id_t node_id)
+{
+    rmc_node_id_t* nodes = 0;
+    uint32_t ind = 0;
+    uint32_t len = 0;
+    RMC_LOG_COMMENT("Subscription complete. Sending supported functions.");
+
+    // Membership has changed. Announce quickly for a while so
+    // that the new node can subscribe to us as well.
+    dstc_restart_announce_schedule();
+
+    // The new node cannot decode delta encoded calls until it has
+    // received full arguments.
+    dstc_delta_force_keyframes();
+
+    dstc_update_local_index();
+
+    // Pack the names of all local functions into as few control
+    // messages as possible. Each name is null terminated.
+    for(ind = 0; ind < local_index_size; ++ind) {
+        uint32_t name_len = local_func[ind].name_len + 1;
+
+        if (!local_func[ind].func_name)
+            continue;
+
+        if (len + name_len > sizeof(announce_buf)) {
+            transport->write_control_message(node_id, announce_buf, len);
+            len = 0;
+        }
+
+        RMC_LOG_COMMENT("  [%s]", local_func[ind].func_name);
+        memcpy(announce_buf + len, local_func[ind].func_name, name_len);
+        len += name_len;
+    }
+
+    if (len)
+        transport->write_control_message(node_id, announce_buf, len);
+
+    RMC_LOG_COMMENT("Done sending functions");
+
+    // Replayed from the event loop, outside of the transport callback.
+    for(ind = 0; ind < replay_node_count; ++ind)
+        if (replay_nodes[ind] == node_id)
+            return;
+
+    nodes = (rmc_node_id_t*) realloc(replay_nodes, sizeof(rmc_node_id_t) * (replay_node_count + 1));
+    if (!nodes) {
+        RMC_LOG_WARNING("Cannot replay cached calls to node %u: Out of memory", node_id);
+        return;
+    }
+
+    replay_nodes = nodes;
+    replay_nodes[replay_node_count++] = node_id;
+    return;
+}
+
+// Next received packet, with replayed calls ahead of those
+// received by the transport.
+static void* dstc_next_inbound_packet(payload_len_t* payload_len)
+{
+    replay_packet_t* replay = replay_head;
+    void* payload = 0;
+
+    if (!replay)
+        return transport->next_packet(payload_len);
+
+    replay_head = replay->next;
+    if (!replay_head)
+        replay_tail = 0;
+
+    payload = replay->payload;
+    *payload_len = replay->payload_len;
+    free(replay);
+    return payload;
+}
+
+void dstc_transport_packets_ready(void)
+{
+    static int in_progress = 0;
+    payload_len_t payload_len = 0;
+    void* payload = 0;
+
+    // A function executed by us may run the event loop, which will
+    // invoke us again. Leave any new packets to the outer invocation.
+    if (in_progress)
+        return;
+
+    in_progress = 1;
+    RMC_LOG_DEBUG("Processing incoming");
+    while((payload = dstc_next_inbound_packet(&payload_len))) {
+        usec_timestamp_t ready_ts = dstc_now();
+
+        // Sort the calls of all ready packets into priority classes
+        // before executing any of them.
+        while(payload) {
+            uint32_t ind = 0;
+
+            RMC_LOG_DEBUG("Got packet. payload_len[%d]", payload_len);
+            while(ind < payload_len) {
+                RMC_LOG_DEBUG("Queuing function call. ind[%d]", ind);
+                ind += dstc_queue_inbound_call(payload,
+                                               ((uint8_t*) payload) + ind,
+                                               payload_len - ind,
+                                               ready_ts);
+            }
+
+            // The payload stays around until all its calls are executed.
+            dstc_transport_release_payload(payload);
+            payload = dstc_next_inbound_packet(&payload_len);
+        }
+        dstc_dispatch_inbound();
+    }
+    in_progress = 0;
+    return;
+}
+
+
+// A subscriber has told us which functions it serves,
+// or replayed the calls in its cache to us.
+void dstc_transport_control_message(rmc_node_id_t node_id,
+                                    void* payload,
+                                    payload_len_t payload_len)
+{
+    char* name = (char*) payload;
+    char* end = name + payload_len;
+    local_peer_t* peer = 0;
+
+    // Calls from dstc_replay_cache() are dispatched as a received packet.
+    if (payload_len && !*name) {
+        replay_packet_t* replay = (replay_packet_t*) malloc(sizeof(replay_packet_t));
+
+        replay->next = 0;
+        replay->payload_len = payload_len - 1;
+        replay->payload = dstc_transport_alloc_payload(replay->payload_len);
+        memcpy(replay->payload, name + 1, replay->payload_len);
+
+        if (replay_tail)
+            replay_tail->next = replay;
+        else
+            replay_head = replay;
+
+        replay_tail = replay;
+        cache_stats.replays_inbound++;
+        dstc_transport_packets_ready();
+        return;
+    }
+
+    // Large calls to a node on this host are handed over as memfds.
+    peer = dstc_local_peer(node_id);
+
+    // Payload is one or more null terminated function names.
+    while(name < end) {
+        char* term = memchr(name, 0, end - name);
+
+        if (!term) {
+            RMC_LOG_WARNING("Unterminated function name in control message. Ignored");
+            return;
+        }
+
+        dstc_register_remote_function(name);
+        dstc_register_remote_server(name, node_id);
+        if (peer && peer->descriptor != -1)
+            dstc_register_local_server(name, node_id);
+
+        name = term + 1;
+    }
+    return;
+}
+
+
+uint32_t dstc_get_socket_count(void)
+{
+    if (!initialized)
+        return 0;
+  
+    return transport->get_socket_count();
+}
+
+
+// Free a call that has been delivered, dropped, or replaced.
+// If the call has a completion callback, it is handed to
+// dstc_notify_completions() instead.
+static void dstc_retire_pending(pending_call_t* pend, int status)
+{
+    uint32_t offset = 0;
+
+    // Receivers cannot decode calls encoded against a dropped call.
+    while(status && offset < pend->call_len) {
+        dstc_header_t* call = (dstc_header_t*) (pend->call + offset);
+
+        if (call->flags & DSTC_FLAG_DELTA)
+            dstc_delta_call_dropped(call);
+
+        offset += sizeof(dstc_header_t) + call->payload_len;
+    }
+
+    if (!pend->complete) {
+        free(pend);
+        return;
+    }
+
+    pend->status = status;
+    pend->next = 0;
+    if (completed_tail)
+        completed_tail->next = pend;
+    else
+        completed_head = pend;
+
+    completed_tail = pend;
+}
+
+// Invoke completion callbacks. Done from the event loop, once RMC
+// is done processing, so that the callbacks can queue new calls.
+static void dstc_notify_completions(void)
+{
+    while(completed_head) {
+        pending_call_t* pend = completed_head;
+
+        completed_head = pend->next;
+        if (!completed_head)
+            completed_tail = 0;
+
+        (*pend->complete)(pend->complete_user_data, pend->status);
+        free(pend);
+    }
+}
+
+// A packet queued with dstc_transport_t::queue_packet() has been
+// delivered to all subscribers.
+void dstc_transport_packet_delivered(void* pl)
+{
+    pending_call_t* pend = (pending_call_t*) ((uint8_t*) pl - offsetof(pending_call_t, call));
+
+    RMC_LOG_DEBUG("Freeing %p", pend);
+    in_flight_packets--;
+    backlog.in_flight_packets--;
+    backlog.in_flight_bytes -= pend->call_len;
+    dstc_retire_pending(pend, 0);
+}
+
+
+int dstc_set_transport(const dstc_transport_t* transport_arg)
+{
+    if (initialized)
+        return EBUSY;
+
+    transport = transport_arg;
+    return 0;
+}
+
+usec_timestamp_t dstc_usec_monotonic_timestamp(void)
+{
+    return dstc_now();
+}
+
+rmc_node_id_t dstc_get_node_id(void)
+{
+    if (!initialized)
+        return 0;
+
+    return transport->node_id();
+}
+
+int dstc_setup_epoll(int epoll_fd_arg)
+{
+    int res = 0;
+
+    // Already intialized?
+    if (initialized) 
+        return EBUSY;
+
+    res = transport->setup(epoll_fd_arg);
+    if (res)
+        return res;
+
+    initialized = 1;
+
+    // Start ticking announcements as a client that the server will connect back to.
+    dstc_restart_announce_schedule();
+    return 0;
+}
+
+
+int dstc_setup(void)
+{
+    if (initialized)
+        return EBUSY;
+
+    // Index all server functions known at startup.
+    dstc_update_local_index();
+
+    // Only the RMC transport is driven by epoll.
+    if (transport != &rmc_transport)
+        return dstc_setup_epoll(-1);
+
+    epoll_fd = epoll_create(1);
+
+    return dstc_setup_epoll(epoll_fd);
+}
+
+uint32_t dstc_get_remote_count(char* function_name)
+{
+    struct remote_func_t* remote = dstc_find_remote_func(function_name);
+
+    // Is this an additional registration of an existing function.
+    if (!remote)
+        return 0;
+    
+    return remote->count;
+}
+
+// Process events until function_name is served by at least one remote
+// node, or until timeout usec have passed. A timeout of -1 waits forever.
+// Returns 0 if the function is available, or ETIME.
+int dstc_wait_for_remote(char* function_name, usec_timestamp_t timeout)
+{
+    usec_timestamp_t timeout_ts = 0;
+
+    if (!initialized)
+        dstc_setup();
+
+    timeout_ts = (timeout == -1)?-1:(dstc_now() + timeout);
+
+    while(!dstc_get_remote_count(function_name)) {
+        usec_timestamp_t now = dstc_now();
+        int msec = dstc_get_timeout_msec();
+
+        if (timeout_ts != -1) {
+            int arg_msec = 0;
+
+            if (now >= timeout_ts)
+                return ETIME;
+
+            arg_msec = (timeout_ts - now) / 1000 + 1;
+            if (msec == -1 || arg_msec < msec)
+                msec = arg_msec;
+        }
+
+        if (dstc_process_single_event(msec) == ETIME)
+            dstc_process_timeout();
+    }
+    return 0;
+}
+
+static uint32_t dstc_iov_len(struct iovec* iov, int iovcnt)
+{
+    uint32_t len = 0;
+
+    while(iovcnt--)
+        len += iov[iovcnt].iov_len;
+
+    return len;
+}
+
+static int dstc_in_flight_window_open(void)
+{
+    return !max_in_flight || in_flight_packets < max_in_flight;
+}
+
+// Can the call at the head of a staged queue be handed to the transport?
+static int dstc_send_window_open(pending_call_t* pend)
+{
+    return pend && dstc_in_flight_window_open() && dstc_pace_allows(pend->call_len);
+}
+
+static pending_call_t* dstc_pending_dequeue(uint8_t prio)
+{
+    struct pending_queue* queue = &pending[prio];
+    pending_call_t* pend = queue->head;
+
+    if (!pend)
+        return 0;
+
+    queue->head = pend->next;
+    if (!queue->head)
+        queue->tail = 0;
+
+    queue->count--;
+    backlog.staged_packets--;
+    backlog.staged_bytes -= pend->call_len;
+    return pend;
+}
+
+static void dstc_pending_enqueue(uint8_t prio, pending_call_t* pend)
+{
+    struct pending_queue* queue = &pending[prio];
+
+    pend->next = 0;
+    if (queue->tail)
+        queue->tail->next = pend;
+    else
+        queue->head = pend;
+
+    queue->tail = pend;
+    queue->count++;
+    backlog.staged_packets++;
+    backlog.staged_bytes += pend->call_len;
+}
+
+// Hand a staged call over to the transport, which will free it through
+// dstc_transport_packet_delivered() on confirmed delivery.
+static void dstc_send_pending(uint8_t prio, pending_call_t* pend)
+{
+    usec_timestamp_t delay = 0;
+    dstc_header_t* call = 0;
+    uint32_t offset = 0;
+
+    // Don't put calls on the wire that no one wants anymore.
+    if (pend->deadline && pend->deadline < dstc_realtime_usec()) {
+        deadline_stats.expired_staged++;
+        dstc_retire_pending(pend, ETIME);
+        return;
+    }
+
+    delay = dstc_now() - pend->queued_ts;
+    dstc_pace_consume(pend->call_len);
+
+    prio_stats[prio].sent += pend->call_count;
+    prio_stats[prio].queue_usec_total += delay;
+    if (delay > prio_stats[prio].queue_usec_max)
+        prio_stats[prio].queue_usec_max = delay;
+
+    // Stamp timestamped calls with the time they leave us.
+    for(offset = 0; offset < pend->call_len; offset += sizeof(dstc_header_t) + call->payload_len) {
+        call = (dstc_header_t*) (pend->call + offset);
+
+        if (call->flags & DSTC_FLAG_LATENCY)
+            *(usec_timestamp_t*) (dstc_header_ext(call, DSTC_FLAG_LATENCY) +
+                                  sizeof(usec_timestamp_t)) = dstc_now();
+    }
+
+    in_flight_packets++;
+    backlog.in_flight_packets++;
+    backlog.in_flight_bytes += pend->call_len;
+    transport->queue_packet(pend->call, pend->call_len);
+}
+
+// Move staged calls to the transport, in priority order, for as long
+// as the in flight window is open and the pacing rate allows.
+static void dstc_drain_pending(void)
+{
+    int prio = 0;
+    uint32_t staged = 0;
+
+    if (!initialized)
+        return;
+
+    // Pacing is checked again, now that time has passed.
+    pace_wait_ts = -1;
+
+    // Sending drops expired calls, whose dependents are fixed up before
+    // the next call is sent.
+    dstc_delta_fix_dropped();
+
+    if (drain_mode == DSTC_DRAIN_STRICT) {
+        for(prio = 0; prio < DSTC_PRIO_COUNT; ++prio)
+            while(dstc_send_window_open(pending[prio].head)) {
+                dstc_send_pending(prio, dstc_pending_dequeue(prio));
+                dstc_delta_fix_dropped();
+            }
+        return;
+    }
+
+    // Weighted round robin
+    for(prio = 0; prio < DSTC_PRIO_COUNT; ++prio)
+        staged += pending[prio].count;
+
+    while(staged && dstc_in_flight_window_open() && pace_wait_ts == -1) {
+        for(prio = 0; prio < DSTC_PRIO_COUNT; ++prio) {
+            uint32_t quota = drain_weights[prio];
+
+            while(quota-- && dstc_send_window_open(pending[prio].head)) {
+                dstc_send_pending(prio, dstc_pending_dequeue(prio));
+                dstc_delta_fix_dropped();
+            }
+        }
+
+        // Fixups may have dropped staged calls.
+        for(staged = 0, prio = 0; prio < DSTC_PRIO_COUNT; ++prio)
+            staged += pending[prio].count;
+    }
+}
+
+void dstc_set_queue_limit(uint32_t max_bytes, uint32_t max_packets, uint8_t policy)
+{
+    queue_max_bytes = max_bytes;
+    queue_max_packets = max_packets;
+    queue_policy = policy;
+}
+
+void dstc_get_queue_backlog(dstc_queue_backlog_t* result)
+{
+    *result = backlog;
+}
+
+void dstc_set_queue_drained_callback(uint32_t low_watermark_bytes,
+                                     void (*callback)(dstc_queue_backlog_t* backlog))
+{
+    queue_low_watermark = low_watermark_bytes;
+    queue_drained_cb = callback;
+    queue_watermark_armed = 0;
+}
+
+// Invoke the drained callback once the backlog has fallen below the
+// low watermark. Called from the event loop rather than from
+// dstc_transport_packet_delivered() so that the callback can queue new calls.
+static void dstc_check_queue_watermark(void)
+{
+    uint32_t bytes = backlog.staged_bytes + backlog.in_flight_bytes;
+
+    if (!queue_drained_cb)
+        return;
+
+    if (bytes >= queue_low_watermark) {
+        queue_watermark_armed = 1;
+        return;
+    }
+
+    if (!queue_watermark_armed)
+        return;
+
+    queue_watermark_armed = 0;
+    (*queue_drained_cb)(&backlog);
+}
+
+// Can call_count calls of call_len bytes in total be queued without
+// exceeding the limits? A single call is always accepted into an
+// empty queue, no matter its size.
+static int dstc_queue_has_room(uint32_t call_count, uint32_t call_len)
+{
+    uint32_t packets = backlog.staged_packets + backlog.in_flight_packets;
+    uint32_t bytes = backlog.staged_bytes + backlog.in_flight_bytes;
+
+    if (!packets && call_count == 1)
+        return 1;
+
+    if (queue_max_packets && packets + call_count > queue_max_packets)
+        return 0;
+
+    if (queue_max_bytes && bytes + call_len > queue_max_bytes)
+        return 0;
+
+    return 1;
+}
+
+// Replace a staged call, not yet handed to the transport, that conflates with pend.
+// pend keeps the queue position of the replaced call.
+// Returns 0 if pend did not take the place of a replaced call.
+static int dstc_replace_pending(uint8_t prio, pending_call_t* pend)
+{
+    struct pending_queue* queue = &pending[prio];
+    pending_call_t* prev = 0;
+    pending_call_t* old = queue->head;
+
+    while(old && !dstc_call_conflates((dstc_header_t*) old->call, (dstc_header_t*) pend->call)) {
+        prev = old;
+        old = old->next;
+    }
+
+    if (!old)
+        return 0;
+
+    // A larger call must not take the queue past its byte limit. Drop the
+    // replaced call and let the caller queue pend as a new call, subject
+    // to the queue policy.
+    if (pend->call_len > old->call_len && queue_max_bytes &&
+        backlog.staged_bytes + backlog.in_flight_bytes - old->call_len + pend->call_len >
+        queue_max_bytes) {
+        if (prev)
+            prev->next = old->next;
+        else
+            queue->head = old->next;
+
+        if (queue->tail == old)
+            queue->tail = prev;
+
+        queue->count--;
+        backlog.staged_packets--;
+        backlog.staged_bytes -= old->call_len;
+        conflation_stats.conflated_staged++;
+        dstc_retire_pending(old, ECANCELED);
+        return 0;
+    }
+
+    pend->next = old->next;
+    if (prev)
+        prev->next = pend;
+    else
+        queue->head = pend;
+
+    if (queue->tail == old)
+        queue->tail = pend;
+
+    backlog.staged_bytes += pend->call_len;
+    backlog.staged_bytes -= old->call_len;
+    conflation_stats.conflated_staged++;
+    dstc_retire_pending(old, ECANCELED);
+    return 1;
+}
+
+// Drop all staged calls that are past their deadline.
+static void dstc_purge_expired_pending(void)
+{
+    usec_timestamp_t now = dstc_realtime_usec();
+    int prio = 0;
+
+    for(prio = 0; prio < DSTC_PRIO_COUNT; ++prio) {
+        struct pending_queue* queue = &pending[prio];
+        pending_call_t* prev = 0;
+        pending_call_t* pend = queue->head;
+
+        while(pend) {
+            pending_call_t* next = pend->next;
+
+            if (!pend->deadline || pend->deadline >= now) {
+                prev = pend;
+                pend = next;
+                continue;
+            }
+
+            if (prev)
+                prev->next = next;
+            else
+                queue->head = next;
+
+            if (queue->tail == pend)
+                queue->tail = prev;
+
+            queue->count--;
+            backlog.staged_packets--;
+            backlog.staged_bytes -= pend->call_len;
+            deadline_stats.expired_staged++;
+            dstc_retire_pending(pend, ETIME);
+            pend = next;
+        }
+    }
+}
+
+// Drop the oldest staged call, regardless of priority class.
+// Returns 0 if there was nothing left to drop.
+static int dstc_drop_oldest_pending(void)
+{
+    int prio = 0;
+    int oldest = -1;
+
+    for(prio = 0; prio < DSTC_PRIO_COUNT; ++prio) {
+        if (!pending[prio].head)
+            continue;
+
+        if (oldest == -1 || pending[prio].head->queued_ts < pending[oldest].head->queued_ts)
+            oldest = prio;
+    }
+
+    if (oldest == -1)
+        return 0;
+
+    dstc_retire_pending(dstc_pending_dequeue(oldest), ECANCELED);
+    backlog.dropped++;
+    return 1;
+}
+
+// Apply the queue policy until a call of call_len bytes fits.
+static int dstc_make_queue_room(uint32_t call_len)
+{
+    if (!dstc_queue_has_room(1, call_len))
+        dstc_purge_expired_pending();
+
+    while(!dstc_queue_has_room(1, call_len)) {
+        switch(queue_policy) {
+        case DSTC_QUEUE_EAGAIN:
+            backlog.rejected++;
+            return EAGAIN;
+
+        case DSTC_QUEUE_DROP_OLDEST:
+            if (!dstc_drop_oldest_pending()) {
+                backlog.rejected++;
+                return EAGAIN;
+            }
+            break;
+
+        default:
+            // Block. Run the event loop until the transport has confirmed
+            // enough deliveries.
+            if (dstc_process_single_event(dstc_get_timeout_msec()) == ETIME)
+                dstc_process_timeout();
+        }
+    }
+    return 0;
+}
+
+// Drop the oldest calls parked for a function until at most keep remain.
+static void dstc_drop_parked(struct client_func_t* client, uint32_t keep, uint64_t* counter)
+{
+    while(client->parked_count > keep) {
+        pending_call_t* pend = client->parked_head;
+
+        client->parked_head = pend->next;
+        if (!client->parked_head)
+            client->parked_tail = 0;
+
+        client->parked_count--;
+        (*counter)++;
+        dstc_retire_pending(pend, ECANCELED);
+    }
+}
+
+// Hold a call to a function that no remote node serves
+// until dstc_flush_parked() is invoked for the function.
+static void dstc_park_call(struct client_func_t* client, pending_call_t* pend)
+{
+    pend->next = 0;
+    if (client->parked_tail)
+        client->parked_tail->next = pend;
+    else
+        client->parked_head = pend;
+
+    client->parked_tail = pend;
+    client->parked_count++;
+    no_server_stats.parked++;
+    dstc_drop_parked(client, client->max_parked, &no_server_stats.park_overflow);
+}
+
+// Stage all calls parked for a function, in the order they were made.
+// Each call is subject to the queue limits as if it was made now, and
+// one that the queue policy rejects reports EAGAIN to its completion.
+// Calls that expired while parked are dropped by dstc_drain_pending().
+static void dstc_flush_parked(struct client_func_t* client)
+{
+    while(client->parked_head) {
+        pending_call_t* pend = client->parked_head;
+
+        client->parked_head = pend->next;
+        if (!client->parked_head)
+            client->parked_tail = 0;
+
+        client->parked_count--;
+
+        // May run the event loop under DSTC_QUEUE_BLOCK.
+        if (dstc_make_queue_room(pend->call_len)) {
+            dstc_retire_pending(pend, EAGAIN);
+            continue;
+        }
+
+        pend->queued_ts = dstc_now();
+        no_server_stats.flushed++;
+        dstc_pending_enqueue(((dstc_header_t*) pend->call)->flags & DSTC_FLAG_PRIO_MASK, pend);
+    }
+
+    dstc_drain_pending();
+}
+
+// Set what calls to a function do while no remote node serves it.
+// DSTC_NO_SERVER_PARK holds up to max_parked calls, dropping the
+// oldest ones first, and sends them once the first server registers.
+// Calls already parked follow the new policy.
+int dstc_set_client_no_server_policy(char* function_name, uint8_t policy, uint32_t max_parked)
+{
+    struct client_func_t* client = 0;
+
+    if (policy > DSTC_NO_SERVER_PARK || (policy == DSTC_NO_SERVER_PARK && !max_parked))
+        return EINVAL;
+
+    client = dstc_get_client_func(function_name);
+    client->no_server = policy;
+    client->max_parked = (policy == DSTC_NO_SERVER_PARK)?max_parked:0;
+
+    if (policy == DSTC_NO_SERVER_PARK)
+        dstc_drop_parked(client, max_parked, &no_server_stats.park_overflow);
+    else if (policy == DSTC_NO_SERVER_DROP)
+        dstc_drop_parked(client, 0, &no_server_stats.dropped);
+    else if (client->parked_head)
+        dstc_flush_parked(client);
+
+    return 0;
+}
+
+void dstc_get_no_server_stats(dstc_no_server_stats_t* stats)
+{
+    *stats = no_server_stats;
+}
+
+// Report the outcome of the next queued call to complete().
+// status is 0 when delivery has been confirmed, ETIME if the call
+// expired before being sent, and ECANCELED if it was dropped or replaced.
+void dstc_set_next_call_completion(void (*complete)(void* user_data, int status),
+                                   void* user_data)
+{
+    next_call_complete = complete;
+    next_call_complete_user_data = user_data;
+}
 
-    // Subscriber init.
+static int dstc_schedule_call(uint8_t* name, uint8_t name_len,
+                              struct iovec* arg_iov, int arg_iovcnt,
+                              usec_timestamp_t delay, usec_timestamp_t max_age,
+                              void (*complete)(void* user_data, int status),
+                              uint32_t bulk_count, uint32_t tuple_size, uint8_t aligned);
+static dstc_header_t* dstc_coalesce_reserve(uint8_t prio, uint32_t call_len);
 
-    sub_conn_vec_mem = malloc(sizeof(rmc_connection_t)*MAX_CONNECTIONS);
-    memset(sub_conn_vec_mem, 0, sizeof(rmc_connection_t)*MAX_CONNECTIONS);
+// Queue a call whose serialized arguments are gathered from arg_iov.
+static int dstc_queue_call(uint8_t* name, uint8_t name_len, struct iovec* arg_iov, int arg_iovcnt)
+{
+    uint16_t actual_name_len = name_len?name_len:sizeof(uint64_t);
+    uint32_t arg_sz = dstc_iov_len(arg_iov, arg_iovcnt);
+    struct client_func_t* client = name_len?dstc_find_client_func((char*) name):0;
+    uint8_t prio = client?client->priority:DSTC_PRIO_NORMAL;
+    usec_timestamp_t max_age = next_call_deadline?next_call_deadline:(client?client->deadline_usec:0);
+    uint32_t bulk_count = next_call_bulk_count;
+    uint32_t tuple_size = next_call_tuple_size;
+    uint8_t aligned = next_call_aligned;
+    // Held in full, outside the staging queues, until a server registers.
+    uint8_t park = client && client->no_server == DSTC_NO_SERVER_PARK &&
+        !dstc_get_remote_count((char*) name);
+    // The key of a bulk call's first tuple says nothing about the rest.
+    uint8_t conflate = client && client->conflate && !bulk_count && !park &&
+        client->key_offset + client->key_len <= arg_sz;
+    // A replaced call would leave the calls encoded against it undecodable.
+    uint8_t delta = client && client->keyframe_interval && !conflate && !park && arg_sz;
+    uint8_t latency = client && client->latency;
+    uint8_t flags = (prio & DSTC_FLAG_PRIO_MASK) |
+        (max_age?DSTC_FLAG_DEADLINE:0) |
+        (conflate?DSTC_FLAG_CONFLATE:0) |
+        (delta?DSTC_FLAG_DELTA:0) |
+        (bulk_count?DSTC_FLAG_BULK:0) |
+        (latency?DSTC_FLAG_LATENCY:0) |
+        (aligned?DSTC_FLAG_ALIGNED:0);
+    uint32_t ext_len = dstc_header_ext_len(flags);
+    // Aligns the arguments of a call sent at the start of a packet.
+    uint8_t pad = aligned?_DSTC_ARRAY_PAD(sizeof(dstc_header_t) + ext_len + actual_name_len):0;
+    uint32_t call_len = sizeof(dstc_header_t) + ext_len + actual_name_len + pad + arg_sz;
+    pending_call_t* pend = 0;
+    dstc_header_t *call = 0;
+    struct remote_func_t* local = 0;
+    void (*complete)(void*, int) = next_call_complete;
+    usec_timestamp_t delay = next_call_delay;
+    usec_timestamp_t deadline = 0;
+    uint8_t coalesce = coalesce_calls && !conflate && !complete && !park && !aligned;
+    uint8_t replaced = 0;
+    struct iovec delta_iov;
+    uint32_t base_seq = 0;
+    uint8_t* data = 0;
+    int ind = 0;
 
-    rmc_sub_init_context(&_dstc_sub_ctx,
-                         // Reuse pub node id to detect and avoid loopback messages
-                         rmc_pub_node_id(&_dstc_pub_ctx), 
-                         MCAST_GROUP_ADDRESS,
-                         "0.0.0.0", // Any interface for multicast address
-                         MCAST_GROUP_PORT,  
-                         user_data,
-                         poll_add_sub, poll_modify_sub, poll_remove,
-                         sub_conn_vec_mem, MAX_CONNECTIONS,
-                         0,0);
-    
-    rmc_sub_set_packet_ready_callback(&_dstc_sub_ctx, dstc_process_incoming);
-    rmc_sub_set_subscription_complete_callback(&_dstc_sub_ctx, dstc_subscription_complete);
+    // Per call settings are consumed even if the call is rejected.
+    next_call_deadline = 0;
+    next_call_complete = 0;
+    next_call_delay = -1;
+    next_call_bulk_count = 0;
+    next_call_tuple_size = 0;
+    next_call_aligned = 0;
+
+    // Large calls that only servers on this host will execute skip
+    // RMC, and are handed over as sealed memfds. See dstc_queue_memfd()
+    // To keep the calls to a function in order, a call that fits in a
+    // packet is staged as usual behind staged calls to the function,
+    // and one that does not waits for them to be handed to the transport.
+    if (delay == -1 && name_len && !bulk_count &&
+        memfd_threshold && call_len > memfd_threshold &&
+        (local = dstc_local_route((char*) name))) {
+        void* user_data = next_call_complete_user_data;
+        int staged = dstc_function_staged(name, name_len);
+        int res = 0;
+
+        if (!staged || call_len > RMC_MAX_PAYLOAD) {
+            if (staged && (res = dstc_flush_function(name, name_len)))
+                return res;
+
+            return dstc_queue_memfd(client, local, prio, name, name_len, arg_iov, arg_iovcnt,
+                                    arg_sz, max_age, complete, user_data);
+        }
+    }
 
-    rmc_pub_activate_context(&_dstc_pub_ctx);
-    rmc_sub_activate_context(&_dstc_sub_ctx);
+    if (call_len > RMC_MAX_PAYLOAD) {
+        RMC_LOG_WARNING("Call of %d bytes exceeds max payload %d. Ignored", call_len, RMC_MAX_PAYLOAD);
+        return EMSGSIZE;
+    }
 
-    // Start ticking announcements as a client that the server will connect back to.
-    rmc_pub_set_announce_interval(&_dstc_pub_ctx, 200000); // Start ticking announces.
+    // DSTC_SCHEDULE() call. Queued by dstc_fire_timer() when due.
+    if (delay != -1)
+        return dstc_schedule_call(name, name_len, arg_iov, arg_iovcnt, delay, max_age, complete,
+                                  bulk_count, tuple_size, aligned);
 
-    initialized = 1;
+    // Calls fired by timers in the same tick are packed into shared
+    // packets by dstc_coalesce_reserve(). Other calls get a packet each.
+    if (!initialized)
+        dstc_setup();
+
+    if (client && client->no_server == DSTC_NO_SERVER_DROP && !dstc_get_remote_count((char*) name)) {
+        no_server_stats.dropped++;
+        return ENOENT;
+    }
+
+    // A conflated call replaces a staged one and needs no extra room.
+    // Parked calls are bounded by the max_parked of the function instead.
+    if (!conflate && !park && dstc_make_queue_room(call_len))
+        return EAGAIN;
+
+    // call_len so far is that of the full arguments, which is the
+    // upper bound of the delta encoded ones.
+    if (delta) {
+        base_seq = dstc_delta_prepare(client, arg_iov, arg_iovcnt, arg_sz, &delta_iov);
+        arg_iov = &delta_iov;
+        arg_iovcnt = 1;
+        arg_sz = delta_iov.iov_len;
+        call_len = sizeof(dstc_header_t) + ext_len + actual_name_len + pad + arg_sz;
+    }
+
+    if (coalesce) {
+        // Fired by a timer. Share a packet with other calls due in the same tick.
+        call = dstc_coalesce_reserve(prio, call_len);
+        pend = coalesced[prio];
+    } else {
+        // Will be freed by dstc_transport_packet_delivered() on confirmed delivery
+        pend = (pending_call_t*) malloc(sizeof(pending_call_t) + call_len);
+        call = (dstc_header_t*) pend->call;
+        pend->complete = complete;
+        pend->complete_user_data = next_call_complete_user_data;
+        pend->status = 0;
+        pend->call_count = 1;
+    }
+
+    call->name_len = name_len; // May be zero to indicate thtat this is an address.
+    call->flags = flags;
+    call->payload_len = ext_len + actual_name_len + pad + arg_sz;
+    call->node_id = dstc_get_node_id();
+
+    if (aligned) {
+        *dstc_header_ext(call, DSTC_FLAG_ALIGNED) = pad;
+        memset(dstc_call_name(call) + actual_name_len, 0, pad);
+    }
+
+    // Gather arguments straight from the caller's memory.
+    memcpy(dstc_call_name(call), name, actual_name_len);
+    data = dstc_call_args(call);
+    for(ind = 0; ind < arg_iovcnt; ++ind) {
+        memcpy(data, arg_iov[ind].iov_base, arg_iov[ind].iov_len);
+        data += arg_iov[ind].iov_len;
+    }
+
+    deadline = max_age?(dstc_realtime_usec() + max_age):0;
+    if (deadline)
+        *(usec_timestamp_t*) dstc_header_ext(call, DSTC_FLAG_DEADLINE) = deadline;
+
+    if (conflate) {
+        uint8_t* ext = dstc_header_ext(call, DSTC_FLAG_CONFLATE);
+
+        *(uint64_t*) ext = dstc_conflation_key(dstc_call_args(call) + client->key_offset,
+                                               client->key_len);
+        *(uint32_t*) (ext + sizeof(uint64_t)) = client->key_offset;
+        *(uint32_t*) (ext + sizeof(uint64_t) + sizeof(uint32_t)) = client->key_len;
+    }
+
+    if (delta) {
+        *(uint32_t*) dstc_header_ext(call, DSTC_FLAG_DELTA) = client->delta_seq;
+        *(uint32_t*) (dstc_header_ext(call, DSTC_FLAG_DELTA) + sizeof(uint32_t)) = base_seq;
+    }
+
+    if (bulk_count) {
+        *(uint32_t*) dstc_header_ext(call, DSTC_FLAG_BULK) = bulk_count;
+        *(uint32_t*) (dstc_header_ext(call, DSTC_FLAG_BULK) + sizeof(uint32_t)) = tuple_size;
+    }
+
+    // The send time is filled in by dstc_send_pending().
+    if (latency) {
+        *(usec_timestamp_t*) dstc_header_ext(call, DSTC_FLAG_LATENCY) = dstc_now();
+        *(usec_timestamp_t*) (dstc_header_ext(call, DSTC_FLAG_LATENCY) + sizeof(usec_timestamp_t)) = 0;
+    }
+
+    RMC_LOG_DEBUG("DSTC Queue: node_id[%lu] name_len[%d/%d] name[%.*s] payload_len[%d]",
+                  call->node_id,
+                  call->name_len, actual_name_len,
+                  call->name_len?call->name_len:10,
+                  call->name_len?dstc_call_name(call):((uint8_t*)"[callback]"),
+                  arg_sz);
+
+    // A coalesced packet can only be dropped once all of its calls have expired.
+    if (coalesce) {
+        if (pend->call_count == 1)
+            pend->deadline = deadline;
+        else if (!deadline || !pend->deadline)
+            pend->deadline = 0;
+        else if (deadline > pend->deadline)
+            pend->deadline = deadline;
+    } else {
+        pend->deadline = deadline;
+        pend->queued_ts = dstc_now();
+        pend->call_len = call_len;
+    }
+
+    // No staged call to replace. Queue as any other call.
+    if (conflate && !(replaced = dstc_replace_pending(prio, pend)) &&
+        dstc_make_queue_room(call_len)) {
+        free(pend);
+        return EAGAIN;
+    }
+
+    // Only calls that were accepted are cached. Delta encoded calls are
+    // cached with the full arguments, which dstc_delta_prepare() kept as
+    // the new snapshot.
+    if (client && client->cache_mode)
+        dstc_cache_call(client, call,
+                        delta?client->snapshot:dstc_call_args(call),
+                        delta?client->snapshot_len:arg_sz);
+
+    prio_stats[prio].queued++;
+
+    if (coalesce || replaced)
+        return 0;
+
+    if (park) {
+        dstc_park_call(client, pend);
+        return 0;
+    }
+
+    dstc_pending_enqueue(prio, pend);
+    dstc_drain_pending();
     return 0;
 }
 
-rmc_node_id_t dstc_get_node_id(void)
+
+// Queue a call, and start the collective call it was made for, if any.
+static int dstc_queue(uint8_t* name, uint8_t name_len, struct iovec* arg_iov, int arg_iovcnt)
+{
+    dstc_gather_t* gather = next_call_gather;
+    uint64_t id = gather?gather->id:0;
+    int res = 0;
+
+    next_call_gather = 0;
+    if (gather)
+        dstc_start_gather(gather, name, name_len);
+
+    res = dstc_queue_call(name, name_len, arg_iov, arg_iovcnt);
+
+    // A blocked call runs the event loop, which may have completed the gather.
+    if (res && id && (gather = dstc_find_gather(id)))
+        gather->status = res;
+
+    return res;
+}
+
+
+int dstc_queue_callback(uint64_t addr, uint8_t* arg, uint32_t arg_sz)
+{
+    struct iovec iov = { .iov_base = arg, .iov_len = arg_sz };
+
+    // Call with zero namelen to treat name as a 64bit integer.
+    // This integer will be mapped by the received through the local_callback
+    // table to a pending callback function.
+    return dstc_queue((uint8_t*) &addr, 0, &iov, 1);
+}
+
+int dstc_queue_func(uint8_t* name, uint8_t* arg, uint32_t arg_sz)
+{
+    struct iovec iov = { .iov_base = arg, .iov_len = arg_sz };
+
+    return dstc_queue(name, strlen((char*) name), &iov, 1);
+}
+
+// Check that the records of a bulk call, call_len bytes in total,
+// can all be queued. Under DSTC_QUEUE_EAGAIN, the records are queued
+// all or none. Returns 0, EAGAIN if they do not fit right now,
+// or EMSGSIZE if they would not fit even in an empty queue.
+static int dstc_bulk_has_room(uint32_t records, uint32_t call_len)
+{
+    if ((queue_max_packets && records > queue_max_packets) ||
+        (queue_max_bytes && call_len > queue_max_bytes))
+        return EMSGSIZE;
+
+    if (!dstc_queue_has_room(records, call_len))
+        dstc_purge_expired_pending();
+
+    if (!dstc_queue_has_room(records, call_len)) {
+        backlog.rejected++;
+        return EAGAIN;
+    }
+    return 0;
+}
+
+// Queue count calls, each with tuple_size bytes of serialized
+// arguments, as bulk records carrying the function name once.
+// Calls that do not fit in a single packet are split over several
+// records. Each record gets the deadline of the call, and the last
+// one reports to the completion callback.
+// Under DSTC_QUEUE_EAGAIN, either all records are queued or none.
+// Under the other policies, a record may still be rejected after
+// earlier ones have been queued, in which case the completion
+// callback gets the error that is returned.
+// Used by DSTC_CLIENT_BULK().
+int dstc_queue_func_bulk(uint8_t* name, const void* tuples, uint32_t tuple_size, uint32_t count)
 {
+    uint32_t name_len = strlen((char*) name);
+    uint32_t header_len = sizeof(dstc_header_t) + dstc_header_ext_len(~DSTC_FLAG_PRIO_MASK) + name_len;
+    uint32_t max_count = (header_len < RMC_MAX_PAYLOAD)?(RMC_MAX_PAYLOAD - header_len) / (tuple_size?tuple_size:1):0;
+    uint32_t records = max_count?(count + max_count - 1) / max_count:0;
+    struct client_func_t* client = dstc_find_client_func((char*) name);
+    usec_timestamp_t max_age = next_call_deadline;
+    void (*complete)(void*, int) = next_call_complete;
+    void* user_data = next_call_complete_user_data;
+    uint32_t queued = 0;
+    int res = 0;
+
+    // A scheduled call is a single timer, and must fit in a single record.
+    if (!tuple_size || !count || !max_count || (next_call_delay != -1 && count > max_count)) {
+        next_call_deadline = 0;
+        next_call_complete = 0;
+        next_call_delay = -1;
+        return (!tuple_size || !count)?EINVAL:EMSGSIZE;
+    }
+
     if (!initialized)
-        return 0;
+        dstc_setup();
 
-    return rmc_pub_node_id(&_dstc_pub_ctx);
+    // Parked calls are bounded by the max_parked of the function instead.
+    if (records > 1 && queue_policy == DSTC_QUEUE_EAGAIN &&
+        !(client && client->no_server == DSTC_NO_SERVER_PARK && !dstc_get_remote_count((char*) name)) &&
+        (res = dstc_bulk_has_room(records, records * header_len + count * tuple_size))) {
+        next_call_deadline = 0;
+        next_call_complete = 0;
+        return res;
+    }
+
+    while(count) {
+        uint32_t record_count = (count < max_count)?count:max_count;
+        struct iovec iov = { .iov_base = (void*) tuples, .iov_len = record_count * tuple_size };
+
+        count -= record_count;
+        next_call_deadline = max_age;
+        next_call_complete = count?0:complete;
+        next_call_complete_user_data = user_data;
+        next_call_bulk_count = record_count;
+        next_call_tuple_size = tuple_size;
+
+        if ((res = dstc_queue(name, name_len, &iov, 1))) {
+            // The records queued so far are on their way,
+            // and no one else will report to the callback.
+            if (queued)
+                dstc_report_completion(complete, user_data, res);
+            return res;
+        }
+
+        queued++;
+        tuples = (uint8_t*) tuples + record_count * tuple_size;
+    }
+    return 0;
 }
 
-int dstc_setup_epoll(int epoll_fd_arg)
+// Queue a call whose arguments are described by iovecs pointing
+// into the caller's memory. Used by DSTC_CLIENT_IOV().
+int dstc_queue_func_iov(uint8_t* name, struct iovec* arg_iov, int arg_iovcnt)
 {
-    return dstc_setup_internal(&_dstc_pub_ctx,
-                               &_dstc_sub_ctx,
-                               epoll_fd_arg,
-                               // user_data to be provided to poll_add, poll_modify, and poll_remove
-                               user_data_nil());
+    return dstc_queue(name, strlen((char*) name), arg_iov, arg_iovcnt);
 }
 
+// Schedule the next queued call instead of queuing it right away.
+// See DSTC_SCHEDULE()
+void dstc_set_next_call_schedule(usec_timestamp_t delay_usec,
+                                 usec_timestamp_t period_usec,
+                                 dstc_timer_id_t* timer_id)
+{
+    next_call_delay = (delay_usec < 0)?0:delay_usec;
+    next_call_period = (period_usec < 0)?0:period_usec;
+    next_call_timer_id = timer_id;
+}
 
-int dstc_setup(void)
+// Add a timer to the wheel level and slot covering its expiry tick,
+// which is never earlier than min_tick. Timers expire at the first
+// tick at or after expire_ts, so that they never fire early, and
+// calls scheduled back to back with the same delay share a tick.
+static void dstc_timer_insert(dstc_timer_t* timer, uint64_t min_tick)
 {
-    if (initialized)
-        return EBUSY;
+    uint64_t expire = (timer->expire_ts - timer_base_ts + DSTC_TIMER_TICK_USEC - 1) /
+        DSTC_TIMER_TICK_USEC;
+    int level = 0;
+    uint32_t slot = 0;
 
-    epoll_fd = epoll_create(1);
+    if (timer->expire_ts < timer_base_ts || expire < min_tick)
+        expire = min_tick;
 
-    return dstc_setup_epoll(epoll_fd);
+    timer->expire_tick = expire;
+
+    for(level = 0; level < TIMER_WHEEL_LEVELS; ++level)
+        if ((expire >> (level * TIMER_WHEEL_BITS)) -
+            (timer_tick >> (level * TIMER_WHEEL_BITS)) < TIMER_WHEEL_SLOTS)
+            break;
+
+    if (level == TIMER_WHEEL_LEVELS) {
+        // Beyond the range of the wheel. Park in the last slot of the
+        // top level, to be re-inserted when that slot is cascaded.
+        level = TIMER_WHEEL_LEVELS - 1;
+        slot = ((timer_tick >> (level * TIMER_WHEEL_BITS)) + TIMER_WHEEL_MASK) & TIMER_WHEEL_MASK;
+    } else
+        slot = (expire >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK;
+
+    timer->next = timer_wheel[level][slot];
+    timer->prev = &timer_wheel[level][slot];
+    if (timer->next)
+        timer->next->prev = &timer->next;
+    timer_wheel[level][slot] = timer;
 }
 
-uint32_t dstc_get_remote_count(char* function_name)
+// Remove a timer from its wheel slot.
+static void dstc_timer_unlink(dstc_timer_t* timer)
 {
-    struct remote_func_t* remote = dstc_find_remote_func(function_name);
+    *timer->prev = timer->next;
+    if (timer->next)
+        timer->next->prev = timer->prev;
 
-    // Is this an additional registration of an existing function.
-    if (!remote)
-        return 0;
-    
-    return remote->count;
+    timer->next = 0;
+    timer->prev = 0;
+}
+
+// Remove a timer from timer_index[] and free it.
+static void dstc_timer_free(dstc_timer_t* timer)
+{
+    dstc_timer_t** prev = &timer_index[timer->id % TIMER_INDEX_SIZE];
+
+    while(*prev != timer)
+        prev = &(*prev)->id_next;
+
+    *prev = timer->id_next;
+    timer_count--;
+    free(timer);
 }
 
-static void dstc_queue(uint8_t* name, uint8_t name_len, uint8_t* arg, uint32_t arg_sz)
+// Store a serialized call in a new timer.
+static int dstc_schedule_call(uint8_t* name, uint8_t name_len,
+                              struct iovec* arg_iov, int arg_iovcnt,
+                              usec_timestamp_t delay, usec_timestamp_t max_age,
+                              void (*complete)(void* user_data, int status),
+                              uint32_t bulk_count, uint32_t tuple_size, uint8_t aligned)
 {
-    // Will be freed by RMC on confirmed delivery
-    dstc_header_t *call = (dstc_header_t*) malloc(sizeof(dstc_header_t) + strlen(name) + arg_sz) ;
     uint16_t actual_name_len = name_len?name_len:sizeof(uint64_t);
+    uint32_t arg_sz = dstc_iov_len(arg_iov, arg_iovcnt);
+    dstc_timer_t* timer = (dstc_timer_t*) malloc(sizeof(dstc_timer_t) + actual_name_len + arg_sz);
+    usec_timestamp_t now = dstc_now();
+    uint8_t* data = timer->data;
+    int ind = 0;
 
-    // FIXME: Stuff multiple calls into a single packet.
-    //        Queue packet either at timeout (1-2 msec) or when packet is full (RMC_MAX_PAYLOAD)
-    //
     if (!initialized)
         dstc_setup();
 
-    call->name_len = name_len; // May be zero to indicate thtat this is an address.
-    call->payload_len = arg_sz + actual_name_len;
-    call->node_id = dstc_get_node_id();
+    if (!timer_count) {
+        timer_base_ts = now;
+        timer_tick = 0;
+    }
 
-    memcpy(call->payload, name, actual_name_len);
-    memcpy(call->payload + actual_name_len, arg, arg_sz);
+    timer->id = timer_next_id++;
+    if (!timer_next_id)
+        timer_next_id = 1;
+
+    timer->expire_ts = now + delay;
+    timer->period = next_call_period;
+    timer->max_age = max_age;
+    timer->complete = complete;
+    timer->complete_user_data = next_call_complete_user_data;
+    timer->cancelled = 0;
+    timer->name_len = name_len;
+    timer->bulk_count = bulk_count;
+    timer->tuple_size = tuple_size;
+    timer->aligned = aligned;
+    timer->arg_sz = arg_sz;
+
+    memcpy(data, name, actual_name_len);
+    data += actual_name_len;
+    for(ind = 0; ind < arg_iovcnt; ++ind) {
+        memcpy(data, arg_iov[ind].iov_base, arg_iov[ind].iov_len);
+        data += arg_iov[ind].iov_len;
+    }
 
-    RMC_LOG_DEBUG("DSTC Queue: node_id[%lu] name_len[%d/%d] name[%.*s] payload_len[%d]",
-                  call->node_id,
-                  call->name_len, actual_name_len,
-                  call->name_len?call->name_len:10,
-                  call->name_len?call->payload:((uint8_t*)"[callback]"),
-                  call->payload_len - actual_name_len);
-    rmc_pub_queue_packet(&_dstc_pub_ctx, call, sizeof(dstc_header_t) + actual_name_len + arg_sz, 0);
-    return;
+    if (next_call_timer_id)
+        *next_call_timer_id = timer->id;
+
+    next_call_period = 0;
+    next_call_timer_id = 0;
+
+    timer->id_next = timer_index[timer->id % TIMER_INDEX_SIZE];
+    timer_index[timer->id % TIMER_INDEX_SIZE] = timer;
+    timer_count++;
+    dstc_timer_insert(timer, timer_tick + 1);
+    return 0;
 }
 
+// Cancel a call scheduled with DSTC_SCHEDULE()
+// Returns ENOENT if there is no such timer.
+int dstc_cancel_timer(dstc_timer_id_t timer_id)
+{
+    dstc_timer_t* timer = timer_index[timer_id % TIMER_INDEX_SIZE];
+
+    while(timer && timer->id != timer_id)
+        timer = timer->id_next;
 
-void dstc_queue_callback(uint64_t addr, uint8_t* arg, uint32_t arg_sz)
+    if (!timer || timer->cancelled)
+        return ENOENT;
+
+    // Expired timers are freed by dstc_process_timers().
+    if (!timer->prev) {
+        timer->cancelled = 1;
+        return 0;
+    }
+
+    dstc_timer_unlink(timer);
+    dstc_timer_free(timer);
+    return 0;
+}
+
+// Monotonic timestamp of the earliest timer tick that needs processing.
+// The first non-empty slot of each level holds its earliest timers.
+static usec_timestamp_t dstc_timer_timeout(void)
 {
-    // Call with zero namelen to treat name as a 64bit integer.
-    // This integer will be mapped by the received through the local_callback
-    // table to a pending callback function.
-    dstc_queue((uint8_t*) &addr, 0, arg, arg_sz);
+    uint64_t next_tick = UINT64_MAX;
+    int level = 0;
+
+    if (!timer_count || timers_in_progress)
+        return -1;
+
+    for(level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+        uint64_t level_tick = timer_tick >> (level * TIMER_WHEEL_BITS);
+        uint32_t ind = 0;
+
+        for(ind = 1; ind < TIMER_WHEEL_SLOTS; ++ind) {
+            dstc_timer_t* timer = timer_wheel[level][(level_tick + ind) & TIMER_WHEEL_MASK];
+
+            if (!timer)
+                continue;
+
+            for(; timer; timer = timer->next)
+                if (timer->expire_tick < next_tick)
+                    next_tick = timer->expire_tick;
+            break;
+        }
+    }
+
+    if (next_tick == UINT64_MAX)
+        return -1;
+
+    return timer_base_ts + next_tick * DSTC_TIMER_TICK_USEC;
+}
+
+// The next tick, no later than now_tick, at which a level 0 slot
+// expires or a higher level slot is cascaded. Ticks in between have
+// nothing to process.
+static uint64_t dstc_timer_next_tick(uint64_t now_tick)
+{
+    uint64_t next_tick = now_tick;
+    int level = 0;
+    uint32_t ind = 0;
+
+    for(ind = 1; ind < TIMER_WHEEL_SLOTS && timer_tick + ind < next_tick; ++ind)
+        if (timer_wheel[0][(timer_tick + ind) & TIMER_WHEEL_MASK]) {
+            next_tick = timer_tick + ind;
+            break;
+        }
+
+    for(level = 1; level < TIMER_WHEEL_LEVELS; ++level) {
+        uint64_t level_tick = timer_tick >> (level * TIMER_WHEEL_BITS);
+
+        for(ind = 1; ind <= TIMER_WHEEL_SLOTS; ++ind) {
+            uint64_t tick = (level_tick + ind) << (level * TIMER_WHEEL_BITS);
+
+            if (tick >= next_tick)
+                break;
+
+            if (timer_wheel[level][(level_tick + ind) & TIMER_WHEEL_MASK]) {
+                next_tick = tick;
+                break;
+            }
+        }
+    }
+
+    return next_tick;
+}
+
+// Does timer a expire before timer b? Timers with the same expiry
+// are ordered by id, which is the order they were scheduled in.
+static int dstc_timer_before(dstc_timer_t* a, dstc_timer_t* b)
+{
+    if (a->expire_ts != b->expire_ts)
+        return a->expire_ts < b->expire_ts;
+
+    return a->id < b->id;
+}
+
+// Merge sort a list of timers into expiry order.
+static dstc_timer_t* dstc_timer_sort(dstc_timer_t* list)
+{
+    dstc_timer_t* half = list;
+    dstc_timer_t* end = list;
+    dstc_timer_t* sorted = 0;
+    dstc_timer_t** tail = &sorted;
+
+    if (!list || !list->next)
+        return list;
+
+    // Split in two halves.
+    while(end->next && end->next->next) {
+        half = half->next;
+        end = end->next->next;
+    }
+    end = half->next;
+    half->next = 0;
+
+    list = dstc_timer_sort(list);
+    end = dstc_timer_sort(end);
+
+    while(list && end) {
+        dstc_timer_t** first = dstc_timer_before(end, list)?&end:&list;
+
+        *tail = *first;
+        tail = &(*first)->next;
+        *first = (*first)->next;
+    }
+
+    *tail = list?list:end;
+    return sorted;
+}
+
+// Advance the wheel to now_tick, moving all expired timers to the
+// tail of timers_fired, a tick at a time and in expiry order within
+// each tick, so that their calls are made in the order they expire.
+// Ticks without expiring or cascading slots are skipped.
+static void dstc_timer_advance(uint64_t now_tick)
+{
+    while(timer_tick < now_tick) {
+        dstc_timer_t* expired = 0;
+        int level = 0;
+        uint32_t slot = 0;
+
+        timer_tick = dstc_timer_next_tick(now_tick);
+
+        // Cascade higher levels first, since their timers
+        // may end up in the slots cascaded below them.
+        for(level = TIMER_WHEEL_LEVELS - 1; level > 0; --level) {
+            dstc_timer_t* timer = 0;
+
+            if (timer_tick & ((1ULL << (level * TIMER_WHEEL_BITS)) - 1))
+                continue;
+
+            slot = (timer_tick >> (level * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK;
+            timer = timer_wheel[level][slot];
+            timer_wheel[level][slot] = 0;
+
+            while(timer) {
+                dstc_timer_t* next = timer->next;
+
+                dstc_timer_insert(timer, timer_tick);
+                timer = next;
+            }
+        }
+
+        slot = timer_tick & TIMER_WHEEL_MASK;
+        expired = 0;
+        while(timer_wheel[0][slot]) {
+            dstc_timer_t* timer = timer_wheel[0][slot];
+
+            dstc_timer_unlink(timer);
+            timer->next = expired;
+            expired = timer;
+        }
+
+        *timers_fired_tail = dstc_timer_sort(expired);
+        while(*timers_fired_tail)
+            timers_fired_tail = &(*timers_fired_tail)->next;
+    }
+}
+
+// Queue the call of an expired timer.
+static void dstc_fire_timer(dstc_timer_t* timer)
+{
+    uint16_t actual_name_len = timer->name_len?timer->name_len:sizeof(uint64_t);
+    struct iovec iov = { .iov_base = timer->data + actual_name_len, .iov_len = timer->arg_sz };
+
+    next_call_deadline = timer->max_age;
+    next_call_complete = timer->complete;
+    next_call_complete_user_data = timer->complete_user_data;
+    next_call_bulk_count = timer->bulk_count;
+    next_call_tuple_size = timer->tuple_size;
+    next_call_aligned = timer->aligned;
+
+    coalesce_calls = 1;
+    dstc_queue(timer->data, timer->name_len, &iov, 1);
+    coalesce_calls = 0;
+}
+
+// Return the packet being filled with calls fired at the current
+// tick, with room for call_len more bytes. A full packet is staged
+// and replaced by a new one.
+static dstc_header_t* dstc_coalesce_reserve(uint8_t prio, uint32_t call_len)
+{
+    pending_call_t* pend = coalesced[prio];
+    dstc_header_t* call = 0;
+
+    if (pend && pend->call_len + call_len > RMC_MAX_PAYLOAD) {
+        dstc_pending_enqueue(prio, pend);
+        pend = 0;
+    }
+
+    if (!pend) {
+        // Trimmed to size by dstc_flush_coalesced()
+        pend = (pending_call_t*) malloc(sizeof(pending_call_t) + RMC_MAX_PAYLOAD);
+        pend->complete = 0;
+        pend->complete_user_data = 0;
+        pend->status = 0;
+        pend->call_count = 0;
+        pend->call_len = 0;
+        pend->deadline = 0;
+        pend->queued_ts = dstc_now();
+        coalesced[prio] = pend;
+    }
+
+    call = (dstc_header_t*) (pend->call + pend->call_len);
+    pend->call_len += call_len;
+    pend->call_count++;
+    return call;
+}
+
+// Stage the packets filled by dstc_coalesce_reserve()
+static void dstc_flush_coalesced(void)
+{
+    int prio = 0;
+
+    for(prio = 0; prio < DSTC_PRIO_COUNT; ++prio) {
+        pending_call_t* pend = coalesced[prio];
+        pending_call_t* trimmed = 0;
+
+        if (!pend)
+            continue;
+
+        coalesced[prio] = 0;
+
+        // Trim to size. Keep the full size buffer if that fails.
+        trimmed = realloc(pend, sizeof(pending_call_t) + pend->call_len);
+        dstc_pending_enqueue(prio, trimmed?trimmed:pend);
+    }
 }
 
-void dstc_queue_func(uint8_t* name, uint8_t* arg, uint32_t arg_sz)
+// Queue the calls of all expired timers, re-arming periodic ones.
+// Calls expiring in the same tick are sent in as few packets as possible.
+static void dstc_process_timers(void)
 {
-    dstc_queue(name, strlen(name), arg, arg_sz);
+    usec_timestamp_t now = 0;
+
+    // A blocked dstc_queue() runs the event loop. Leave timers to the
+    // outer invocation.
+    if (timers_in_progress || !initialized)
+        return;
+
+    now = dstc_now();
+    if (!timer_count) {
+        timer_base_ts = now;
+        timer_tick = 0;
+        return;
+    }
+
+    dstc_timer_advance((now - timer_base_ts) / DSTC_TIMER_TICK_USEC);
+    if (!timers_fired)
+        return;
+
+    timers_in_progress = 1;
+    while(timers_fired) {
+        dstc_timer_t* timer = timers_fired;
+
+        if (!timer->cancelled)
+            dstc_fire_timer(timer);
+
+        timers_fired = timer->next;
+        if (!timers_fired)
+            timers_fired_tail = &timers_fired;
+
+        if (!timer->period || timer->cancelled) {
+            dstc_timer_free(timer);
+            continue;
+        }
+
+        // Keep the phase of the period, skipping any periods we have missed.
+        timer->expire_ts += timer->period;
+        if (timer->expire_ts <= now)
+            timer->expire_ts += ((now - timer->expire_ts) / timer->period + 1) * timer->period;
+
+        dstc_timer_insert(timer, timer_tick + 1);
+    }
+
+    dstc_flush_coalesced();
+    timers_in_progress = 0;
+    dstc_drain_pending();
 }
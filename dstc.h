@@ -9,8 +9,11 @@
 #ifndef __DSTC_H__
 #define __DSTC_H__
 #include <stdint.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/uio.h>
 #include "reliable_multicast/reliable_multicast.h"
 
 
@@ -19,9 +22,259 @@ dstc_header {
     uint16_t payload_len;          // 2 bytes 
     rmc_node_id_t node_id;         // 4 bytes  Publisher Node ID
     uint8_t name_len;              // 1 byte of name length. 0 = callback address
+    uint8_t flags;                 // 1 byte of DSTC_FLAG_XXX bits. See below.
+                                   // Not present in releases before priority classes,
+                                   // which misread calls that have it.
     uint8_t payload[];             // Function name followed by function args.
 } dstc_header_t;
 
+// Bits 0-1 of dstc_header_t::flags carry the priority class of the call.
+#define DSTC_FLAG_PRIO_MASK 0x03
+
+// The remaining flag bits mark header extensions. Extensions are
+// stored in flag bit order at the start of payload, ahead of the
+// function name, and are included in payload_len.
+
+// 8 byte deadline, in usec since epoch (CLOCK_REALTIME).
+// A call past its deadline is dropped instead of being sent or executed.
+#define DSTC_FLAG_DEADLINE  0x04
+
+// 8 byte conflation key hash, followed by the 4 byte offset and 4 byte
+// length of the key in the arguments. Only the newest call with a given
+// function name and key needs to be sent and executed.
+#define DSTC_FLAG_CONFLATE  0x08
+
+// 4 byte sequence number of the arguments, followed by the 4 byte
+// sequence number of the earlier arguments they are delta encoded
+// against. A base of 0 marks a keyframe carrying the full arguments.
+// See dstc_set_client_delta().
+#define DSTC_FLAG_DELTA     0x10
+
+// 4 byte tuple count followed by 4 byte tuple size. The arguments are
+// count tuples, each holding the serialized arguments of one call.
+// See DSTC_CLIENT_BULK().
+#define DSTC_FLAG_BULK      0x20
+
+// 8 byte timestamp of the client call, followed by the 8 byte timestamp
+// of when it was handed to the transport, both in usec on the sender's
+// monotonic clock. See dstc_set_client_latency().
+#define DSTC_FLAG_LATENCY   0x40
+
+// 1 byte count of pad bytes between the function name and the
+// arguments, which aligns the arguments to DSTC_ARRAY_ALIGN bytes
+// from the start of the packet. See DECL_DYNAMIC_ARRAY().
+#define DSTC_FLAG_ALIGNED   0x80
+
+// Priority classes.
+// Outbound calls are staged in one queue per class and handed to RMC
+// in priority order. Inbound calls that are ready at the same time are
+// dispatched highest class first.
+#define DSTC_PRIO_HIGH    0
+#define DSTC_PRIO_NORMAL  1 // Default
+#define DSTC_PRIO_BULK    2
+#define DSTC_PRIO_COUNT   3
+
+// Order in which the outbound priority queues are drained into RMC.
+// STRICT always drains the highest non-empty class first.
+// WEIGHTED drains up to weight[prio] calls per class and round.
+#define DSTC_DRAIN_STRICT   0
+#define DSTC_DRAIN_WEIGHTED 1
+
+// Per priority class counters, retrieved with dstc_get_priority_stats().
+typedef struct {
+    uint64_t queued;                       // Outbound calls queued
+    uint64_t sent;                         // Outbound calls handed to RMC
+    usec_timestamp_t queue_usec_total;     // Time spent staged before handed to RMC
+    usec_timestamp_t queue_usec_max;
+    uint64_t dispatched;                   // Inbound calls executed
+    usec_timestamp_t dispatch_usec_total;  // Time from packet ready to call execution
+    usec_timestamp_t dispatch_usec_max;
+} dstc_priority_stats_t;
+
+// Latency histogram. buckets[0] counts latencies below 1 usec,
+// and buckets[n] those from 2^(n-1) up to 2^n usec. The last
+// bucket also counts everything above it.
+#define DSTC_LATENCY_BUCKETS 32
+
+typedef struct {
+    uint64_t count;
+    usec_timestamp_t usec_total;
+    usec_timestamp_t usec_max;
+    uint64_t buckets[DSTC_LATENCY_BUCKETS];
+} dstc_latency_histogram_t;
+
+// Per function latency of received calls, from the client call on the
+// sending node until the server function ran on this node.
+// Retrieved with dstc_get_latency_stats().
+typedef struct {
+    dstc_latency_histogram_t queue;      // Call until handed to the transport by the sender
+    dstc_latency_histogram_t transit;    // Lowest recent network delay seen from the sender
+    dstc_latency_histogram_t retransmit; // Network delay above the lowest, from loss and reordering
+    dstc_latency_histogram_t dispatch;   // Received until the server function ran
+    dstc_latency_histogram_t total;      // Call until the server function ran
+} dstc_latency_stats_t;
+
+// What a client call does when the outbound queue limit,
+// set by dstc_set_queue_limit(), has been reached.
+#define DSTC_QUEUE_BLOCK       0 // Process events until there is room. (Default)
+#define DSTC_QUEUE_EAGAIN      1 // Return EAGAIN without queuing the call.
+#define DSTC_QUEUE_DROP_OLDEST 2 // Drop oldest staged call. EAGAIN if none is staged.
+
+// Outbound backlog, retrieved with dstc_get_queue_backlog().
+// Staged calls have not yet been handed to RMC. In flight calls
+// have been handed to RMC but not yet confirmed as delivered.
+typedef struct {
+    uint32_t staged_packets;
+    uint32_t staged_bytes;
+    uint32_t in_flight_packets;
+    uint32_t in_flight_bytes;
+    uint64_t rejected;         // Calls refused with EAGAIN
+    uint64_t dropped;          // Staged calls dropped by DSTC_QUEUE_DROP_OLDEST
+} dstc_queue_backlog_t;
+
+// What a client call does when no remote node serves the function.
+// Set per function with dstc_set_client_no_server_policy().
+#define DSTC_NO_SERVER_SEND 0 // Send the call anyway. (Default)
+#define DSTC_NO_SERVER_DROP 1 // Return ENOENT without sending the call.
+#define DSTC_NO_SERVER_PARK 2 // Hold the call until the first server registers.
+
+// Calls made to functions without remote servers.
+// Retrieved with dstc_get_no_server_stats().
+typedef struct {
+    uint64_t dropped;          // Refused by DSTC_NO_SERVER_DROP
+    uint64_t parked;           // Held by DSTC_NO_SERVER_PARK
+    uint64_t park_overflow;    // Oldest parked calls dropped to make room for new ones
+    uint64_t flushed;          // Parked calls sent once a server registered
+} dstc_no_server_stats_t;
+
+// How calls to a function are cached for nodes that connect later.
+// Set per function with dstc_set_client_cache().
+#define DSTC_CACHE_NONE    0 // (Default)
+#define DSTC_CACHE_LAST    1 // Keep the last max_calls calls.
+#define DSTC_CACHE_PER_KEY 2 // Keep the last call for each of up to max_calls keys.
+
+// Late joiner cache. Retrieved with dstc_get_cache_stats().
+typedef struct {
+    uint64_t cached;           // Calls added to the cache
+    uint64_t replaced;         // Replaced by a newer call with the same key
+    uint64_t evicted;          // Dropped to stay within max_calls or the byte limit
+    uint64_t replays;          // Nodes the cache has been replayed to
+    uint64_t replayed_calls;   // Calls sent by replays
+    uint64_t replays_inbound;  // Replay messages received from other nodes
+    uint32_t entries;          // Calls currently cached
+    uint32_t bytes;            // Memory used by cached calls
+} dstc_cache_stats_t;
+
+// How the sockets of the RMC transport are registered with epoll.
+// Set with dstc_set_epoll_mode() before dstc_setup().
+#define DSTC_EPOLL_LEVEL     0 // Level triggered. Interest changes are batched. (Default)
+#define DSTC_EPOLL_EDGE      1 // Edge triggered. Registered once and drained until EAGAIN.
+#define DSTC_EPOLL_IMMEDIATE 2 // Level triggered. One epoll_ctl() per interest change.
+
+// epoll system calls made by the RMC transport.
+// Retrieved with dstc_get_epoll_stats().
+typedef struct {
+    uint64_t waits;            // epoll_wait()
+    uint64_t ctls;             // epoll_ctl()
+    uint64_t interest_changes; // Read and write interest changes requested by RMC
+    uint64_t edge_reads;       // Reads made while draining an edge triggered socket
+} dstc_epoll_stats_t;
+
+// Time the staged calls were held back by send pacing.
+// Retrieved with dstc_get_pacing_stats().
+typedef struct {
+    uint64_t waits;            // Times a staged call had to wait for the rate limit
+    uint64_t wait_usec_total;  // Time spent waiting
+    uint64_t wait_usec_max;
+    uint64_t sent_packets;     // Packets handed to the transport while paced
+    uint64_t sent_bytes;
+} dstc_pacing_stats_t;
+
+// Calls handed over to servers on the same host as sealed memfds.
+// Retrieved with dstc_get_memfd_stats().
+typedef struct {
+    uint64_t sent;             // Calls handed over
+    uint64_t sent_bytes;       // Argument bytes of those calls
+    uint64_t partial;          // Calls handed over to some, but not all, servers
+    uint64_t received;         // Calls received and executed
+    uint64_t rejected;         // Received memfds that were not sealed or could not be mapped
+    uint32_t local_peers;      // Nodes reachable through their local socket
+} dstc_memfd_stats_t;
+
+// Calls dropped since they were past their deadline.
+// Retrieved with dstc_get_deadline_stats().
+typedef struct {
+    uint64_t expired_staged;   // Dropped by the sender before handed to RMC
+    uint64_t expired_inbound;  // Dropped by the receiver before execution
+} dstc_deadline_stats_t;
+
+// Calls replaced by a newer call with the same function name and
+// conflation key. Retrieved with dstc_get_conflation_stats().
+typedef struct {
+    uint64_t conflated_staged;  // Replaced by the sender before handed to RMC
+    uint64_t conflated_inbound; // Skipped by the receiver before execution
+} dstc_conflation_stats_t;
+
+// Delta encoded calls. Retrieved with dstc_get_delta_stats().
+typedef struct {
+    uint64_t keyframes;         // Calls sent with full arguments
+    uint64_t deltas;            // Calls sent delta encoded
+    uint64_t arg_bytes;         // Argument bytes before encoding
+    uint64_t encoded_bytes;     // Argument bytes sent
+    uint64_t decoded_inbound;   // Delta encoded calls rebuilt by the receiver
+    uint64_t missed_inbound;    // Dropped by the receiver, waiting for a keyframe
+} dstc_delta_stats_t;
+
+// Reply to a collective call, holding the serialized arguments the
+// server passed to its callback. See CLIENT_GATHER_ARG().
+typedef struct {
+    rmc_node_id_t node_id;
+    uint32_t length;
+    uint8_t* data;
+} dstc_gather_reply_t;
+
+// Replies collected by a collective call, handed to its completion
+// function. Owned by DSTC, and freed once the completion function returns.
+typedef struct {
+    int status;                   // 0 = All servers replied. ETIME = Deadline passed first. ENOENT = No servers
+    uint32_t expected;            // Servers of the function when the call was made
+    uint32_t count;               // Servers that replied
+    dstc_gather_reply_t* replies;
+} dstc_gather_result_t;
+
+// Collective calls. Retrieved with dstc_get_gather_stats().
+typedef struct {
+    uint64_t started;          // Collective calls made
+    uint64_t completed;        // Completed with a reply from all servers
+    uint64_t expired;          // Completed by their deadline, or since the call failed
+    uint64_t replies;          // Replies collected
+    uint64_t late_replies;     // Replies to collective calls that had already completed
+    uint64_t unexpected_replies; // Replies from nodes that were not servers when the call was made
+} dstc_gather_stats_t;
+
+// Have a single client call report its outcome to _complete(_user_data, status)
+// DSTC_ON_COMPLETE(upload_done, buf, dstc_upload(DYNAMIC_ARG(buf, len)));
+#define DSTC_ON_COMPLETE(_complete, _user_data, _call) \
+    ({ dstc_set_next_call_completion(_complete, _user_data); _call; })
+
+// Make a single client call with a deadline of _usec microseconds from now.
+// DSTC_DEADLINE(500000, dstc_set_speed(42));
+#define DSTC_DEADLINE(_usec, _call) ({ dstc_set_next_call_deadline(_usec); _call; })
+
+// Identifies a call scheduled with DSTC_SCHEDULE(). 0 = No timer.
+typedef uint32_t dstc_timer_id_t;
+
+// Resolution of the timer wheel driving scheduled calls.
+// Calls due in the same tick are sent in a single packet.
+#define DSTC_TIMER_TICK_USEC 1000
+
+// Make a client call _delay usec from now and, if _period is non-zero,
+// every _period usec after that until cancelled by dstc_cancel_timer().
+// The timer id is stored in *_timer_id, unless _timer_id is 0.
+// DSTC_SCHEDULE(0, 10000, &speed_timer, dstc_set_speed(42));
+#define DSTC_SCHEDULE(_delay, _period, _timer_id, _call) \
+    ({ dstc_set_next_call_schedule(_delay, _period, _timer_id); _call; })
+
 extern uint32_t dstc_get_socket_count(void);
 extern int dstc_get_next_timeout(usec_timestamp_t* result_ts);
 extern int dstc_setup(void);
@@ -30,11 +283,140 @@ extern int dstc_process_events(usec_timestamp_t timeout);
 extern void dstc_process_timeout(void);
 extern int dstc_get_timeout_msec(void);
 extern uint32_t dstc_get_remote_count(char* function_name);
+extern int dstc_wait_for_remote(char* function_name, usec_timestamp_t timeout);
+
+// Used by DSTC_CLIENT(), DSTC_CALLBACK(), and language bindings
+// such as dstc.hpp to queue serialized calls.
+extern int dstc_queue_func(uint8_t* name, uint8_t* arg_buf, uint32_t arg_sz);
+extern int dstc_queue_callback(uint64_t addr, uint8_t* arg_buf, uint32_t arg_sz);
+extern int dstc_queue_func_iov(uint8_t* name, struct iovec* arg_iov, int arg_iovcnt);
+extern int dstc_queue_func_bulk(uint8_t* name, const void* tuples, uint32_t tuple_size, uint32_t count);
+extern void dstc_set_next_call_completion(void (*complete)(void* user_data, int status),
+                                          void* user_data);
+extern void dstc_set_next_call_aligned(void);
+extern void dstc_register_local_function_ctx(char* name,
+                                             void (*server_func)(void* ctx, rmc_node_id_t node_id, uint8_t*),
+                                             void* ctx);
+extern uint64_t dstc_register_callback_ctx(void (*callback)(void* ctx, rmc_node_id_t node_id, uint8_t*),
+                                           void* ctx);
+extern void* dstc_cancel_callback_ctx(uint64_t func_addr);
+extern void dstc_set_announce_schedule(usec_timestamp_t burst_interval,
+                                       uint32_t burst_count,
+                                       usec_timestamp_t steady_interval);
+extern void dstc_set_remote_function_callback(void (*callback)(char* function_name,
+                                                               uint32_t remote_count));
 extern usec_timestamp_t dstc_get_timeout_timestamp(void);
 struct epoll_event;
 extern int dstc_process_single_event(int timeout);
+extern int dstc_set_epoll_mode(uint8_t mode);
+extern void dstc_set_client_latency(char* function_name, uint8_t enabled);
+extern void dstc_set_node_clock_offset(rmc_node_id_t node_id, usec_timestamp_t offset_usec);
+extern int dstc_get_latency_stats(char* function_name, dstc_latency_stats_t* stats);
+extern void dstc_reset_latency_stats(void);
+extern void dstc_get_epoll_stats(dstc_epoll_stats_t* stats);
+extern void dstc_set_memfd_threshold(uint32_t threshold_bytes);
+extern void dstc_get_memfd_stats(dstc_memfd_stats_t* stats);
 extern void dstc_process_epoll_result(struct epoll_event* event);
 extern rmc_node_id_t dstc_get_node_id(void);
+extern int dstc_set_client_priority(char* function_name, uint8_t priority);
+extern int dstc_set_drain_mode(uint8_t mode, uint32_t weights[DSTC_PRIO_COUNT]);
+extern void dstc_set_max_in_flight(uint32_t max_packets);
+extern void dstc_set_pacing(uint64_t bytes_per_sec, uint32_t packets_per_sec,
+                            uint32_t burst_bytes, uint32_t burst_packets);
+extern void dstc_get_pacing_stats(dstc_pacing_stats_t* stats);
+extern uint64_t dstc_register_gather(void (*reduce)(void* user_data, rmc_node_id_t node_id, uint8_t* reply),
+                                     void (*complete)(void* user_data, dstc_gather_result_t* result),
+                                     void* user_data,
+                                     usec_timestamp_t timeout_usec);
+extern void dstc_get_gather_stats(dstc_gather_stats_t* stats);
+extern int dstc_get_priority_stats(uint8_t priority, dstc_priority_stats_t* stats);
+extern void dstc_reset_priority_stats(void);
+extern void dstc_set_queue_limit(uint32_t max_bytes, uint32_t max_packets, uint8_t policy);
+extern void dstc_get_queue_backlog(dstc_queue_backlog_t* backlog);
+extern void dstc_set_queue_drained_callback(uint32_t low_watermark_bytes,
+                                            void (*callback)(dstc_queue_backlog_t* backlog));
+extern void dstc_set_client_deadline(char* function_name, usec_timestamp_t max_age_usec);
+extern void dstc_set_next_call_deadline(usec_timestamp_t max_age_usec);
+extern void dstc_get_deadline_stats(dstc_deadline_stats_t* stats);
+extern void dstc_set_client_conflation(char* function_name, uint32_t key_offset, uint32_t key_len);
+extern void dstc_get_conflation_stats(dstc_conflation_stats_t* stats);
+extern void dstc_set_client_delta(char* function_name, uint32_t keyframe_interval);
+extern void dstc_get_delta_stats(dstc_delta_stats_t* stats);
+extern int dstc_set_client_no_server_policy(char* function_name, uint8_t policy, uint32_t max_parked);
+extern void dstc_get_no_server_stats(dstc_no_server_stats_t* stats);
+extern int dstc_set_client_cache(char* function_name, uint8_t mode, uint32_t max_calls,
+                                 uint32_t key_offset, uint32_t key_len);
+extern void dstc_set_cache_limit(uint32_t max_bytes);
+extern void dstc_get_cache_stats(dstc_cache_stats_t* stats);
+extern void dstc_set_next_call_schedule(usec_timestamp_t delay_usec,
+                                        usec_timestamp_t period_usec,
+                                        dstc_timer_id_t* timer_id);
+extern int dstc_cancel_timer(dstc_timer_id_t timer_id);
+extern usec_timestamp_t dstc_usec_monotonic_timestamp(void);
+
+// Transport carrying calls and function announcements between nodes.
+// The default transport is reliable multicast (RMC) over UDP, with
+// epoll driven sockets. Another transport, such as the in-memory
+// simulator in dstc_sim.h, is installed with dstc_set_transport()
+// before dstc_setup() is called.
+//
+// The transport reports back to DSTC through the dstc_transport_xxx()
+// functions below.
+typedef struct dstc_transport {
+    // Set up the transport. epoll_fd is -1 if the transport
+    // is not driven by epoll.
+    int (*setup)(int epoll_fd);
+
+    // Node id of this node.
+    rmc_node_id_t (*node_id)(void);
+
+    // Monotonic clock used for all DSTC timers and stats.
+    usec_timestamp_t (*now)(void);
+
+    // Wait up to timeout msec (-1 = forever) for events and process them.
+    // Returns ETIME if no events were processed.
+    int (*process_events)(int timeout);
+
+    // Absolute timestamp of the next transport timeout, or -1 for none.
+    usec_timestamp_t (*get_next_timeout)(void);
+    void (*process_timeout)(void);
+    uint32_t (*get_socket_count)(void);
+
+    // Publish a packet to all subscribing nodes. The transport owns
+    // payload until it reports delivery through
+    // dstc_transport_packet_delivered()
+    int (*queue_packet)(void* payload, payload_len_t payload_len);
+
+    // Send the null terminated names of functions served by
+    // this node, or calls replayed from its cache, to the publisher node_id.
+    int (*write_control_message)(rmc_node_id_t node_id, void* payload, payload_len_t payload_len);
+
+    // Interval between discovery announcements of this node.
+    void (*set_announce_interval)(usec_timestamp_t interval);
+
+    // Return the next received packet ready for dispatch, or 0 if
+    // there are none. The payload is allocated with
+    // dstc_transport_alloc_payload(), and the caller takes over
+    // one reference to it.
+    void* (*next_packet)(payload_len_t* payload_len);
+} dstc_transport_t;
+
+extern int dstc_set_transport(const dstc_transport_t* transport);
+
+// Called by the transport.
+extern void* dstc_transport_alloc_payload(payload_len_t payload_len);
+extern void dstc_transport_retain_payload(void* payload);
+extern void dstc_transport_release_payload(void* payload);
+extern void dstc_transport_packets_ready(void);
+extern void dstc_transport_packet_delivered(void* payload);
+extern void dstc_transport_node_subscribed(rmc_node_id_t node_id);
+extern void dstc_transport_control_message(rmc_node_id_t node_id,
+                                           void* payload,
+                                           payload_len_t payload_len);
+
+// Number of calls carried by a call record of a packet. The tuple
+// count of a bulk record, and 1 for all other records.
+extern uint32_t dstc_call_count(dstc_header_t* call);
 
 // FIXME: ADD DOCUMENTATION
 typedef struct {
@@ -47,18 +429,71 @@ typedef struct {
 #define DECL_DYNAMIC_ARG DSTC,
 
 // Tag for dynamic data magic cookie: "DSTC" = 0x44535443
-// Used by DESERIALIZE_ARGUMENT and SERIALIZE_ARGUMENT
-// to detect dynamic data arguments
-//#define DSTC_DYNARG_TAG 0x43545344
+// Dynamic data arguments are detected by their DSTC type at
+// compile time. See _DSTC_IS_DYNAMIC()
 #define DSTC_DYNARG_TAG 0x43545344
 
 // Define an alias type that matches the magic cookie.
 typedef dstc_dynamic_data_t DSTC;
 
+// Declare a struct argument that DSTC_SERVER_REF() passes to the
+// server function as a const pointer into the received packet.
+// Has the same wire format as a regular "struct name, " declaration.
+#define DECL_REF_ARG(type) type, [1]
+
 // Use dynamic arguments as:
 // dstc_send_variable_len(DYNARG("Hello world", 11))
 #define DYNAMIC_ARG(_data, _length) ({ DSTC d = { .length = _length, .data = _data }; d; })
 
+//
+// Typed dynamic arrays.
+//
+// A dynamic argument carrying count elements of a numeric type.
+// The elements are padded so that they start at a DSTC_ARRAY_ALIGN
+// byte boundary in the receive buffer, and the server function gets
+// a typed, aligned pointer to them that it can hand to vector code.
+//
+//   DSTC_CLIENT(scale, DECL_DYNAMIC_ARRAY(float), float,)
+//   dstc_scale(DYNAMIC_ARRAY(float, samples, 1024), 0.5);
+//
+//   DSTC_SERVER(scale, DECL_DYNAMIC_ARRAY(float), float,)
+//   void scale(dstc_array_float samples, float factor)
+//   {
+//       float* s = __builtin_assume_aligned(samples.data, DSTC_ARRAY_ALIGN);
+//       ...
+//   }
+//
+// The elements are sent in host byte order.
+//
+#define DSTC_ARRAY_ALIGN 64
+
+// Same layout as dstc_dynamic_data_t, with count in elements.
+#define _DSTC_DECLARE_ARRAY_TYPE(type)                                  \
+    typedef struct {                                                    \
+        uint32_t count;                                                 \
+        type* data;                                                     \
+    } dstc_array_##type;
+
+_DSTC_DECLARE_ARRAY_TYPE(float)
+_DSTC_DECLARE_ARRAY_TYPE(double)
+_DSTC_DECLARE_ARRAY_TYPE(int8_t)
+_DSTC_DECLARE_ARRAY_TYPE(uint8_t)
+_DSTC_DECLARE_ARRAY_TYPE(int16_t)
+_DSTC_DECLARE_ARRAY_TYPE(uint16_t)
+_DSTC_DECLARE_ARRAY_TYPE(int32_t)
+_DSTC_DECLARE_ARRAY_TYPE(uint32_t)
+_DSTC_DECLARE_ARRAY_TYPE(int64_t)
+_DSTC_DECLARE_ARRAY_TYPE(uint64_t)
+
+// Setup a simple macro so that we don't need an extra comma
+// when we use DECL_DYNAMIC_ARRAY in DSTC_CLIENT and DSTC_SERVER lines.
+#define DECL_DYNAMIC_ARRAY(type) dstc_array_##type,
+
+// Use typed dynamic arrays as:
+// dstc_scale(DYNAMIC_ARRAY(float, samples, 1024), 0.5)
+#define DYNAMIC_ARRAY(type, _data, _count) \
+    ({ dstc_array_##type a = { .count = _count, .data = _data }; a; })
+
 
 //
 // Callback functions.
@@ -69,8 +504,8 @@ typedef dstc_dynamic_data_t DSTC;
 //
 
 // Tag for function pointer argument. "CBCK" = 0x4342434B
-// Used by DESERIALIZE_ARGUMENT and SERIALIZE_ARGUMENT
-// to detect callback function arguments
+// Callback arguments are serialized as their fixed size
+// dstc_callback_t, like any other struct.
 //
 #define DSTC_CALLBACK_TAG 0x4B434243
 
@@ -108,6 +543,54 @@ typedef dstc_callback_t CBCK;
     callback;                                     \
 })
 
+//
+// Collective calls.
+//
+// A callback argument that collects the replies of all servers of
+// the called function, instead of only the first one. The call is
+// multicast once, and _complete(_user_data, result) is invoked with
+// all replies once every server has replied, or _timeout_usec has
+// passed. A _timeout_usec of 0 uses DSTC_GATHER_TIMEOUT_USEC.
+// The servers reply through their callback argument as usual.
+//
+//   void temp_done(void* user_data, dstc_gather_result_t* result) { ... }
+//
+//   DSTC_CLIENT(get_temp, int,, DECL_CALLBACK_ARG)
+//   dstc_get_temp(0, CLIENT_GATHER_ARG(temp_done, 0, 100000));
+//
+// Timeout of a collective call made with a _timeout_usec of 0.
+// Servers that go away are not detected, so every call has one.
+#define DSTC_GATHER_TIMEOUT_USEC 10000000
+
+#define CLIENT_GATHER_ARG(_complete, _user_data, _timeout_usec) ({       \
+    CBCK callback = {                                                   \
+        .func_addr = dstc_register_gather(0, _complete, _user_data, _timeout_usec) \
+    };                                                                  \
+    callback;                                                           \
+    })
+
+// As CLIENT_GATHER_ARG(), but also hands each reply, as it arrives, to
+// _reduce(_user_data, node_id, ...) with the arguments of the reply.
+//
+//   void temp_max(void* user_data, rmc_node_id_t node_id, int temp) { ... }
+//
+//   dstc_get_temp(0, CLIENT_GATHER_REDUCE_ARG(temp_max, temp_done, &max, 100000, int,));
+//
+#define CLIENT_GATHER_REDUCE_ARG(_reduce, _complete, _user_data, _timeout_usec, ...) ({ \
+    void dstc_gather_##_reduce(void* user_data, rmc_node_id_t node_id, uint8_t* data) \
+    {                                                                   \
+        DECLARE_VARIABLES(__VA_ARGS__);                                 \
+        DESERIALIZE_ARGUMENTS(__VA_ARGS__);                             \
+        (*_reduce)(user_data, node_id, LIST_ARGUMENTS(__VA_ARGS__));    \
+        return;                                                         \
+    }                                                                   \
+    CBCK callback = {                                                   \
+        .func_addr = dstc_register_gather(dstc_gather_##_reduce, _complete, \
+                                          _user_data, _timeout_usec)    \
+    };                                                                  \
+    callback;                                                           \
+    })
+
 
 // Thanks to https://codecraft.co/2014/11/25/variadic-macros-tricks for
 // deciphering variadic macro iterations.
@@ -123,10 +606,10 @@ typedef dstc_callback_t CBCK;
 #define _FE4(_call, type, size, ...) _call(2, type, size) _FE2(_call, __VA_ARGS__)
 #define _FE6(_call, type, size, ...) _call(3, type, size) _FE4(_call, __VA_ARGS__)
 #define _FE8(_call, type, size, ...) _call(4, type, size) _FE6(_call, __VA_ARGS__)
-#define _FE10(_call, type, size, ...) _call(5, type, size) _FE9(_call, __VA_ARGS__)
-#define _FE12(_call, type, size, ...) _call(6, type, size) _FE11(_call, __VA_ARGS__)
-#define _FE14(_call, type, size, ...) _call(7, type, size) _FE14(_call, __VA_ARGS__)
-#define _FE16(_call, type, size, ...) _call(8, type, size) _FE16(_call, __VA_ARGS__)
+#define _FE10(_call, type, size, ...) _call(5, type, size) _FE8(_call, __VA_ARGS__)
+#define _FE12(_call, type, size, ...) _call(6, type, size) _FE10(_call, __VA_ARGS__)
+#define _FE14(_call, type, size, ...) _call(7, type, size) _FE12(_call, __VA_ARGS__)
+#define _FE16(_call, type, size, ...) _call(8, type, size) _FE14(_call, __VA_ARGS__)
 #define _ERR(...) "Declare arguments in pairs: (char, [16]). Leave size empty if not array (int,)"
 
 #define FOR_EACH_VARIADIC_MACRO(_call, ...)                             \
@@ -139,6 +622,7 @@ typedef dstc_callback_t CBCK;
 // List building variant where each output generated by _call(),
 // except the last one, is trailed by a comma.
 // Solves trailing comma issue
+#define _LE0(_call)
 #define _LE2(_call, type, size, ...) _call(1, type, size) 
 #define _LE4(_call, type, size, ...) _call(2, type, size) , _LE2(_call, __VA_ARGS__)
 #define _LE6(_call, type, size, ...) _call(3, type, size) , _LE4(_call, __VA_ARGS__)
@@ -155,57 +639,212 @@ typedef dstc_callback_t CBCK;
                  _LE8,  _ERR, _LE6,  _ERR,                              \
                      _LE4,  _ERR, _LE2,  _ERR, _LE0)(_call, ##__VA_ARGS__)  
 
-// replace if with switch?
-#define SERIALIZE_ARGUMENT(arg_id, type, size)                          \
-    switch(*(uint32_t*) #type) {                                        \
-    case DSTC_DYNARG_TAG:                                               \
-        *((uint32_t*) data) = ((dstc_dynamic_data_t*) &_a##arg_id)->length; \
-        data += sizeof(uint32_t);                                       \
-        memcpy((void*) data, ((dstc_dynamic_data_t*) &_a##arg_id)->data, \
-               ((dstc_dynamic_data_t*) & _a##arg_id)->length);          \
-        data += ((dstc_dynamic_data_t*) & _a##arg_id)->length;          \
-        break;                                                          \
-                                                                        \
-    case DSTC_CALLBACK_TAG:                                             \
-        *((uint64_t*) data) = ((dstc_callback_t*) &_a##arg_id)->func_addr; \
-        data += sizeof(uint64_t);                                       \
-        break;                                                          \
-                                                                        \
-    default:                                                            \
-        if (sizeof(type size ) == sizeof(type))                         \
-            memcpy((void*) data, (void*) &_a##arg_id, sizeof(type size)); \
-        else                                                            \
-            memcpy((void*) data, (void*) *(char**) &_a##arg_id, sizeof(type size)); \
-        data += sizeof(type size);                                      \
-    }
+// Argument kinds are resolved at compile time from the declared type.
+// A dynamic argument is serialized as its length followed by its data.
+// All other arguments, including callbacks, have a fixed size and are
+// copied as is, which makes the size of a call without dynamic arguments
+// a constant and each argument a constant size copy.
+#define _DSTC_IS_DYNAMIC(type) __builtin_types_compatible_p(type, DSTC)
+#define _DSTC_IS_ARRAY(type, size) (!__builtin_types_compatible_p(type size, type))
+
+// A typed dynamic array is serialized as its element count, a pad
+// length byte, pad bytes, and its elements. The pad aligns the elements
+// to DSTC_ARRAY_ALIGN bytes from the start of the call arguments, which
+// DSTC places at a DSTC_ARRAY_ALIGN boundary on the receiving side.
+// Element size of a typed dynamic array. 0 = Not a typed dynamic array
+#define _DSTC_ARRAY_TYPE_SIZE(type, elem_type, other)                   \
+    __builtin_choose_expr(__builtin_types_compatible_p(type, dstc_array_##elem_type), \
+                          sizeof(elem_type), other)
+
+#define _DSTC_ARRAY_ELEM_SIZE(type)                                     \
+    _DSTC_ARRAY_TYPE_SIZE(type, float,                                  \
+    _DSTC_ARRAY_TYPE_SIZE(type, double,                                 \
+    _DSTC_ARRAY_TYPE_SIZE(type, int8_t,                                 \
+    _DSTC_ARRAY_TYPE_SIZE(type, uint8_t,                                \
+    _DSTC_ARRAY_TYPE_SIZE(type, int16_t,                                \
+    _DSTC_ARRAY_TYPE_SIZE(type, uint16_t,                               \
+    _DSTC_ARRAY_TYPE_SIZE(type, int32_t,                                \
+    _DSTC_ARRAY_TYPE_SIZE(type, uint32_t,                               \
+    _DSTC_ARRAY_TYPE_SIZE(type, int64_t,                                \
+    _DSTC_ARRAY_TYPE_SIZE(type, uint64_t, (size_t) 0))))))))))
+
+#define _DSTC_IS_DYNAMIC_ARRAY(type) (_DSTC_ARRAY_ELEM_SIZE(type) != 0)
+
+// Bytes between the count and pad length of an array starting offset
+// bytes into the arguments, and its aligned elements.
+#define _DSTC_ARRAY_PAD(offset) ((-(offset)) & (DSTC_ARRAY_ALIGN - 1))
+#define _DSTC_ARRAY_HEADER_LEN (sizeof(uint32_t) + sizeof(uint8_t))
+
+// Address of the memory of a client side argument. An array parameter
+// is a pointer to the caller's array.
+#define _DSTC_ARG_ADDR(arg_id, type, size)                              \
+    __builtin_choose_expr(_DSTC_IS_ARRAY(type, size),                   \
+                          (const void*) *(char**) &_a##arg_id,          \
+                          (const void*) &_a##arg_id)
+
+// Dynamic argument of a call. The address is passed as a void pointer
+// since the branches of a non-dynamic argument are type checked as well,
+// and a packed struct argument would otherwise warn about its alignment.
+static inline dstc_dynamic_data_t* _dstc_dynamic_arg(void* arg)
+{
+    return (dstc_dynamic_data_t*) arg;
+}
 
+#define _DSTC_DYNAMIC_ARG(arg_id) _dstc_dynamic_arg((void*) &_a##arg_id)
+
+static inline uint8_t* _dstc_put(uint8_t* data, const void* arg, uint32_t len)
+{
+    memcpy(data, arg, len);
+    return data + len;
+}
+
+static inline uint8_t* _dstc_put_dynamic(uint8_t* data, const dstc_dynamic_data_t* arg)
+{
+    memcpy(data, &arg->length, sizeof(uint32_t));
+    return _dstc_put(data + sizeof(uint32_t), arg->data, arg->length);
+}
+
+static inline uint8_t* _dstc_put_array(uint8_t* data, const uint8_t* arg_buf,
+                                       const dstc_dynamic_data_t* arg, uint32_t elem_size)
+{
+    uint8_t pad = _DSTC_ARRAY_PAD(data + _DSTC_ARRAY_HEADER_LEN - arg_buf);
+
+    memcpy(data, &arg->length, sizeof(uint32_t));
+    data[sizeof(uint32_t)] = pad;
+    memset(data + _DSTC_ARRAY_HEADER_LEN, 0, pad);
+    return _dstc_put(data + _DSTC_ARRAY_HEADER_LEN + pad, arg->data, arg->length * elem_size);
+}
+
+static inline uint8_t* _dstc_get(uint8_t* data, void* arg, uint32_t len)
+{
+    memcpy(arg, data, len);
+    return data + len;
+}
+
+static inline uint8_t* _dstc_get_ref(uint8_t* data, uint8_t** arg, uint32_t len)
+{
+    *arg = data;
+    return data + len;
+}
+
+static inline uint8_t* _dstc_get_dynamic(uint8_t* data, dstc_dynamic_data_t* arg)
+{
+    memcpy(&arg->length, data, sizeof(uint32_t));
+    arg->data = data + sizeof(uint32_t);
+    return data + sizeof(uint32_t) + arg->length;
+}
+
+static inline uint8_t* _dstc_get_array(uint8_t* data, dstc_dynamic_data_t* arg, uint32_t elem_size)
+{
+    memcpy(&arg->length, data, sizeof(uint32_t));
+    arg->data = data + _DSTC_ARRAY_HEADER_LEN + data[sizeof(uint32_t)];
+    return (uint8_t*) arg->data + arg->length * elem_size;
+}
+
+static inline int _dstc_iov(struct iovec* iov, int iovcnt, const void* arg, uint32_t len)
+{
+    iov[iovcnt].iov_base = (void*) arg;
+    iov[iovcnt].iov_len = len;
+    return iovcnt + 1;
+}
+
+static inline int _dstc_iov_dynamic(struct iovec* iov, int iovcnt, uint32_t* len,
+                                    const dstc_dynamic_data_t* arg)
+{
+    *len = arg->length;
+    iovcnt = _dstc_iov(iov, iovcnt, len, sizeof(uint32_t));
+    return _dstc_iov(iov, iovcnt, arg->data, arg->length);
+}
+
+// The pad length byte and pad bytes of an array are stored in pad,
+// and their length computed from the iovecs preceding it.
+static inline int _dstc_iov_array(struct iovec* iov, int iovcnt, uint32_t* len, uint8_t* pad,
+                                  const dstc_dynamic_data_t* arg, uint32_t elem_size)
+{
+    uint32_t offset = _DSTC_ARRAY_HEADER_LEN;
+    int ind = 0;
+
+    for(ind = 0; ind < iovcnt; ++ind)
+        offset += iov[ind].iov_len;
+
+    *len = arg->length;
+    pad[0] = _DSTC_ARRAY_PAD(offset);
+    memset(pad + 1, 0, pad[0]);
+    iovcnt = _dstc_iov(iov, iovcnt, len, sizeof(uint32_t));
+    iovcnt = _dstc_iov(iov, iovcnt, pad, sizeof(uint8_t) + pad[0]);
+    return _dstc_iov(iov, iovcnt, arg->data, arg->length * elem_size);
+}
+
+#define SERIALIZE_ARGUMENT(arg_id, type, size)                          \
+    data = __builtin_choose_expr(_DSTC_IS_DYNAMIC(type),                \
+                                 _dstc_put_dynamic(data, _DSTC_DYNAMIC_ARG(arg_id)), \
+           __builtin_choose_expr(_DSTC_IS_DYNAMIC_ARRAY(type),          \
+                                 _dstc_put_array(data, arg_buf, _DSTC_DYNAMIC_ARG(arg_id), \
+                                                 _DSTC_ARRAY_ELEM_SIZE(type)), \
+                                 _dstc_put(data, _DSTC_ARG_ADDR(arg_id, type, size), \
+                                           sizeof(type size))));
 
 #define DESERIALIZE_ARGUMENT(arg_id, type, size)                        \
-    switch(*(uint32_t*) #type) {                                        \
-    case DSTC_DYNARG_TAG:                                               \
-        ((dstc_dynamic_data_t*) &_a##arg_id)->length = *((uint32_t*) data); \
-        data += sizeof(uint32_t);                                       \
-        ((dstc_dynamic_data_t*) &_a##arg_id)->data = data;              \
-        data += ((dstc_dynamic_data_t*) &_a##arg_id)->length;           \
-        break;                                                          \
-                                                                        \
-    case DSTC_CALLBACK_TAG:                                             \
-        ((dstc_callback_t*) &_a##arg_id)->func_addr = *(uint64_t*) data; \
-        data += sizeof(uint64_t);                                       \
-        break;                                                          \
-                                                                        \
-    default:                                                            \
-        if (sizeof(type size) == sizeof(type))                          \
-            memcpy((void*) &_a##arg_id, (void*) data, sizeof(type size)); \
-        else                                                            \
-            memcpy((void*) (uint32_t*) &_a##arg_id, (void*) data, sizeof(type size)); \
-        data += sizeof(type size);                                      \
-    }
+    data = __builtin_choose_expr(_DSTC_IS_DYNAMIC(type),                \
+                                 _dstc_get_dynamic(data, _DSTC_DYNAMIC_ARG(arg_id)), \
+           __builtin_choose_expr(_DSTC_IS_DYNAMIC_ARRAY(type),          \
+                                 _dstc_get_array(data, _DSTC_DYNAMIC_ARG(arg_id), \
+                                                 _DSTC_ARRAY_ELEM_SIZE(type)), \
+                                 _dstc_get(data, (void*) &_a##arg_id, sizeof(type size))));
+
+// Describe an argument as iovecs pointing into the caller's memory.
+// Dynamic arguments use two iovecs: the length and the data.
+// Typed dynamic arrays use three: the count, the pad, and the elements.
+// Used by DSTC_CLIENT_IOV()
+#define IOV_ARGUMENT(arg_id, type, size)                                \
+    iovcnt = __builtin_choose_expr(_DSTC_IS_DYNAMIC(type),              \
+                                   _dstc_iov_dynamic(iov, iovcnt, &dyn_len[arg_id], \
+                                                     _DSTC_DYNAMIC_ARG(arg_id)), \
+             __builtin_choose_expr(_DSTC_IS_DYNAMIC_ARRAY(type),        \
+                                   _dstc_iov_array(iov, iovcnt, &dyn_len[arg_id], pad[arg_id], \
+                                                   _DSTC_DYNAMIC_ARG(arg_id), \
+                                                   _DSTC_ARRAY_ELEM_SIZE(type)), \
+                                   _dstc_iov(iov, iovcnt, _DSTC_ARG_ADDR(arg_id, type, size), \
+                                             sizeof(type size))));
+
+// Used by DSTC_SERVER_REF() to pass array arguments as const pointers
+// into the received packet instead of copying them.
+// Scalar arguments are declared as copies, array arguments as pointers.
+#define DECLARE_REF_VARIABLE(arg_id, type, size)                        \
+    __typeof__(__builtin_choose_expr(__builtin_types_compatible_p(type size, type), \
+                                     *(type*) 0,                        \
+                                     (const type*) 0)) _a##arg_id;
+
+#define DESERIALIZE_REF_ARGUMENT(arg_id, type, size)                    \
+    data = __builtin_choose_expr(_DSTC_IS_DYNAMIC(type),                \
+                                 _dstc_get_dynamic(data, _DSTC_DYNAMIC_ARG(arg_id)), \
+           __builtin_choose_expr(_DSTC_IS_DYNAMIC_ARRAY(type),          \
+                                 _dstc_get_array(data, _DSTC_DYNAMIC_ARG(arg_id), \
+                                                 _DSTC_ARRAY_ELEM_SIZE(type)), \
+           __builtin_choose_expr(_DSTC_IS_ARRAY(type, size),            \
+                                 _dstc_get_ref(data, (uint8_t**) &_a##arg_id, sizeof(type size)), \
+                                 _dstc_get(data, (void*) &_a##arg_id, sizeof(type size)))));
+
+#define DECLARE_CONST_ARGUMENT(arg_id, type, size) const type _a##arg_id size
 
 #define DECLARE_ARGUMENT(arg_id, type, size) type _a##arg_id size
 #define LIST_ARGUMENT(arg_id, type, size) _a##arg_id
 #define DECLARE_VARIABLE(arg_id, type, size) type _a##arg_id size ;
-#define SIZE_ARGUMENT(arg_id, type, size) ((* (uint32_t*) #type == DSTC_DYNARG_TAG)?(sizeof(uint32_t) + ((dstc_dynamic_data_t*) &_a##arg_id)->length): sizeof(type size)) +
+// Typed dynamic arrays are sized with their largest pad.
+#define SIZE_ARGUMENT(arg_id, type, size)                               \
+    __builtin_choose_expr(_DSTC_IS_DYNAMIC(type),                       \
+                          sizeof(uint32_t) + (_DSTC_DYNAMIC_ARG(arg_id))->length, \
+    __builtin_choose_expr(_DSTC_IS_DYNAMIC_ARRAY(type),                 \
+                          _DSTC_ARRAY_HEADER_LEN + DSTC_ARRAY_ALIGN - 1 + \
+                          (_DSTC_DYNAMIC_ARG(arg_id))->length * _DSTC_ARRAY_ELEM_SIZE(type), \
+                          sizeof(type size))) +
+
+// 1 if any argument is a typed dynamic array
+#define ALIGN_ARGUMENT(arg_id, type, size) _DSTC_IS_DYNAMIC_ARRAY(type) ||
+
+// Used by DSTC_CLIENT_BULK() to check its tuple type against the arguments.
+#define DYNAMIC_ARGUMENT(arg_id, type, size) _DSTC_IS_DYNAMIC(type) ||
+#define FIXED_SIZE_ARGUMENT(arg_id, type, size) sizeof(type size) +
         
 #define SERIALIZE_ARGUMENTS(...) FOR_EACH_VARIADIC_MACRO(SERIALIZE_ARGUMENT, ##__VA_ARGS__)
 #define DESERIALIZE_ARGUMENTS(...) FOR_EACH_VARIADIC_MACRO(DESERIALIZE_ARGUMENT, ##__VA_ARGS__)
@@ -213,20 +852,72 @@ typedef dstc_callback_t CBCK;
 #define LIST_ARGUMENTS(...) FOR_EACH_VARIADIC_MACRO_ELEM(LIST_ARGUMENT, ##__VA_ARGS__)
 #define DECLARE_VARIABLES(...) FOR_EACH_VARIADIC_MACRO(DECLARE_VARIABLE, ##__VA_ARGS__)
 #define SIZE_ARGUMENTS(...) FOR_EACH_VARIADIC_MACRO(SIZE_ARGUMENT, ##__VA_ARGS__) 0
+#define ALIGN_ARGUMENTS(...) (FOR_EACH_VARIADIC_MACRO(ALIGN_ARGUMENT, ##__VA_ARGS__) 0)
+#define IOV_ARGUMENTS(...) FOR_EACH_VARIADIC_MACRO(IOV_ARGUMENT, ##__VA_ARGS__)
+#define DECLARE_REF_VARIABLES(...) FOR_EACH_VARIADIC_MACRO(DECLARE_REF_VARIABLE, ##__VA_ARGS__)
+#define DESERIALIZE_REF_ARGUMENTS(...) FOR_EACH_VARIADIC_MACRO(DESERIALIZE_REF_ARGUMENT, ##__VA_ARGS__)
+#define DECLARE_CONST_ARGUMENTS(...) FOR_EACH_VARIADIC_MACRO_ELEM(DECLARE_CONST_ARGUMENT, ##__VA_ARGS__)
 
 
 // Create client function that serializes and writes to descriptor.
 // If the reliable multicast system has not been started when the
 // client call is made, it is will be done through dstc_setup()
+// Returns 0, or EAGAIN if the call could not be queued.
+// See dstc_set_queue_limit().
 #define DSTC_CLIENT(name, ...)                                          \
-  void dstc_##name(DECLARE_ARGUMENTS(__VA_ARGS__)) {                    \
+  int dstc_##name(DECLARE_ARGUMENTS(__VA_ARGS__)) {                     \
       uint32_t arg_sz = SIZE_ARGUMENTS(__VA_ARGS__);                    \
       uint8_t arg_buf[arg_sz];                                          \
       uint8_t *data = arg_buf;                                          \
-      extern void dstc_queue_func(uint8_t* name, uint8_t* arg_buf, uint32_t arg_sz); \
+      extern int dstc_queue_func(uint8_t* name, uint8_t* arg_buf, uint32_t arg_sz); \
                                                                         \
       SERIALIZE_ARGUMENTS(__VA_ARGS__);                                 \
-      dstc_queue_func(#name, arg_buf, arg_sz);                          \
+      if (ALIGN_ARGUMENTS(__VA_ARGS__))                                 \
+          dstc_set_next_call_aligned();                                 \
+      return dstc_queue_func(#name, arg_buf, data - arg_buf);           \
+  }                                                                     \
+
+
+// Create client function that gathers its arguments directly from the
+// caller's memory instead of serializing them into an intermediate
+// buffer. Saves a full copy of large dynamic arguments.
+// The caller may reuse the argument memory as soon as the call returns.
+#define DSTC_CLIENT_IOV(name, ...)                                      \
+  int dstc_##name(DECLARE_ARGUMENTS(__VA_ARGS__)) {                     \
+      struct iovec iov[24];                                             \
+      uint32_t dyn_len[9];                                              \
+      uint8_t pad[ALIGN_ARGUMENTS(__VA_ARGS__)?9:1][DSTC_ARRAY_ALIGN];  \
+      int iovcnt = 0;                                                   \
+                                                                        \
+      IOV_ARGUMENTS(__VA_ARGS__);                                       \
+      if (ALIGN_ARGUMENTS(__VA_ARGS__))                                 \
+          dstc_set_next_call_aligned();                                 \
+      return dstc_queue_func_iov(#name, iov, iovcnt);                   \
+  }                                                                     \
+
+
+// Create client function that makes count calls in bulk. The calls
+// travel as records carrying the function name once, and are executed
+// by a single invocation of a DSTC_SERVER_BULK() server function.
+// Servers declared with DSTC_SERVER() get one invocation per tuple.
+// tuple_type holds the arguments of a single call, laid out as they
+// are serialized: in order and without padding. For a function taking
+// a single struct, that is the struct itself. The arguments follow as
+// in DSTC_CLIENT(), and must be of fixed size and add up to tuple_type.
+//
+//   DSTC_CLIENT_BULK(sample, struct sample, struct sample,)
+//   dstc_bulk_sample(samples, 10000);
+#define DSTC_CLIENT_BULK(name, tuple_type, ...)                         \
+  _Static_assert(!ALIGN_ARGUMENTS(__VA_ARGS__) &&                       \
+                 !(FOR_EACH_VARIADIC_MACRO(DYNAMIC_ARGUMENT, __VA_ARGS__) 0), \
+                 "Bulk call " #name " has dynamic arguments");          \
+  _Static_assert(sizeof(tuple_type) == (FOR_EACH_VARIADIC_MACRO(FIXED_SIZE_ARGUMENT, __VA_ARGS__) 0), \
+                 "Tuple type of bulk call " #name " does not match its arguments"); \
+  int dstc_bulk_##name(const tuple_type* tuples, uint32_t count) {     \
+      extern int dstc_queue_func_bulk(uint8_t* name, const void* tuples, \
+                                      uint32_t tuple_size, uint32_t count); \
+                                                                        \
+      return dstc_queue_func_bulk(#name, tuples, sizeof(tuple_type), count); \
   }                                                                     \
 
 
@@ -234,14 +925,16 @@ typedef dstc_callback_t CBCK;
 // If the reliable multicast system has not been started when the
 // client call is made, it is will be done through dstc_setup()
 #define DSTC_CALLBACK(name, ...)                                        \
-  void dstc_##name(DECLARE_ARGUMENTS(__VA_ARGS__)) {                    \
+  int dstc_##name(DECLARE_ARGUMENTS(__VA_ARGS__)) {                     \
       uint32_t arg_sz = SIZE_ARGUMENTS(__VA_ARGS__);                    \
       uint8_t arg_buf[arg_sz];                                          \
       uint8_t *data = arg_buf;                                          \
-      extern void dstc_queue_callback(uint64_t addr, uint8_t* arg_buf, uint32_t arg_sz); \
+      extern int dstc_queue_callback(uint64_t addr, uint8_t* arg_buf, uint32_t arg_sz); \
                                                                         \
       SERIALIZE_ARGUMENTS(__VA_ARGS__);                                 \
-      dstc_queue_callback(name.func_addr, arg_buf, arg_sz);             \
+      if (ALIGN_ARGUMENTS(__VA_ARGS__))                                 \
+          dstc_set_next_call_aligned();                                 \
+      return dstc_queue_callback(name.func_addr, arg_buf, data - arg_buf); \
   }                                                                     \
 
 
@@ -259,18 +952,199 @@ typedef dstc_callback_t CBCK;
         return;                                                         \
     }                                                                   \
 
+// Registration record of a server function. DSTC_SERVER() places one
+// in the dstc_servers linker section, where DSTC finds them at startup
+// without running any code per function.
+typedef struct dstc_server_record {
+    const char* name;
+    void (*func)(rmc_node_id_t node_id, uint8_t*);
+    // Set instead of func by DSTC_SERVER_BULK() and DSTC_SERVER_BULK_SOA()
+    void (*batch_func)(rmc_node_id_t node_id, uint32_t count, uint32_t tuple_size, uint8_t*);
+} dstc_server_record_t;
+
+// The linker collects the records of the main program into a single
+// dstc_servers section. A shared object has a section of its own,
+// whose bounds the linker only defines if they are referenced. Code
+// built for a shared object (-fPIC, but not -fPIE) references them
+// from each server, and DSTC finds the section through the dynamic
+// symbols of the object. No code runs at load time.
+#if defined(__PIC__) && !defined(__pie__)
+#define _DSTC_REGISTER_SECTION(name)                                    \
+    extern const dstc_server_record_t __start_dstc_servers[] __attribute__((weak)); \
+    extern const dstc_server_record_t __stop_dstc_servers[] __attribute__((weak)); \
+    static const dstc_server_record_t* const _dstc_section_##name[]     \
+    __attribute__((used)) = { __start_dstc_servers, __stop_dstc_servers }; \
+
+#else
+#define _DSTC_REGISTER_SECTION(name)
+#endif
+
 #define _DSTC_AUTO_REGISTER(name)                                       \
-    void __attribute__((constructor)) _dstc_register_##name()           \
+    const dstc_server_record_t _dstc_record_##name                      \
+    __attribute__((used, section("dstc_servers"), aligned(sizeof(void*)))) = \
+    { #name, dstc_server_##name, 0 };                                   \
+    _DSTC_REGISTER_SECTION(name)                                        \
+
+#define _DSTC_AUTO_REGISTER_BATCH(name)                                 \
+    const dstc_server_record_t _dstc_record_##name                      \
+    __attribute__((used, section("dstc_servers"), aligned(sizeof(void*)))) = \
+    { #name, 0, dstc_server_##name };                                   \
+    _DSTC_REGISTER_SECTION(name)                                        \
+
+// Register the dstc_servers section of a shared object whose sources
+// are not built with -fPIC, or that is linked with
+// -z start-stop-visibility=hidden, from a single constructor.
+#define DSTC_REGISTER_SHARED_OBJECT()                                   \
+    extern const dstc_server_record_t __start_dstc_servers[]            \
+        __attribute__((weak, visibility("hidden")));                    \
+    extern const dstc_server_record_t __stop_dstc_servers[]             \
+        __attribute__((weak, visibility("hidden")));                    \
+    static void __attribute__((constructor)) _dstc_register_shared_object(void) \
     {                                                                   \
-        extern void dstc_register_local_function(char*, void (*)(rmc_node_id_t, uint8_t*)); \
-        dstc_register_local_function(#name, dstc_server_##name);        \
+        extern void dstc_register_server_records(const dstc_server_record_t*, \
+                                                 const dstc_server_record_t*); \
+        dstc_register_server_records(__start_dstc_servers, __stop_dstc_servers); \
     }                                                                   \
 
+// Iterate over the fields of a struct, for DSTC_SERVER_BULK_SOA()
+#define _FF1(_call, type, field) _call(type, field)
+#define _FF2(_call, type, field, ...) _call(type, field) _FF1(_call, type, __VA_ARGS__)
+#define _FF3(_call, type, field, ...) _call(type, field) _FF2(_call, type, __VA_ARGS__)
+#define _FF4(_call, type, field, ...) _call(type, field) _FF3(_call, type, __VA_ARGS__)
+#define _FF5(_call, type, field, ...) _call(type, field) _FF4(_call, type, __VA_ARGS__)
+#define _FF6(_call, type, field, ...) _call(type, field) _FF5(_call, type, __VA_ARGS__)
+#define _FF7(_call, type, field, ...) _call(type, field) _FF6(_call, type, __VA_ARGS__)
+#define _FF8(_call, type, field, ...) _call(type, field) _FF7(_call, type, __VA_ARGS__)
+
+#define _FL1(_call, type, field) _call(type, field)
+#define _FL2(_call, type, field, ...) _call(type, field), _FL1(_call, type, __VA_ARGS__)
+#define _FL3(_call, type, field, ...) _call(type, field), _FL2(_call, type, __VA_ARGS__)
+#define _FL4(_call, type, field, ...) _call(type, field), _FL3(_call, type, __VA_ARGS__)
+#define _FL5(_call, type, field, ...) _call(type, field), _FL4(_call, type, __VA_ARGS__)
+#define _FL6(_call, type, field, ...) _call(type, field), _FL5(_call, type, __VA_ARGS__)
+#define _FL7(_call, type, field, ...) _call(type, field), _FL6(_call, type, __VA_ARGS__)
+#define _FL8(_call, type, field, ...) _call(type, field), _FL7(_call, type, __VA_ARGS__)
+
+#define FOR_EACH_FIELD(_call, type, ...)                                \
+    _GET_NTH_ARG(__VA_ARGS__, _ERR, _ERR, _ERR, _ERR, _ERR, _ERR, _ERR, _ERR, \
+                 _FF8, _FF7, _FF6, _FF5, _FF4, _FF3, _FF2, _FF1)(_call, type, __VA_ARGS__)
+
+#define FOR_EACH_FIELD_ELEM(_call, type, ...)                           \
+    _GET_NTH_ARG(__VA_ARGS__, _ERR, _ERR, _ERR, _ERR, _ERR, _ERR, _ERR, _ERR, \
+                 _FL8, _FL7, _FL6, _FL5, _FL4, _FL3, _FL2, _FL1)(_call, type, __VA_ARGS__)
+
+#define _SOA_FIELD_TYPE(type, field) __typeof__(((type*) 0)->field)
+#define DECLARE_SOA_PARAM(type, field) const _SOA_FIELD_TYPE(type, field)* field
+#define DECLARE_SOA_ARRAY(type, field) \
+    _SOA_FIELD_TYPE(type, field)* _soa_##field = malloc(_count * sizeof(_SOA_FIELD_TYPE(type, field)));
+#define GATHER_SOA_FIELD(type, field)                                   \
+    memcpy(&_soa_##field[_ind], _data + _ind * sizeof(type) + offsetof(type, field), \
+           sizeof(_SOA_FIELD_TYPE(type, field)));
+#define LIST_SOA_ARRAY(type, field) _soa_##field
+#define MISSING_SOA_ARRAY(type, field) !_soa_##field ||
+#define FREE_SOA_ARRAY(type, field) free(_soa_##field);
+
 #define DSTC_SERVER(name, ...)                          \
     extern void name(DECLARE_ARGUMENTS(__VA_ARGS__));   \
     static DSTC_SERVER_INTERNAL(name, __VA_ARGS__)      \
     static _DSTC_AUTO_REGISTER(name)
 
+// Variant of DSTC_SERVER_INTERNAL() where array arguments are not
+// copied. The server function gets const pointers into the received
+// packet, valid until it returns. The pointers may be unaligned.
+#define DSTC_SERVER_REF_INTERNAL(name, ...)                             \
+    void dstc_server_##name(rmc_node_id_t node_id, uint8_t* data)       \
+    {                                                                   \
+        DECLARE_REF_VARIABLES(__VA_ARGS__);                             \
+        DESERIALIZE_REF_ARGUMENTS(__VA_ARGS__);                         \
+        name(LIST_ARGUMENTS(__VA_ARGS__));                              \
+        return;                                                         \
+    }                                                                   \
+
+// Zero copy server. Same arguments and wire format as DSTC_SERVER(),
+// but array arguments are passed to the server function as const
+// pointers into the received packet. Use DECL_REF_ARG(type) to have
+// a struct argument passed the same way.
+//
+//   DSTC_SERVER_REF(chat_message, char, [128], char, [512])
+//   void chat_message(const char username[128], const char buf[512])
+//
+#define DSTC_SERVER_REF(name, ...)                              \
+    extern void name(DECLARE_CONST_ARGUMENTS(__VA_ARGS__));     \
+    static DSTC_SERVER_REF_INTERNAL(name, __VA_ARGS__)          \
+    static _DSTC_AUTO_REGISTER(name)
+
+// Batch server for calls made with DSTC_CLIENT_BULK(). The server
+// function is invoked once per received record, with all of its tuples
+// in an array. Calls made with DSTC_CLIENT() arrive as a single tuple.
+//
+//   DSTC_SERVER_BULK(sample, struct sample)
+//   void sample(uint32_t count, const struct sample* samples)
+//
+#define DSTC_SERVER_BULK(name, tuple_type)                              \
+    extern void name(uint32_t count, const tuple_type* tuples);         \
+    static void dstc_server_##name(rmc_node_id_t _node_id, uint32_t _count, \
+                                   uint32_t _tuple_size, uint8_t* _data) \
+    {                                                                   \
+        extern void dstc_bulk_call_dropped(const char* name, uint32_t count, \
+                                           uint32_t tuple_size, uint32_t server_tuple_size); \
+        tuple_type* _copy = 0;                                          \
+                                                                        \
+        if (_tuple_size != sizeof(tuple_type)) {                        \
+            dstc_bulk_call_dropped(#name, _count, _tuple_size, sizeof(tuple_type)); \
+            return;                                                     \
+        }                                                               \
+                                                                        \
+        /* Tuples in a received packet may be unaligned. */             \
+        if ((uintptr_t) _data % __alignof__(tuple_type)) {              \
+            if (!(_copy = malloc(_count * sizeof(tuple_type)))) {       \
+                dstc_bulk_call_dropped(#name, _count, _tuple_size, sizeof(tuple_type)); \
+                return;                                                 \
+            }                                                           \
+            memcpy(_copy, _data, _count * sizeof(tuple_type));          \
+            _data = (uint8_t*) _copy;                                   \
+        }                                                               \
+        name(_count, (const tuple_type*) _data);                        \
+        free(_copy);                                                    \
+    }                                                                   \
+    static _DSTC_AUTO_REGISTER_BATCH(name)
+
+// Batch server that gets the tuples in struct of arrays layout, with
+// one array for each of the listed fields of tuple_type, suitable for
+// vectorized processing.
+//
+//   DSTC_SERVER_BULK_SOA(sample, struct sample, ts, value)
+//   void sample(uint32_t count, const usec_timestamp_t* ts, const float* value)
+//
+#define DSTC_SERVER_BULK_SOA(name, tuple_type, ...)                     \
+    extern void name(uint32_t count,                                    \
+                     FOR_EACH_FIELD_ELEM(DECLARE_SOA_PARAM, tuple_type, __VA_ARGS__)); \
+    static void dstc_server_##name(rmc_node_id_t _node_id, uint32_t _count, \
+                                   uint32_t _tuple_size, uint8_t* _data) \
+    {                                                                   \
+        extern void dstc_bulk_call_dropped(const char* name, uint32_t count, \
+                                           uint32_t tuple_size, uint32_t server_tuple_size); \
+        uint32_t _ind = 0;                                              \
+                                                                        \
+        if (_tuple_size != sizeof(tuple_type)) {                        \
+            dstc_bulk_call_dropped(#name, _count, _tuple_size, sizeof(tuple_type)); \
+            return;                                                     \
+        }                                                               \
+                                                                        \
+        FOR_EACH_FIELD(DECLARE_SOA_ARRAY, tuple_type, __VA_ARGS__)      \
+        if (FOR_EACH_FIELD(MISSING_SOA_ARRAY, tuple_type, __VA_ARGS__) 0) { \
+            dstc_bulk_call_dropped(#name, _count, _tuple_size, sizeof(tuple_type)); \
+            FOR_EACH_FIELD(FREE_SOA_ARRAY, tuple_type, __VA_ARGS__)     \
+            return;                                                     \
+        }                                                               \
+        for(_ind = 0; _ind < _count; ++_ind) {                          \
+            FOR_EACH_FIELD(GATHER_SOA_FIELD, tuple_type, __VA_ARGS__)   \
+        }                                                               \
+        name(_count, FOR_EACH_FIELD_ELEM(LIST_SOA_ARRAY, tuple_type, __VA_ARGS__)); \
+        FOR_EACH_FIELD(FREE_SOA_ARRAY, tuple_type, __VA_ARGS__)         \
+    }                                                                   \
+    static _DSTC_AUTO_REGISTER_BATCH(name)
+
 #endif // __DSTC_H__
 
 
@@ -0,0 +1,371 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the 
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// Header only C++20 binding of DSTC.
+// Calls use the same wire format as DSTC_CLIENT() and DSTC_SERVER(),
+// so C++ and C nodes can call each other.
+//
+// Argument mapping to the C macro declarations:
+//
+//   C++ argument                    C declaration
+//   ------------------------------  -------------------------------
+//   Trivially copyable T            T,  (or T, [N] for std::array<T, N>)
+//   std::string_view                DECL_DYNAMIC_ARG
+//   std::span<const T>              DECL_DYNAMIC_ARG
+//   dstc_dynamic_data_t             DECL_DYNAMIC_ARG
+//   dstc_callback_t                 DECL_CALLBACK_ARG
+//   const T* (zero copy receive)    T,  (or T, [N] for std::array<T, N>)
+//
+
+#ifndef __DSTC_HPP__
+#define __DSTC_HPP__
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include "dstc.h"
+}
+
+namespace dstc {
+
+// Serialization of a single argument.
+// The primary template handles fixed size arguments, which are
+// copied in their native format, just like the C macros do.
+template<typename T>
+struct codec {
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "DSTC arguments must be trivially copyable or have a dstc::codec specialization");
+    static constexpr bool is_fixed = true;
+    static constexpr uint32_t wire_size = sizeof(T);
+
+    static constexpr uint32_t size(const T&) { return sizeof(T); }
+
+    static uint8_t* write(uint8_t* data, const T& arg)
+    {
+        std::memcpy(data, &arg, sizeof(T));
+        return data + sizeof(T);
+    }
+
+    static T read(uint8_t*& data)
+    {
+        T arg;
+
+        std::memcpy(&arg, data, sizeof(T));
+        data += sizeof(T);
+        return arg;
+    }
+};
+
+// Fixed size argument passed by pointer. Sent with the same wire format
+// as T itself. A server handler taking a const T* gets a pointer into
+// the received packet, valid until it returns, and nothing is copied.
+// The pointer may be unaligned.
+template<typename T>
+struct codec<const T*> {
+    static_assert(std::is_trivially_copyable_v<T>, "DSTC arguments must be trivially copyable");
+    static constexpr bool is_fixed = true;
+    static constexpr uint32_t wire_size = sizeof(T);
+
+    static constexpr uint32_t size(const T*) { return sizeof(T); }
+
+    static uint8_t* write(uint8_t* data, const T* arg)
+    {
+        std::memcpy(data, arg, sizeof(T));
+        return data + sizeof(T);
+    }
+
+    static const T* read(uint8_t*& data)
+    {
+        const T* arg = reinterpret_cast<const T*>(data);
+
+        data += sizeof(T);
+        return arg;
+    }
+};
+
+// Dynamic arguments are a uint32_t byte count followed by the bytes.
+// Received dynamic arguments point into the packet and are only
+// valid for the duration of the call.
+namespace detail {
+    inline uint8_t* write_dynamic(uint8_t* data, const void* buf, uint32_t length)
+    {
+        std::memcpy(data, &length, sizeof(uint32_t));
+        data += sizeof(uint32_t);
+        std::memcpy(data, buf, length);
+        return data + length;
+    }
+
+    inline uint32_t read_dynamic(uint8_t*& data, uint8_t*& buf)
+    {
+        uint32_t length = 0;
+
+        std::memcpy(&length, data, sizeof(uint32_t));
+        buf = data + sizeof(uint32_t);
+        data = buf + length;
+        return length;
+    }
+}
+
+template<>
+struct codec<std::string_view> {
+    static constexpr bool is_fixed = false;
+
+    static uint32_t size(const std::string_view& arg) { return sizeof(uint32_t) + arg.size(); }
+
+    static uint8_t* write(uint8_t* data, const std::string_view& arg)
+    {
+        return detail::write_dynamic(data, arg.data(), arg.size());
+    }
+
+    static std::string_view read(uint8_t*& data)
+    {
+        uint8_t* buf = 0;
+        uint32_t length = detail::read_dynamic(data, buf);
+
+        return std::string_view(reinterpret_cast<const char*>(buf), length);
+    }
+};
+
+template<typename T>
+struct codec<std::span<const T>> {
+    static_assert(std::is_trivially_copyable_v<T>, "DSTC span elements must be trivially copyable");
+    static constexpr bool is_fixed = false;
+
+    static uint32_t size(const std::span<const T>& arg) { return sizeof(uint32_t) + arg.size_bytes(); }
+
+    static uint8_t* write(uint8_t* data, const std::span<const T>& arg)
+    {
+        return detail::write_dynamic(data, arg.data(), arg.size_bytes());
+    }
+
+    static std::span<const T> read(uint8_t*& data)
+    {
+        uint8_t* buf = 0;
+        uint32_t length = detail::read_dynamic(data, buf);
+
+        return std::span<const T>(reinterpret_cast<const T*>(buf), length / sizeof(T));
+    }
+};
+
+template<>
+struct codec<dstc_dynamic_data_t> {
+    static constexpr bool is_fixed = false;
+
+    static uint32_t size(const dstc_dynamic_data_t& arg) { return sizeof(uint32_t) + arg.length; }
+
+    static uint8_t* write(uint8_t* data, const dstc_dynamic_data_t& arg)
+    {
+        return detail::write_dynamic(data, arg.data, arg.length);
+    }
+
+    static dstc_dynamic_data_t read(uint8_t*& data)
+    {
+        dstc_dynamic_data_t arg;
+        uint8_t* buf = 0;
+
+        arg.length = detail::read_dynamic(data, buf);
+        arg.data = buf;
+        return arg;
+    }
+};
+
+template<typename T>
+using arg_t = std::remove_cvref_t<T>;
+
+// True if all arguments have a size known at compile time.
+template<typename... Args>
+inline constexpr bool all_fixed = (codec<arg_t<Args>>::is_fixed && ...);
+
+// Serialized size of a signature made only of fixed size arguments.
+template<typename... Args>
+inline constexpr uint32_t fixed_size = (0 + ... + codec<arg_t<Args>>::wire_size);
+
+namespace detail {
+    template<typename... Args>
+    inline void serialize(uint8_t* data, const Args&... args)
+    {
+        ((data = codec<arg_t<Args>>::write(data, args)), ...);
+    }
+
+    // Largest dynamic size call serialized on the stack.
+    inline constexpr uint32_t stack_buffer_size = 1024;
+
+    // Serialize args and pass them to queue().
+    // Fixed size signatures serialize into a stack buffer of constant size.
+    template<typename Queue, typename... Args>
+    inline int queue_call(Queue queue, const Args&... args)
+    {
+        if constexpr (all_fixed<Args...>) {
+            uint8_t arg_buf[fixed_size<Args...> + 1]; // Avoid zero size array
+
+            serialize(arg_buf, args...);
+            return queue(arg_buf, fixed_size<Args...>);
+        } else {
+            uint32_t arg_sz = (0 + ... + codec<arg_t<Args>>::size(args));
+
+            // Small dynamic calls are serialized on the stack as well.
+            if (arg_sz <= stack_buffer_size) {
+                uint8_t arg_buf[stack_buffer_size];
+
+                serialize(arg_buf, args...);
+                return queue(arg_buf, arg_sz);
+            }
+
+            std::vector<uint8_t> arg_buf(arg_sz);
+
+            serialize(arg_buf.data(), args...);
+            return queue(arg_buf.data(), arg_sz);
+        }
+    }
+
+    // Decode the arguments of a call and invoke func with them.
+    // Braced initialization guarantees left to right decoding.
+    template<typename Func, typename... Args>
+    inline void invoke(Func& func, uint8_t* data)
+    {
+        std::tuple<arg_t<Args>...> args { codec<arg_t<Args>>::read(data)... };
+
+        std::apply(func, args);
+    }
+
+    // Argument types of a lambda, function object, or function pointer.
+    template<typename T>
+    struct signature : signature<decltype(&T::operator())> {};
+
+    template<typename R, typename... Args>
+    struct signature<R (*)(Args...)> {
+        template<typename Func>
+        static void invoke(Func& func, uint8_t* data) { detail::invoke<Func, Args...>(func, data); }
+    };
+
+    template<typename C, typename R, typename... Args>
+    struct signature<R (C::*)(Args...)> : signature<R (*)(Args...)> {};
+
+    template<typename C, typename R, typename... Args>
+    struct signature<R (C::*)(Args...) const> : signature<R (*)(Args...)> {};
+}
+
+// Client side of a remote function.
+//
+//   dstc::client<std::array<char, 32>, int> print_name_and_age("print_name_and_age");
+//   print_name_and_age(name, 42);
+//
+template<typename... Args>
+class client {
+public:
+    constexpr explicit client(const char* name): name_(name) {}
+
+    // Returns 0, or EAGAIN if the call could not be queued.
+    int operator()(const arg_t<Args>&... args) const
+    {
+        return detail::queue_call([this](uint8_t* arg_buf, uint32_t arg_sz) {
+            return dstc_queue_func((uint8_t*) name_, arg_buf, arg_sz);
+        }, args...);
+    }
+
+    uint32_t remote_count(void) const { return dstc_get_remote_count((char*) name_); }
+
+private:
+    const char* name_;
+};
+
+// Server side of a remote function. The handler is invoked with the
+// decoded arguments for every incoming call. The server object must
+// outlive the event loop, and is typically a global.
+//
+//   dstc::server print_name_and_age("print_name_and_age",
+//       [](std::array<char, 32> name, int age) { ... });
+//
+template<typename Func>
+class server {
+public:
+    server(const char* name, Func func): func_(std::move(func))
+    {
+        dstc_register_local_function_ctx((char*) name, &server::dispatch, this);
+    }
+
+    server(const server&) = delete;
+    server& operator=(const server&) = delete;
+
+private:
+    static void dispatch(void* ctx, rmc_node_id_t node_id, uint8_t* data)
+    {
+        detail::signature<Func>::invoke(static_cast<server*>(ctx)->func_, data);
+    }
+
+    Func func_;
+};
+
+// Create a one shot callback argument from a handler. The handler is
+// deleted after it has been invoked by the server. A callback that will
+// not be invoked, for example since no server received the call, must
+// be released with cancel_callback().
+//
+//   double_value(21, dstc::callback([](int value) { ... }));
+//
+namespace detail {
+    struct callback_base {
+        virtual ~callback_base() = default;
+        virtual void invoke(uint8_t* data) = 0;
+    };
+
+    template<typename Func>
+    struct callback_holder: callback_base {
+        explicit callback_holder(Func func): func_(std::move(func)) {}
+
+        void invoke(uint8_t* data) override { detail::signature<Func>::invoke(func_, data); }
+
+        Func func_;
+    };
+
+    inline void dispatch_callback(void* ctx, rmc_node_id_t node_id, uint8_t* data)
+    {
+        callback_base* holder = static_cast<callback_base*>(ctx);
+
+        holder->invoke(data);
+        delete holder;
+    }
+}
+
+template<typename Func>
+dstc_callback_t callback(Func func)
+{
+    dstc_callback_t result;
+
+    result.func_addr = dstc_register_callback_ctx(&detail::dispatch_callback,
+                                                  new detail::callback_holder<Func>(std::move(func)));
+    return result;
+}
+
+// Delete a callback that has not been invoked, together with its handler.
+// Returns false if it was already invoked.
+inline bool cancel_callback(const dstc_callback_t& callback)
+{
+    void* ctx = dstc_cancel_callback_ctx(callback.func_addr);
+
+    delete static_cast<detail::callback_base*>(ctx);
+    return ctx != nullptr;
+}
+
+// Invoke a callback argument received by a server.
+template<typename... Args>
+int invoke_callback(const dstc_callback_t& callback, const Args&... args)
+{
+    return detail::queue_call([&callback](uint8_t* arg_buf, uint32_t arg_sz) {
+        return dstc_queue_callback(callback.func_addr, arg_buf, arg_sz);
+    }, args...);
+}
+
+}
+
+#endif // __DSTC_HPP__
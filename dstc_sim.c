@@ -0,0 +1,486 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+
+// In-memory transport with virtual peers. See dstc_sim.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "dstc_sim.h"
+#include "rmc_log.h"
+
+typedef struct sim_peer {
+    rmc_node_id_t node_id;
+    char* functions;          // Null terminated names, back to back
+    uint32_t functions_len;
+    uint8_t subscribing;      // Subscription to the local node in progress
+    uint8_t subscribed;       // Receives packets from the local node
+    usec_timestamp_t inbound_ts; // Arrival of last packet sent to the local node
+    dstc_sim_peer_stats_t stats;
+} sim_peer_t;
+
+#define SIM_EVENT_ANNOUNCE        0 // Local node announces itself to all peers
+#define SIM_EVENT_PEER_SUBSCRIBED 1 // Peer has subscribed to the local node
+#define SIM_EVENT_NODE_SUBSCRIBED 2 // Local node has subscribed to peer
+#define SIM_EVENT_DELIVERED       3 // Published packet acknowledged by all peers
+#define SIM_EVENT_INCOMING        4 // Packet from peer has arrived
+
+typedef struct sim_event {
+    struct sim_event* next;
+    usec_timestamp_t ts;
+    uint8_t type;             // SIM_EVENT_XXX
+    int peer;
+    void* payload;
+    payload_len_t payload_len;
+} sim_event_t;
+
+// Received packet waiting for dstc_sim_next_packet()
+typedef struct sim_packet {
+    struct sim_packet* next;
+    void* payload;
+    payload_len_t payload_len;
+} sim_packet_t;
+
+static sim_peer_t* peers = 0;
+static uint32_t peer_count = 0;
+static uint32_t peer_size = 0;
+static uint32_t peers_unsubscribed = 0;
+
+static sim_event_t* events = 0;       // Ordered by ts
+static sim_event_t* events_tail = 0;
+static sim_event_t* events_last = 0;  // Last scheduled event, still in events
+static sim_packet_t* incoming_head = 0;
+static sim_packet_t* incoming_tail = 0;
+
+static usec_timestamp_t sim_now = 0;
+static usec_timestamp_t sim_latency = 1000;
+static usec_timestamp_t announce_interval = -1;
+static int announce_scheduled = 0;
+
+static dstc_sim_link_t sim_link = { .retransmit_usec = 10000 };
+static dstc_sim_link_stats_t link_stats;
+static uint64_t rand_state = 1;
+
+// xorshift64*, so that runs are reproducible across C libraries.
+static uint64_t sim_rand(void)
+{
+    rand_state ^= rand_state >> 12;
+    rand_state ^= rand_state << 25;
+    rand_state ^= rand_state >> 27;
+    return rand_state * 0x2545F4914F6CDD1D;
+}
+
+static int sim_chance(double probability)
+{
+    return probability > 0.0 && (sim_rand() >> 11) * (1.0 / 9007199254740992.0) < probability;
+}
+
+// Arrival time of a packet sent at ts, with lost transmissions
+// resent until one gets through. If dup_ts is given, it is set to the
+// arrival time of a duplicate of the packet, or -1 if there is none.
+static usec_timestamp_t sim_transmit(usec_timestamp_t ts, usec_timestamp_t* dup_ts)
+{
+    link_stats.transmissions++;
+    while(sim_chance(sim_link.loss)) {
+        link_stats.transmissions++;
+        link_stats.retransmits++;
+        ts += sim_link.retransmit_usec;
+    }
+
+    ts += sim_latency;
+    if (sim_link.jitter_usec)
+        ts += sim_rand() % (sim_link.jitter_usec + 1);
+
+    if (sim_chance(sim_link.reorder)) {
+        link_stats.reordered++;
+        ts += sim_link.reorder_usec;
+    }
+
+    if (dup_ts)
+        *dup_ts = -1;
+
+    // A duplicate is a spurious retransmit of a packet that got through.
+    if (sim_chance(sim_link.duplicate)) {
+        link_stats.transmissions++;
+        link_stats.duplicates++;
+        if (dup_ts)
+            *dup_ts = ts + sim_link.retransmit_usec;
+    }
+
+    return ts;
+}
+
+// Time at which a request sent at ts has been answered.
+static usec_timestamp_t sim_round_trip(usec_timestamp_t ts)
+{
+    return sim_transmit(sim_transmit(ts, 0), 0);
+}
+
+// Insert after all events with the same timestamp, so that
+// events are processed in the order they were scheduled.
+static void sim_schedule(usec_timestamp_t ts, uint8_t type, int peer,
+                         void* payload, payload_len_t payload_len)
+{
+    sim_event_t* event = (sim_event_t*) malloc(sizeof(sim_event_t));
+    sim_event_t** prev = &events;
+
+    event->ts = ts;
+    event->type = type;
+    event->peer = peer;
+    event->payload = payload;
+    event->payload_len = payload_len;
+
+    // Most events are scheduled a fixed latency ahead of the previous
+    // ones, or in a burst with the same timestamp.
+    if (events_tail && events_tail->ts <= ts)
+        prev = &events_tail->next;
+    else if (events_last && events_last->ts <= ts)
+        prev = &events_last->next;
+
+    while(*prev && (*prev)->ts <= ts)
+        prev = &(*prev)->next;
+
+    event->next = *prev;
+    *prev = event;
+
+    if (!event->next)
+        events_tail = event;
+
+    events_last = event;
+}
+
+static void sim_announce(void)
+{
+    uint32_t ind = 0;
+
+    // Peers that have not yet subscribed hear the announcement
+    // and set up a subscription.
+    for(ind = 0; peers_unsubscribed && ind < peer_count; ++ind) {
+        if (peers[ind].subscribed || peers[ind].subscribing)
+            continue;
+
+        peers[ind].subscribing = 1;
+        sim_schedule(sim_round_trip(sim_now), SIM_EVENT_PEER_SUBSCRIBED, ind, 0, 0);
+    }
+
+    sim_schedule(sim_now + announce_interval, SIM_EVENT_ANNOUNCE, -1, 0, 0);
+}
+
+static void sim_process_event(sim_event_t* event)
+{
+    sim_peer_t* peer = (event->peer >= 0)?&peers[event->peer]:0;
+    sim_packet_t* pack = 0;
+
+    switch(event->type) {
+    case SIM_EVENT_ANNOUNCE:
+        sim_announce();
+        break;
+
+    case SIM_EVENT_PEER_SUBSCRIBED:
+        peer->subscribing = 0;
+        peer->subscribed = 1;
+        peer->stats.subscribed_ts = sim_now;
+        peers_unsubscribed--;
+
+        // The peer tells us which functions it serves.
+        if (peer->functions_len)
+            dstc_transport_control_message(peer->node_id, peer->functions, peer->functions_len);
+        break;
+
+    case SIM_EVENT_NODE_SUBSCRIBED:
+        peer->stats.discovered_ts = sim_now;
+        dstc_transport_node_subscribed(peer->node_id);
+        break;
+
+    case SIM_EVENT_DELIVERED:
+        dstc_transport_packet_delivered(event->payload);
+        break;
+
+    case SIM_EVENT_INCOMING:
+        pack = (sim_packet_t*) malloc(sizeof(sim_packet_t));
+        pack->payload = event->payload;
+        pack->payload_len = event->payload_len;
+        pack->next = 0;
+
+        if (incoming_tail)
+            incoming_tail->next = pack;
+        else
+            incoming_head = pack;
+
+        incoming_tail = pack;
+        dstc_transport_packets_ready();
+        break;
+    }
+}
+
+static int dstc_sim_setup_transport(int epoll_fd)
+{
+    return 0;
+}
+
+static rmc_node_id_t dstc_sim_node_id(void)
+{
+    return DSTC_SIM_LOCAL_NODE_ID;
+}
+
+static usec_timestamp_t dstc_sim_now(void)
+{
+    return sim_now;
+}
+
+// Advance the virtual clock to the next event, unless it is more than
+// timeout msec away, and process all events due at that time.
+static int dstc_sim_process_events(int timeout)
+{
+    usec_timestamp_t timeout_ts = (timeout == -1)?-1:(sim_now + (usec_timestamp_t) timeout * 1000);
+
+    if (!events || (timeout_ts != -1 && events->ts > timeout_ts)) {
+        if (timeout_ts != -1)
+            sim_now = timeout_ts;
+
+        return ETIME;
+    }
+
+    if (events->ts > sim_now)
+        sim_now = events->ts;
+
+    while(events && events->ts <= sim_now) {
+        sim_event_t* event = events;
+
+        events = event->next;
+        if (!events)
+            events_tail = 0;
+
+        if (event == events_last)
+            events_last = 0;
+
+        sim_process_event(event);
+        free(event);
+    }
+    return 0;
+}
+
+// All simulated activity is driven through events.
+static usec_timestamp_t dstc_sim_get_next_timeout(void)
+{
+    return -1;
+}
+
+static void dstc_sim_process_timeout(void)
+{
+}
+
+static uint32_t dstc_sim_get_socket_count(void)
+{
+    return 0;
+}
+
+// Deliver the packet to all subscribed peers. It is reported as
+// delivered once the last peer has acknowledged it.
+static int dstc_sim_queue_packet(void* payload, payload_len_t payload_len)
+{
+    usec_timestamp_t delivered_ts = sim_now;
+    uint32_t calls = 0;
+    uint32_t ind = 0;
+
+    while(ind < payload_len) {
+        dstc_header_t* call = (dstc_header_t*) ((uint8_t*) payload + ind);
+
+        // A bulk record counts as one call per tuple.
+        calls += dstc_call_count(call);
+
+        ind += sizeof(dstc_header_t) + call->payload_len;
+    }
+
+    for(ind = 0; ind < peer_count; ++ind) {
+        usec_timestamp_t ack_ts = 0;
+
+        if (!peers[ind].subscribed)
+            continue;
+
+        peers[ind].stats.packets++;
+        peers[ind].stats.calls += calls;
+        peers[ind].stats.bytes += payload_len;
+
+        ack_ts = sim_round_trip(sim_now);
+        if (ack_ts > delivered_ts)
+            delivered_ts = ack_ts;
+    }
+
+    sim_schedule(delivered_ts, SIM_EVENT_DELIVERED, -1, payload, payload_len);
+    return 0;
+}
+
+static int dstc_sim_write_control_message(rmc_node_id_t node_id,
+                                          void* payload,
+                                          payload_len_t payload_len)
+{
+    // Peers call the local node through dstc_sim_peer_call(),
+    // and have no use for the functions it serves.
+    return 0;
+}
+
+static void dstc_sim_set_announce_interval(usec_timestamp_t interval)
+{
+    announce_interval = interval;
+
+    if (announce_scheduled)
+        return;
+
+    announce_scheduled = 1;
+    sim_schedule(sim_now + interval, SIM_EVENT_ANNOUNCE, -1, 0, 0);
+}
+
+static void* dstc_sim_next_packet(payload_len_t* payload_len)
+{
+    sim_packet_t* pack = incoming_head;
+    void* payload = 0;
+
+    if (!pack)
+        return 0;
+
+    incoming_head = pack->next;
+    if (!incoming_head)
+        incoming_tail = 0;
+
+    payload = pack->payload;
+    *payload_len = pack->payload_len;
+    free(pack);
+    return payload;
+}
+
+const dstc_transport_t dstc_sim_transport = {
+    .setup = dstc_sim_setup_transport,
+    .node_id = dstc_sim_node_id,
+    .now = dstc_sim_now,
+    .process_events = dstc_sim_process_events,
+    .get_next_timeout = dstc_sim_get_next_timeout,
+    .process_timeout = dstc_sim_process_timeout,
+    .get_socket_count = dstc_sim_get_socket_count,
+    .queue_packet = dstc_sim_queue_packet,
+    .write_control_message = dstc_sim_write_control_message,
+    .set_announce_interval = dstc_sim_set_announce_interval,
+    .next_packet = dstc_sim_next_packet,
+};
+
+int dstc_sim_setup(usec_timestamp_t latency_usec)
+{
+    int res = dstc_set_transport(&dstc_sim_transport);
+
+    if (res)
+        return res;
+
+    sim_latency = latency_usec;
+    return dstc_setup();
+}
+
+void dstc_sim_set_link(dstc_sim_link_t* link, uint64_t seed)
+{
+    sim_link = *link;
+    rand_state = seed?seed:1;
+}
+
+void dstc_sim_get_link_stats(dstc_sim_link_stats_t* stats)
+{
+    *stats = link_stats;
+}
+
+int dstc_sim_add_peer(char** function_names, uint32_t function_count)
+{
+    sim_peer_t* peer = 0;
+    uint32_t ind = 0;
+
+    if (peer_count == peer_size) {
+        peer_size = peer_size?peer_size * 2:64;
+        peers = realloc(peers, peer_size * sizeof(sim_peer_t));
+    }
+
+    peer = &peers[peer_count];
+    memset(peer, 0, sizeof(*peer));
+    peer->node_id = DSTC_SIM_PEER_NODE_ID + peer_count;
+    peer->stats.subscribed_ts = -1;
+    peer->stats.discovered_ts = -1;
+
+    for(ind = 0; ind < function_count; ++ind)
+        peer->functions_len += strlen(function_names[ind]) + 1;
+
+    peer->functions = malloc(peer->functions_len);
+    peer->functions_len = 0;
+    for(ind = 0; ind < function_count; ++ind) {
+        strcpy(peer->functions + peer->functions_len, function_names[ind]);
+        peer->functions_len += strlen(function_names[ind]) + 1;
+    }
+
+    peers_unsubscribed++;
+
+    // We hear the first announcement of the peer, and subscribe to it.
+    sim_schedule(sim_round_trip(sim_now), SIM_EVENT_NODE_SUBSCRIBED, peer_count, 0, 0);
+    return peer_count++;
+}
+
+uint32_t dstc_sim_get_peer_count(void)
+{
+    return peer_count;
+}
+
+rmc_node_id_t dstc_sim_get_peer_node_id(int peer)
+{
+    return peers[peer].node_id;
+}
+
+void dstc_sim_get_peer_stats(int peer, dstc_sim_peer_stats_t* stats)
+{
+    *stats = peers[peer].stats;
+}
+
+int dstc_sim_peer_call(int peer, char* name, void* arg, uint32_t arg_sz)
+{
+    uint32_t name_len = strlen(name);
+    payload_len_t payload_len = sizeof(dstc_header_t) + name_len + arg_sz;
+    usec_timestamp_t arrival_ts = 0;
+    usec_timestamp_t dup_ts = -1;
+    dstc_header_t* call = 0;
+
+    if (peer < 0 || peer >= peer_count)
+        return ENOENT;
+
+    if (name_len > 255 || sizeof(dstc_header_t) + name_len + arg_sz > RMC_MAX_PAYLOAD)
+        return EMSGSIZE;
+
+    call = (dstc_header_t*) dstc_transport_alloc_payload(payload_len);
+    call->payload_len = name_len + arg_sz;
+    call->node_id = peers[peer].node_id;
+    call->name_len = name_len;
+    call->flags = DSTC_PRIO_NORMAL;
+    memcpy(call->payload, name, name_len);
+    memcpy(call->payload + name_len, arg, arg_sz);
+
+    arrival_ts = sim_transmit(sim_now, &dup_ts);
+
+    // An unordered link hands the receiver every copy of the
+    // packet, in the order they arrive.
+    if (sim_link.unordered) {
+        if (dup_ts != -1) {
+            void* dup = dstc_transport_alloc_payload(payload_len);
+
+            memcpy(dup, call, payload_len);
+            sim_schedule(dup_ts, SIM_EVENT_INCOMING, peer, dup, payload_len);
+        }
+
+        sim_schedule(arrival_ts, SIM_EVENT_INCOMING, peer, call, payload_len);
+        return 0;
+    }
+
+    // Packets from a peer are delivered in order, so a late
+    // packet holds back the ones behind it.
+    if (arrival_ts < peers[peer].inbound_ts)
+        arrival_ts = peers[peer].inbound_ts;
+
+    peers[peer].inbound_ts = arrival_ts;
+    sim_schedule(arrival_ts, SIM_EVENT_INCOMING, peer, call, payload_len);
+    return 0;
+}
@@ -0,0 +1,80 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// In-memory DSTC transport, simulating a network of virtual peer
+// nodes around the local node. No sockets are used. All events are
+// driven by a virtual clock that advances only when the event loop
+// waits, which makes runs deterministic and as fast as the CPU allows.
+// See README.md for details.
+
+#ifndef __DSTC_SIM_H__
+#define __DSTC_SIM_H__
+#include "dstc.h"
+
+// Virtual node id of the local node. Peers are numbered from
+// DSTC_SIM_PEER_NODE_ID upward.
+#define DSTC_SIM_LOCAL_NODE_ID 1
+#define DSTC_SIM_PEER_NODE_ID 1000
+
+// Per peer counters, retrieved with dstc_sim_get_peer_stats().
+typedef struct {
+    uint64_t packets;                // Packets received from the local node
+    uint64_t calls;                  // Calls received from the local node
+    uint64_t bytes;
+    usec_timestamp_t subscribed_ts;  // Virtual time the peer subscribed to us. -1 = Not yet
+    usec_timestamp_t discovered_ts;  // Virtual time we subscribed to the peer. -1 = Not yet
+} dstc_sim_peer_stats_t;
+
+// Faults injected on the link between the local node and each peer.
+// The simulator does not run RMC. Lost transmissions are resent after
+// a fixed retransmit_usec, standing in for the recovery of a reliable
+// transport, and packets from peers are delivered to the local node in
+// order without duplicates. Loss and reordering thus show up as added
+// latency. Set unordered to hand duplicated and reordered packets from
+// peers to the local node as they arrive.
+typedef struct {
+    double loss;                      // Probability that a transmission is lost
+    double duplicate;                 // Probability that a packet is received twice
+    double reorder;                   // Probability that a packet is held back by reorder_usec
+    usec_timestamp_t jitter_usec;     // Uniformly distributed delay added to the latency
+    usec_timestamp_t reorder_usec;
+    usec_timestamp_t retransmit_usec; // Time until a lost transmission is resent
+    uint8_t unordered;                // Deliver duplicates, and packets out of order, to the local node
+} dstc_sim_link_t;
+
+// Link counters, retrieved with dstc_sim_get_link_stats().
+// Transmissions in both directions, including acknowledgements, are counted.
+typedef struct {
+    uint64_t transmissions;   // Including retransmits
+    uint64_t retransmits;
+    uint64_t duplicates;      // Discarded by the receiver, unless the link is unordered
+    uint64_t reordered;
+} dstc_sim_link_stats_t;
+
+extern const dstc_transport_t dstc_sim_transport;
+
+// Install the simulator as the transport and call dstc_setup().
+// latency_usec is the one way latency between the local node and each peer.
+extern int dstc_sim_setup(usec_timestamp_t latency_usec);
+
+// Set the link fault profile. seed makes the faults reproducible.
+extern void dstc_sim_set_link(dstc_sim_link_t* link, uint64_t seed);
+extern void dstc_sim_get_link_stats(dstc_sim_link_stats_t* stats);
+
+// Add a peer serving function_count functions. The peer
+// announces itself right away, and subscribes to the local
+// node at its next announcement. Returns the peer index.
+extern int dstc_sim_add_peer(char** function_names, uint32_t function_count);
+extern uint32_t dstc_sim_get_peer_count(void);
+extern rmc_node_id_t dstc_sim_get_peer_node_id(int peer);
+extern void dstc_sim_get_peer_stats(int peer, dstc_sim_peer_stats_t* stats);
+
+// Have a peer call a function served by the local node.
+// The call arrives after the latency of the link.
+extern int dstc_sim_peer_call(int peer, char* name, void* arg, uint32_t arg_sz);
+
+#endif // __DSTC_SIM_H__
@@ -29,8 +29,7 @@ void double_value_callback(int value)
 int main(int argc, char* argv[])
 {
     // Wait for function to become available on one or more servers.
-    while(!dstc_get_remote_count("double_value")) 
-        dstc_process_events(500000);
+    dstc_wait_for_remote("double_value", -1);
 
     // Make the call
     dstc_double_value(42, CLIENT_CALLBACK_ARG(double_value_callback,int,));
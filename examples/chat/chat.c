@@ -25,8 +25,10 @@ DSTC_CLIENT(chat_message, char, [128], char, [512])
 // above.
 // The deserializer decodes the incoming data and calls the
 // chat_chat_message() function in this file.
+// DSTC_SERVER_REF passes the arrays as pointers into the received
+// packet instead of copying them onto the stack.
 //
-DSTC_SERVER(chat_message, char, [128], char, [512])
+DSTC_SERVER_REF(chat_message, char, [128], char, [512])
 
 //
 // Handle keyboard input on stdin.  called by dstc_node since init()
@@ -59,7 +61,7 @@ static void handle_keyboard()
 // Process an incoming message with a message() function call.
 // Invoked by deserilisation code generated by DSTC_SERVER() above.
 //
-void chat_message(char username[128], char buf[512])
+void chat_message(const char username[128], const char buf[512])
 {
     printf("\r[%s]: %s\n", username, buf);
     printf("> ");
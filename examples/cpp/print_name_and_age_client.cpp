@@ -0,0 +1,31 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the 
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// C++ version of examples/print_name_and_age/print_name_and_age_client.c
+// Can call both the C and C++ servers.
+//
+
+#include <array>
+#include "dstc.hpp"
+
+// Same wire format as
+// DSTC_CLIENT(print_name_and_age, char, [32], int,)
+static const dstc::client<std::array<char, 32>, int> print_name_and_age("print_name_and_age");
+
+int main(int argc, char* argv[])
+{
+    std::array<char, 32> name = { "Bob Smith" };
+
+    // Wait for function to become available on one or more servers.
+    dstc_wait_for_remote((char*) "print_name_and_age", -1);
+
+    // Make the call
+    print_name_and_age(name, 25);
+
+    // Process events for another 100 msec to ensure that the call gets out.
+    dstc_process_events(100000);
+}
@@ -0,0 +1,28 @@
+// Copyright (C) 2018, Jaguar Land Rover
+// This program is licensed under the terms and conditions of the
+// Mozilla Public License, version 2.0.  The full text of the 
+// Mozilla Public License is at https://www.mozilla.org/MPL/2.0/
+//
+// Author: Magnus Feuer (mfeuer1@jaguarlandrover.com)
+//
+// C++ version of examples/print_name_and_age/print_name_and_age_server.c
+// Can be called by both the C and C++ clients.
+//
+
+#include <array>
+#include <cstdio>
+#include "dstc.hpp"
+
+// Same wire format as
+// DSTC_SERVER(print_name_and_age, char, [32], int,)
+dstc::server print_name_and_age("print_name_and_age",
+                                [](std::array<char, 32> name, int age) {
+                                    printf("Name: %s\n", name.data());
+                                    printf("Age:  %d\n", age);
+                                });
+
+int main(int argc, char* argv[])
+{
+    // Process incoming events for ever
+    dstc_process_events(-1);
+}
@@ -28,8 +28,7 @@ int main(int argc, char* argv[])
     }
 
     // Wait for function to become available on one or more servers.
-    while(!dstc_get_remote_count("test_dynamic_function"))
-        dstc_process_events(500000);
+    dstc_wait_for_remote("test_dynamic_function", -1);
 
     // Make the call
     dstc_test_dynamic_function(DYNAMIC_ARG(argv[1], strlen(argv[1])+1), second_array_arg);
@@ -22,8 +22,7 @@ DSTC_CLIENT(print_name_and_age, char, [32], int,)
 int main(int argc, char* argv[])
 {
     // Wait for function to become available on one or more servers.
-    while(!dstc_get_remote_count("print_name_and_age")) 
-        dstc_process_events(500000);
+    dstc_wait_for_remote("print_name_and_age", -1);
 
     // Make the call
     dstc_print_name_and_age("Bob Smith", 25);
@@ -24,8 +24,7 @@ int main(int argc, char* argv[])
     };
 
     // Wait for function to become available on one or more servers.
-    while(!dstc_get_remote_count("print_struct")) 
-        dstc_process_events(500000);
+    dstc_wait_for_remote("print_struct", -1);
 
     dstc_print_struct(arg);
 